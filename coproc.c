@@ -0,0 +1,324 @@
+#include <fcntl.h>
+#include <ctype.h>
+#include <time.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "events.h"
+#include "env.h"
+#include "coproc.h"
+
+typedef struct             /* A coprocess */
+{
+   char name[COPROCNAMELEN];   /* "" if the slot is unused */
+   int jid;
+   pid_t pgrp;             /* of its job, to tell it from a later one */
+   int inFd;               /* write end of its input, nonblocking */
+   int outFd;              /* read end of its output, nonblocking */
+   int quietMs;            /* 0 to wait for a line per query line */
+   long queries;
+   double answerMs;        /* total ms the answers took */
+} coprocT;
+
+static coprocT coprocs[MAXCOPROCS];
+static int linesLeft;       /* lines of the answer still to come */
+static int gotAnswer;       /* 1 once some of the answer came */
+static int ended;           /* 1 once the output of the coprocess closed */
+static double lastOutput;   /* when the answer last grew */
+
+//not needed outside of this file
+static coprocT * findCoproc(char * name, int len, jobT jobs[MAXJOBS]);
+static void listCoprocs(jobT jobs[MAXJOBS]);
+static void closeCoproc(coprocT * c);
+static void readAnswer(int fd, short revents, void * arg);
+static void noteWritable(int fd, short revents, void * arg);
+static int drain(coprocT * c);
+
+/* coprocCmd
+ * The coproc builtin (see coproc.h).  job is the job as typed:
+ * coproc [-q MS] NAME cmdline, coproc -c NAME or coproc.  The
+ * cmdline is started with run.
+ */
+void coprocCmd(char * job, coprocRunFn run, jobT jobs[MAXJOBS])
+{
+   char * p = job, * word, * name = NULL;
+   int i, quiet = 0, jid, in[2], out[2];
+   coprocT * c = NULL;
+
+   free(nextWord(&p));   //coproc
+   if ((word = nextWord(&p)) == NULL)
+   {
+      listCoprocs(jobs);
+      return;
+   }
+   if (strcmp(word, "-c") == 0)
+   {
+      free(word);
+      if ((word = nextWord(&p)) == NULL || (c = findCoproc(word, strlen(word), jobs)) == NULL)
+         printf("coproc: %s: no such coprocess\n", word != NULL ? word : "");
+      else closeCoproc(c);
+      free(word);
+      return;
+   }
+   if (strcmp(word, "-q") == 0)
+   {
+      free(word);
+      word = nextWord(&p);
+      quiet = word != NULL ? atoi(word) : 0;
+      free(word);
+      word = nextWord(&p);
+   }
+   name = word;
+   p += strspn(p, BLANKS);
+   if (name == NULL || *p == '\0' || quiet < 0)
+   {
+      printf("usage: coproc [-q MS] NAME cmdline | coproc -c NAME | coproc\n");
+      free(name);
+      return;
+   }
+   for (i = 0; name[i] == '_' || isalpha((unsigned char) name[i]) ||
+        (i > 0 && isdigit((unsigned char) name[i])); i++);
+   if (name[i] != '\0' || i >= COPROCNAMELEN)
+      printf("coproc: %s: bad name\n", name);
+   else if (findCoproc(name, strlen(name), jobs) != NULL)
+      printf("coproc: %s: already running\n", name);
+   else
+   {
+      for (i = 0; i < MAXCOPROCS && coprocs[i].name[0] != '\0'; i++);
+      if (i == MAXCOPROCS) printf("coproc: too many coprocesses\n");
+      else c = &coprocs[i];
+   }
+   if (c == NULL)
+   {
+      free(name);
+      return;
+   }
+   Pipe2(in, O_CLOEXEC);
+   Pipe2(out, O_CLOEXEC);
+   jid = run(p, in[0], out[1]);
+   close(in[0]);
+   close(out[1]);
+   if (jid < 0)
+   {
+      //a command run in ush (like echo) answered nothing and is over
+      fcntl(out[0], F_SETFL, O_NONBLOCK);
+      fflush(stdout);
+      close(in[1]);
+      c->outFd = out[0];
+      drain(c);
+      close(out[0]);
+      printf("coproc: %s: ended\n", name);
+      free(name);
+      return;
+   }
+   if (jid == 0 || getJobJid(jid, jobs) == NULL)
+   {
+      printf("coproc: %s: did not start\n", name);
+      close(in[1]);
+      close(out[0]);
+      free(name);
+      return;
+   }
+   fcntl(out[0], F_SETFL, O_NONBLOCK);
+   //a coprocess that stopped reading must not hang ush
+   fcntl(in[1], F_SETFL, O_NONBLOCK);
+   memset(c, 0, sizeof(coprocT));
+   strcpy(c->name, name);
+   c->jid = jid;
+   c->pgrp = getJobJid(jid, jobs)->pgrp;
+   c->inFd = in[1];
+   c->outFd = out[0];
+   c->quietMs = quiet;
+   free(name);
+}
+
+/* isCoprocQuery
+ * Returns 1 if job is NAME <<< query for a running coprocess.
+ */
+int isCoprocQuery(char * job, jobT jobs[MAXJOBS])
+{
+   char * mark = strstr(job, "<<<");
+   int start;
+
+   if (mark == NULL) return 0;
+   start = strspn(job, BLANKS);
+   while (mark > job + start && strchr(BLANKS, mark[-1]) != NULL) mark--;
+   return findCoproc(job + start, mark - job - start, jobs) != NULL;
+}
+
+/* coprocQuery
+ * Runs job, NAME <<< query (see isCoprocQuery): writes the query,
+ * with its variables expanded, as a line to the coprocess and its
+ * answer to stdout.  Writing the query and waiting for the answer
+ * take at most COPROCWAIT ms together.  Returns 0 if an answer
+ * came, or a wait status of exit status 1 (after saying why) if
+ * none did.  With -q the
+ * quiet window starts at the query, so a query answered by nothing
+ * takes MS ms.
+ */
+int coprocQuery(char * job, jobT jobs[MAXJOBS])
+{
+   char * mark = strstr(job, "<<<"), * query, * line;
+   int start = strspn(job, BLANKS), len, n, ms, off = 0, stuck = 0;
+   double begin, now, deadline;
+   coprocT * c;
+
+   for (len = mark - job; len > start && strchr(BLANKS, job[len - 1]) != NULL; len--);
+   c = findCoproc(job + start, len - start, jobs);
+   mark += 3;
+   mark += strspn(mark, " \t");
+   query = expandVars(mark);
+   if (query == NULL) query = strdup(mark);
+   len = strlen(query);
+   line = Malloc(len + 2);
+   sprintf(line, "%s\n", query);
+   free(query);
+   //what it wrote since the last answer is not part of this one
+   fflush(stdout);
+   ended = drain(c);
+   begin = lastOutput = seconds();
+   deadline = begin + COPROCWAIT / 1000.0;
+   while (!ended && !stuck && off <= len && (n = write(c->inFd, line + off, len + 1 - off)) != 0)
+   {
+      if (n > 0) off += n;
+      else if (errno == EAGAIN)
+      {
+         //its input pipe is full; wait until it reads some
+         ms = (deadline - seconds()) * 1000;
+         if (ms <= 0) stuck = 1;
+         else
+         {
+            addEvent(c->inFd, POLLOUT, noteWritable, NULL);
+            runEvents(ms);
+            removeEvent(c->inFd);
+         }
+      }
+      else if (errno != EINTR) ended = 1;
+   }
+   free(line);
+   if (stuck)
+   {
+      printf("coproc: %s: not reading its input\n", c->name);
+      return 1 << 8;
+   }
+   linesLeft = 1;
+   gotAnswer = 0;
+   addEvent(c->outFd, POLLIN, readAnswer, c);
+   while (!ended)
+   {
+      now = seconds();
+      if (c->quietMs == 0 && linesLeft <= 0) break;
+      //with -q, saying nothing for the window is an empty answer
+      if (c->quietMs > 0)
+         ms = (lastOutput + c->quietMs / 1000.0 - now) * 1000;
+      else ms = (deadline - now) * 1000;
+      if (ms <= 0) break;
+      runEvents(ms);
+   }
+   removeEvent(c->outFd);
+   if (gotAnswer || (c->quietMs > 0 && !ended))
+   {
+      c->queries++;
+      c->answerMs += (lastOutput - begin) * 1000;
+      return 0;
+   }
+   if (ended)
+   {
+      printf("coproc: %s: ended\n", c->name);
+      closeCoproc(c);
+   } else printf("coproc: %s: no answer in %dms\n", c->name, COPROCWAIT);
+   return 1 << 8;
+}
+
+/* findCoproc
+ * Returns the running coprocess whose name is the len bytes at
+ * name, or NULL.  One whose job is gone is closed on the way.
+ */
+static coprocT * findCoproc(char * name, int len, jobT jobs[MAXJOBS])
+{
+   int i;
+   jobT * job;
+   coprocT * c;
+
+   for (i = 0; i < MAXCOPROCS; i++)
+   {
+      c = &coprocs[i];
+      if (c->name[0] == '\0') continue;
+      job = getJobJid(c->jid, jobs);
+      if (job == NULL || job->pgrp != c->pgrp) closeCoproc(c);
+      else if (strncmp(c->name, name, len) == 0 && c->name[len] == '\0') return c;
+   }
+   return NULL;
+}
+
+/* listCoprocs
+ * Prints the running coprocesses.
+ */
+static void listCoprocs(jobT jobs[MAXJOBS])
+{
+   int i;
+   coprocT * c;
+
+   findCoproc("", 0, jobs);   //drops the ones that are gone
+   printf("NAME             JID  QUERIES   AVG MS  COMMAND\n");
+   for (i = 0; i < MAXCOPROCS; i++)
+   {
+      c = &coprocs[i];
+      if (c->name[0] == '\0') continue;
+      printf("%-15s %4d %8ld ", c->name, c->jid, c->queries);
+      if (c->queries > 0) printf("%8.2f", c->answerMs / c->queries);
+      else printf("%8s", "-");
+      printf("  %s\n", getJobJid(c->jid, jobs)->cmdline);
+   }
+}
+
+/* closeCoproc
+ * Closes the pipes of c, which ends most commands, and frees its
+ * slot.
+ */
+static void closeCoproc(coprocT * c)
+{
+   close(c->inFd);
+   close(c->outFd);
+   c->name[0] = '\0';
+}
+
+/* readAnswer
+ * Event handler for the output of the coprocess being queried:
+ * writes what it wrote to stdout and counts the lines of the
+ * answer.
+ */
+static void readAnswer(int fd, short revents, void * arg)
+{
+   char buf[COPROCREAD];
+   int n = read(fd, buf, sizeof(buf)), i;
+
+   if (n > 0)
+   {
+      gotAnswer = 1;
+      lastOutput = seconds();
+      for (i = 0; i < n; i++) linesLeft -= (buf[i] == '\n');
+      write(1, buf, n);
+   }
+   else if (n == 0 || (errno != EAGAIN && errno != EINTR)) ended = 1;
+}
+
+/* noteWritable
+ * Event handler for the input pipe of a coprocess that was full:
+ * it only wakes up the event loop.
+ */
+static void noteWritable(int fd, short revents, void * arg)
+{
+}
+
+/* drain
+ * Writes to stdout what c wrote that has not been read yet.
+ * Returns 1 if its output is closed.
+ */
+static int drain(coprocT * c)
+{
+   char buf[COPROCREAD];
+   int n;
+
+   while ((n = read(c->outFd, buf, sizeof(buf))) > 0) write(1, buf, n);
+   return n == 0 || (errno != EAGAIN && errno != EINTR);
+}
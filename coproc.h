@@ -0,0 +1,34 @@
+/*
+ *  Coprocesses: long lived commands that answer queries.
+ *  coproc [-q MS] NAME cmdline starts cmdline as a background job
+ *  reading from and writing to pipes held by ush, so a tool with a
+ *  slow startup (an interpreter, a database client) starts once per
+ *  session.  NAME <<< query then writes the query as a line to the
+ *  coprocess and writes its answer out: as many lines as the query
+ *  had, or with -q, all it writes until it is quiet for MS ms (which
+ *  suits commands that answer some queries with nothing).  An
+ *  answer that does not come within COPROCWAIT ms is given up on.
+ *  Output written between queries comes out before the next answer.
+ *  The command must not buffer its output when it is a pipe (use
+ *  python3 -u, stdbuf -oL and the like).
+ *  coproc lists the coprocesses and coproc -c NAME closes the input
+ *  of one, which ends most commands.  A coprocess is a background
+ *  job: jobs lists it and kill ends it.  Since queries wait on it,
+ *  it runs with the FG scheduling policy and is never throttled
+ *  (see pressure.h), and a query gives up on a coprocess that does
+ *  not read its input within COPROCWAIT ms as well.
+ */
+
+#define MAXCOPROCS 16
+#define COPROCNAMELEN 32
+#define COPROCWAIT 10000      /* ms to wait for an answer */
+#define COPROCREAD 4096       /* bytes read from a coprocess at once */
+
+/* starts cmdline as a background job reading inFd and writing
+ * outFd; returns its jid, 0 if it did not start or -1 if it ran
+ * in ush and is over */
+typedef int (*coprocRunFn)(char * cmdline, int inFd, int outFd);
+
+void coprocCmd(char * job, coprocRunFn run, jobT jobs[MAXJOBS]);
+int isCoprocQuery(char * job, jobT jobs[MAXJOBS]);
+int coprocQuery(char * job, jobT jobs[MAXJOBS]);
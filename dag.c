@@ -0,0 +1,463 @@
+#include <time.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "pstat.h"
+#include "dag.h"
+
+#define DAGPOLL 100        /* ms between checks for input */
+
+/* Task states */
+#define TASKWAIT 0         /* waiting on deps */
+#define TASKREADY 1        /* deps done, in the ready queue */
+#define TASKRUN 2          /* running as a job */
+#define TASKOK 3           /* exited 0 */
+#define TASKFAIL 4         /* failed or killed */
+#define TASKSKIP 5         /* depends on a failed task */
+
+typedef struct             /* A task of the dag */
+{
+   char * name;
+   char * cmdline;
+   char ** depNames;       /* deps as named in the spec */
+   int * deps;             /* indexes of the deps */
+   int depCnt;
+   int * next;             /* indexes of the tasks that depend on it */
+   int nextCnt;
+   int waiting;            /* deps not done yet */
+   int state;              /* TASKWAIT, ... */
+   int jid;                /* job of the task while it runs */
+   int status;             /* wait status; -1 if it could not start */
+   double start, end;      /* seconds since the dag started */
+   double path;            /* length of the longest chain ending here */
+   int pathPrev;           /* the dep before it on that chain; -1 if none */
+} taskT;
+
+static taskT * tasks = NULL;
+static int taskCnt = 0;
+static int * ready = NULL;  /* FIFO of ready tasks */
+static int readyHead = 0, readyTail = 0;
+static int running = 0;
+static int stopping = 0;    /* 1 once no new tasks are started */
+static int keepGoing = 0;
+static int limit = 1;       /* most tasks running at once */
+static int active = 0;      /* 1 while a dag runs */
+static double startTime;
+static jobT * jobList = NULL;
+static dagRunFn runFn = NULL;
+
+//not needed outside of this file
+static int readSpec(char * path);
+static int linkTasks(int * order);
+static void startReady();
+static void startTask(int i);
+static void taskDone(int i, int status);
+static void skipTask(int i);
+static void report(int * order);
+static char * statusStr(taskT * t, char * buf, int size);
+static void freeTasks();
+
+/* dagCmd
+ * The dag builtin (see dag.h).  Tasks are started with run and
+ * the event loop is run with wait until all the started tasks
+ * are reaped.
+ */
+void dagCmd(char ** args, jobT jobs[MAXJOBS], dagRunFn run, watchFn wait)
+{
+   int i, * order;
+   char * path = NULL;
+
+   if (active)
+   {
+      printf("dag: a dag is already running\n");
+      return;
+   }
+   keepGoing = 0;
+   limit = getJobLimit();
+   for (i = 1; args[i] != NULL; i++)
+   {
+      if (strcmp(args[i], "-k") == 0) keepGoing = 1;
+      else if (strcmp(args[i], "-j") == 0 && args[i + 1] != NULL)
+         limit = atoi(args[++i]);
+      else if (args[i][0] != '-' && path == NULL) path = args[i];
+      else
+      {
+         path = NULL;
+         break;
+      }
+   }
+   if (path == NULL || limit < 1)
+   {
+      printf("usage: dag [-j N] [-k] specfile\n");
+      return;
+   }
+   if (!readSpec(path))
+   {
+      freeTasks();
+      return;
+   }
+   order = Malloc((taskCnt + 1) * sizeof(int));
+   ready = Malloc((taskCnt + 1) * sizeof(int));
+   readyHead = readyTail = running = stopping = 0;
+   if (!linkTasks(order))
+   {
+      free(order);
+      freeTasks();
+      return;
+   }
+   active = 1;
+   jobList = jobs;
+   runFn = run;
+   startTime = seconds();
+   for (i = 0; i < taskCnt; i++)
+   {
+      if (tasks[i].waiting > 0) continue;
+      tasks[i].state = TASKREADY;
+      ready[readyTail++] = i;
+   }
+   //tasks are started as their deps are reaped (see taskDone)
+   startReady();
+   while (running > 0)
+   {
+      //lines of a script or a pipe are the commands after the dag
+      if (!stopping && !wait(DAGPOLL, isatty(0)))
+      {
+         stopping = 1;
+         printf("dag: stopped, waiting for %d running tasks\n", running);
+      }
+      else if (stopping) wait(DAGPOLL, 0);
+      //a job entry may have been freed by a job that is not a task
+      startReady();
+   }
+   active = 0;
+   report(order);
+   free(order);
+   freeTasks();
+}
+
+/* dagJobDone
+ * Called when the job with jid was reaped with the wait status of
+ * its last command, to finish the task it belongs to.
+ */
+void dagJobDone(int jid, int status)
+{
+   int i;
+
+   if (!active) return;
+   for (i = 0; i < taskCnt; i++)
+   {
+      if (tasks[i].state == TASKRUN && tasks[i].jid == jid)
+      {
+         taskDone(i, status);
+         return;
+      }
+   }
+}
+
+/* readSpec
+ * Reads the tasks of the spec file at path.  Returns 0 (after
+ * saying why) if it cannot be read or has a bad line.
+ */
+static int readSpec(char * path)
+{
+   FILE * fp = fopen(path, "r");
+   char * line = NULL, * p, * colon, * word;
+   size_t cap = 0;
+   int lineNo = 0, len, ok = 1;
+   taskT * t;
+
+   if (fp == NULL)
+   {
+      printf("dag: %s: %s\n", path, strerror(errno));
+      return 0;
+   }
+   while (getline(&line, &cap, fp) > 0)
+   {
+      lineNo++;
+      p = line + strspn(line, BLANKS);
+      if (*p == '\0' || *p == '#') continue;
+      if ((colon = strchr(p, ':')) == NULL)
+      {
+         printf("dag: %s:%d: expected name [dep ...] : cmdline\n", path, lineNo);
+         ok = 0;
+         break;
+      }
+      *colon = '\0';
+      tasks = realloc(tasks, (taskCnt + 1) * sizeof(taskT));
+      if (tasks == NULL) unixError("realloc error");
+      t = &tasks[taskCnt++];
+      memset(t, 0, sizeof(taskT));
+      t->status = -1;
+      t->pathPrev = -1;
+      //the first word is the name, the rest are deps
+      while (*(p += strspn(p, BLANKS)) != '\0')
+      {
+         len = strcspn(p, BLANKS);
+         word = strndup(p, len);
+         p += len;
+         if (t->name == NULL)
+         {
+            t->name = word;
+            continue;
+         }
+         t->depNames = realloc(t->depNames, (t->depCnt + 1) * sizeof(char *));
+         if (t->depNames == NULL) unixError("realloc error");
+         t->depNames[t->depCnt++] = word;
+      }
+      p = colon + 1 + strspn(colon + 1, BLANKS);
+      p[strcspn(p, "\n\r")] = '\0';
+      t->cmdline = strdup(p);
+      if (t->name == NULL || *p == '\0')
+      {
+         printf("dag: %s:%d: expected name [dep ...] : cmdline\n", path, lineNo);
+         ok = 0;
+         break;
+      }
+   }
+   free(line);
+   fclose(fp);
+   if (ok && taskCnt == 0) printf("dag: %s: no tasks\n", path);
+   return ok && taskCnt > 0;
+}
+
+/* linkTasks
+ * Resolves the deps of the tasks and fills order with the tasks
+ * in an order that has every task after its deps.  Returns 0
+ * (after saying why) on an unknown dep, a duplicate name or a
+ * cycle.
+ */
+static int linkTasks(int * order)
+{
+   int i, j, k, n = 0, head = 0, * waiting;
+   taskT * t;
+
+   for (i = 0; i < taskCnt; i++)
+   {
+      t = &tasks[i];
+      for (j = 0; j < i; j++)
+      {
+         if (strcmp(tasks[j].name, t->name) == 0)
+         {
+            printf("dag: task %s is defined twice\n", t->name);
+            return 0;
+         }
+      }
+      t->deps = Malloc((t->depCnt + 1) * sizeof(int));
+      for (j = 0; j < t->depCnt; j++)
+      {
+         for (k = 0; k < taskCnt && strcmp(tasks[k].name, t->depNames[j]); k++);
+         if (k == taskCnt)
+         {
+            printf("dag: task %s depends on unknown task %s\n", t->name,
+                   t->depNames[j]);
+            return 0;
+         }
+         t->deps[j] = k;
+         tasks[k].next = realloc(tasks[k].next, (tasks[k].nextCnt + 1) *
+                                 sizeof(int));
+         if (tasks[k].next == NULL) unixError("realloc error");
+         tasks[k].next[tasks[k].nextCnt++] = i;
+      }
+      t->waiting = t->depCnt;
+   }
+   //Kahn's algorithm; tasks left over are on a cycle
+   waiting = Malloc((taskCnt + 1) * sizeof(int));
+   for (i = 0; i < taskCnt; i++)
+   {
+      waiting[i] = tasks[i].waiting;
+      if (waiting[i] == 0) order[n++] = i;
+   }
+   for (head = 0; head < n; head++)
+   {
+      t = &tasks[order[head]];
+      for (j = 0; j < t->nextCnt; j++)
+         if (--waiting[t->next[j]] == 0) order[n++] = t->next[j];
+   }
+   if (n < taskCnt)
+   {
+      printf("dag: cycle among:");
+      for (i = 0; i < taskCnt; i++)
+         if (waiting[i] > 0) printf(" %s", tasks[i].name);
+      printf("\n");
+   }
+   free(waiting);
+   return n == taskCnt;
+}
+
+/* startReady
+ * Starts ready tasks while fewer than limit run and there are
+ * free job entries (one stays free for a foreground job).
+ */
+static void startReady()
+{
+   static int starting = 0;
+
+   //a builtin task finishes inside startTask, which calls us again
+   if (starting) return;
+   starting = 1;
+   while (!stopping && readyHead < readyTail && running < limit)
+   {
+      if (freeJobs(jobList) <= 1)
+      {
+         if (running == 0)
+         {
+            printf("dag: no free job entries\n");
+            stopping = 1;
+         }
+         break;
+      }
+      startTask(ready[readyHead++]);
+   }
+   starting = 0;
+}
+
+/* startTask
+ * Starts task i.
+ */
+static void startTask(int i)
+{
+   taskT * t = &tasks[i];
+   int status = 0;
+
+   t->state = TASKRUN;
+   t->start = seconds() - startTime;
+   running++;
+   t->jid = runFn(t->cmdline, &status);
+   //a finished task is done already, and one that could not start failed
+   if (t->jid == 0) taskDone(i, status);
+   else if (t->jid < 0) taskDone(i, -1);
+}
+
+/* taskDone
+ * Finishes the running task i, which ended with wait status
+ * status, and readies the tasks waiting on it.
+ */
+static void taskDone(int i, int status)
+{
+   taskT * t = &tasks[i];
+   char buf[32];
+   int j, n;
+
+   t->end = seconds() - startTime;
+   t->status = status;
+   running--;
+   if (status == 0)
+   {
+      t->state = TASKOK;
+      for (j = 0; j < t->nextCnt; j++)
+      {
+         n = t->next[j];
+         if (--tasks[n].waiting == 0 && tasks[n].state == TASKWAIT)
+         {
+            tasks[n].state = TASKREADY;
+            ready[readyTail++] = n;
+         }
+      }
+      startReady();
+      return;
+   }
+   t->state = TASKFAIL;
+   printf("dag: %s %s after %.1fs\n", t->name, statusStr(t, buf, sizeof(buf)),
+          t->end - t->start);
+   if (!keepGoing) stopping = 1;
+   for (j = 0; j < t->nextCnt; j++) skipTask(t->next[j]);
+}
+
+/* skipTask
+ * Marks task i and the tasks that depend on it as skipped.
+ */
+static void skipTask(int i)
+{
+   int j;
+
+   if (tasks[i].state == TASKSKIP) return;
+   tasks[i].state = TASKSKIP;
+   for (j = 0; j < tasks[i].nextCnt; j++) skipTask(tasks[i].next[j]);
+}
+
+/* report
+ * Prints how each task ended and how long it took, then the
+ * critical path: the chain of deps with the longest total time.
+ * order has the tasks after their deps.
+ */
+static void report(int * order)
+{
+   int i, j, k, last = -1, done = 0, * chain;
+   char buf[32];
+   taskT * t;
+
+   printf("%-16s %-12s %8s %8s\n", "TASK", "STATUS", "START", "TIME");
+   for (i = 0; i < taskCnt; i++)
+   {
+      t = &tasks[order[i]];
+      if (t->state == TASKOK || t->state == TASKFAIL)
+      {
+         done++;
+         printf("%-16s %-12s %7.1fs %7.1fs\n", t->name,
+                statusStr(t, buf, sizeof(buf)), t->start, t->end - t->start);
+         t->path = t->end - t->start;
+         for (j = 0; j < t->depCnt; j++)
+         {
+            k = t->deps[j];
+            if (tasks[k].path + t->end - t->start > t->path)
+            {
+               t->path = tasks[k].path + t->end - t->start;
+               t->pathPrev = k;
+            }
+         }
+         if (last < 0 || t->path > tasks[last].path) last = order[i];
+      }
+      else printf("%-16s %s\n", t->name,
+                  t->state == TASKSKIP ? "skipped" : "not run");
+   }
+   printf("dag: %d of %d tasks ran in %.1fs\n", done, taskCnt,
+          seconds() - startTime);
+   if (last < 0) return;
+   //walk the chain back from its end, then print it from the start
+   chain = Malloc((taskCnt + 1) * sizeof(int));
+   for (k = 0; last >= 0; last = tasks[last].pathPrev) chain[k++] = last;
+   printf("critical path:");
+   for (i = k - 1; i >= 0; i--)
+      printf(" %s (%.1fs)%s", tasks[chain[i]].name,
+             tasks[chain[i]].end - tasks[chain[i]].start, i ? " ->" : "");
+   printf(" = %.1fs\n", tasks[chain[0]].path);
+   free(chain);
+}
+
+
+/* statusStr
+ * Formats how task t ended into buf: ok, exit N, killed (SIG)
+ * or failed to start.
+ */
+static char * statusStr(taskT * t, char * buf, int size)
+{
+   if (t->status == -1) snprintf(buf, size, "not started");
+   else if (WIFEXITED(t->status) && WEXITSTATUS(t->status) == 0)
+      snprintf(buf, size, "ok");
+   else if (WIFEXITED(t->status))
+      snprintf(buf, size, "exit %d", WEXITSTATUS(t->status));
+   else snprintf(buf, size, "signal %d", WTERMSIG(t->status));
+   return buf;
+}
+
+/* freeTasks
+ * Frees the tasks.
+ */
+static void freeTasks()
+{
+   int i, j;
+
+   for (i = 0; i < taskCnt; i++)
+   {
+      free(tasks[i].name);
+      free(tasks[i].cmdline);
+      for (j = 0; j < tasks[i].depCnt; j++) free(tasks[i].depNames[j]);
+      free(tasks[i].depNames);
+      free(tasks[i].deps);
+      free(tasks[i].next);
+   }
+   free(tasks);
+   free(ready);
+   tasks = NULL;
+   ready = NULL;
+   taskCnt = 0;
+}
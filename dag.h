@@ -0,0 +1,24 @@
+/*
+ *  The dag builtin: runs the tasks of a spec file in dependency
+ *  order, as many at once as allowed.
+ *  dag [-j N] [-k] specfile
+ *  Each line of the spec is a task: name [dep ...] : cmdline.
+ *  Blank lines and lines starting with # are skipped.  A task is
+ *  started as a background job the moment the last of its deps is
+ *  reaped, so the jobs array tracks the tasks and jobs shows them.
+ *  At most N tasks (the job limit by default) run at once.
+ *  When a task fails no new tasks are started; with -k the tasks
+ *  that do not depend on it still run.  A line typed at a terminal
+ *  stops the dag the same way; input from a script or a pipe is
+ *  left for after the dag.  At the end the time of each task and the
+ *  critical path, the chain of tasks that took the longest, are
+ *  printed.
+ */
+
+/* runs cmdline as a background job; returns its jid, 0 if it
+ * already finished (a builtin, or a job run in ush) with its wait
+ * status in status, or -1 if it could not start */
+typedef int (*dagRunFn)(char * cmdline, int * status);
+
+void dagCmd(char ** args, jobT jobs[MAXJOBS], dagRunFn run, watchFn wait);
+void dagJobDone(int jid, int status);
@@ -0,0 +1,321 @@
+#include <ctype.h>
+#include "wrappers.h"
+#include "env.h"
+#include "wildcard.h"
+
+typedef struct             /* A slot of the variable hash map */
+{
+   char * pair;            /* "NAME=value" or NULL if the slot is free */
+   int nameLen;            /* length of NAME */
+   int exported;           /* 1 if the variable is in the environment */
+   int deleted;            /* 1 if the variable was unset (a tombstone) */
+} varT;
+
+static varT * vars = NULL;
+static int slots = 0;      /* size of vars, a power of 2 */
+static int used = 0;       /* slots holding a variable or a tombstone */
+static int version = 0;    /* changed whenever the environment changes */
+static int blockVersion = -1;
+static char ** block = NULL;   /* the envp block of version blockVersion */
+static long blockBytes = 0;    /* bytes block takes up in an exec */
+
+//not needed outside of this file
+static varT * findSlot(const char * name, int len, int insert);
+static unsigned long hashName(const char * name, int len);
+static void growVars();
+static int nameLength(const char * word);
+
+/* initEnv
+ * Fills the hash map with the environment the shell got.
+ */
+void initEnv()
+{
+   extern char ** environ;
+   int i;
+
+   slots = ENVINITSIZE;
+   vars = calloc(slots, sizeof(varT));
+   if (vars == NULL) unixError("calloc error");
+   for (i = 0; environ[i] != NULL; i++)
+      if (strchr(environ[i], '=') != NULL) assignVar(environ[i], 1);
+}
+
+/* getVar
+ * Returns the value of variable name or NULL if it is not set.
+ */
+char * getVar(const char * name)
+{
+   varT * v = findSlot(name, strlen(name), 0);
+   return v == NULL ? NULL : v->pair + v->nameLen + 1;
+}
+
+/* setVar
+ * Sets variable name to value.  If export is 1 the variable
+ * is exported; otherwise it keeps its exported flag.
+ */
+void setVar(const char * name, const char * value, int export)
+{
+   int len = strlen(name), vlen = strlen(value);
+   varT * v = findSlot(name, len, 1);
+
+   if (v->pair == NULL && !v->deleted) used++;
+   if (v->pair == NULL) v->exported = 0;
+   else free(v->pair);
+   v->pair = Malloc(len + vlen + 2);
+   memcpy(v->pair, name, len);
+   v->pair[len] = '=';
+   memcpy(v->pair + len + 1, value, vlen + 1);
+   v->nameLen = len;
+   v->deleted = 0;
+   v->exported |= export;
+   if (v->exported) version++;
+   if (used * 10 > slots * 7) growVars();
+}
+
+/* exportVar
+ * Exports variable name. Returns 0 if it is not set.
+ */
+int exportVar(const char * name)
+{
+   varT * v = findSlot(name, strlen(name), 0);
+
+   if (v == NULL) return 0;
+   if (!v->exported) version++;
+   v->exported = 1;
+   return 1;
+}
+
+/* unsetVar
+ * Removes variable name.
+ */
+void unsetVar(const char * name)
+{
+   varT * v = findSlot(name, strlen(name), 0);
+
+   if (v == NULL) return;
+   if (v->exported) version++;
+   free(v->pair);
+   v->pair = NULL;
+   v->exported = 0;
+   v->deleted = 1;
+}
+
+/* isAssignment
+ * Returns 1 if word has the form NAME=value.
+ */
+int isAssignment(const char * word)
+{
+   int len = nameLength(word);
+   return len > 0 && word[len] == '=';
+}
+
+/* assignVar
+ * Carries out an assignment NAME=value (see setVar).
+ */
+void assignVar(const char * word, int export)
+{
+   int len = nameLength(word);
+   char * name;
+
+   if (len == 0 || word[len] != '=') return;
+   name = strndup(word, len);
+   setVar(name, &word[len + 1], export);
+   free(name);
+}
+
+/* envBlock
+ * Returns the NULL ended envp block of the exported variables.
+ * The block is only rebuilt after the environment changed, and
+ * only pointers are copied: the strings are the ones in the map.
+ * The block must not be changed or freed by the caller and is
+ * only valid until the environment changes.
+ */
+char ** envBlock()
+{
+   int i, n = 0;
+
+   if (blockVersion == version) return block;
+   free(block);
+   block = Malloc((used + 1) * sizeof(char *));
+   blockBytes = sizeof(char *);
+   for (i = 0; i < slots; i++)
+   {
+      if (vars[i].pair != NULL && vars[i].exported)
+      {
+         block[n++] = vars[i].pair;
+         blockBytes += strlen(vars[i].pair) + 1 + sizeof(char *);
+      }
+   }
+   block[n] = NULL;
+   blockVersion = version;
+   return block;
+}
+
+/* envBytes
+ * Returns the space the environment takes up in an exec.
+ */
+long envBytes()
+{
+   envBlock();
+   return blockBytes;
+}
+
+/* envOverlay
+ * Returns an envp block for a command run with the cnt
+ * assignments in assigns as prefixes (VAR=value cmd).  The
+ * pointers of envBlock() are copied, leaving out the variables
+ * that are assigned, and the assignments are added.  The caller
+ * frees the returned array (but not the strings).
+ */
+char ** envOverlay(char ** assigns, int cnt)
+{
+   char ** base = envBlock();
+   char ** envp;
+   int i, j, n = 0, len;
+
+   for (i = 0; base[i] != NULL; i++);
+   envp = Malloc((i + cnt + 1) * sizeof(char *));
+   for (i = 0; base[i] != NULL; i++)
+   {
+      len = strchr(base[i], '=') - base[i] + 1;
+      for (j = 0; j < cnt && strncmp(base[i], assigns[j], len) != 0; j++);
+      if (j == cnt) envp[n++] = base[i];
+   }
+   for (j = 0; j < cnt; j++) envp[n++] = assigns[j];
+   envp[n] = NULL;
+   return envp;
+}
+
+/* expandVars
+ * Returns word with $NAME and ${NAME} replaced by the values
+ * of the variables (nothing if a variable is not set), in new
+ * space. Returns NULL if word has no $ in it.
+ */
+char * expandVars(const char * word)
+{
+   int cap, len = 0, nlen, vlen, brace;
+   char * out, * name, * value;
+
+   if (strchr(word, '$') == NULL) return NULL;
+   cap = strlen(word) + 64;
+   out = Malloc(cap);
+   while (*word != '\0')
+   {
+      brace = (word[0] == '$' && word[1] == '{');
+      nlen = (word[0] == '$') ? nameLength(word + 1 + brace) : 0;
+      if (nlen > 0 && brace && word[2 + nlen] != '}') nlen = 0;
+      value = NULL;
+      if (nlen > 0)
+      {
+         name = strndup(word + 1 + brace, nlen);
+         value = getVar(name);
+         free(name);
+         word += 1 + brace + nlen + brace;
+      } else word++;
+      vlen = (nlen > 0) ? (value ? strlen(value) : 0) : 1;
+      if (len + vlen + 1 > cap)
+      {
+         cap = 2 * (len + vlen + 1);
+         out = realloc(out, cap);
+         if (out == NULL) unixError("realloc error");
+      }
+      if (nlen > 0) memcpy(out + len, value ? value : "", vlen);
+      else out[len] = word[-1];
+      len += vlen;
+   }
+   out[len] = '\0';
+   return out;
+}
+
+/* printExported
+ * Outputs the exported variables, sorted by name.
+ */
+void printExported()
+{
+   char ** env = envBlock();
+   char ** sorted;
+   int i, n;
+
+   for (n = 0; env[n] != NULL; n++);
+   sorted = Malloc((n + 1) * sizeof(char *));
+   memcpy(sorted, env, (n + 1) * sizeof(char *));
+   sortStrings(sorted, n);
+   for (i = 0; i < n; i++) printf("export %s\n", sorted[i]);
+   free(sorted);
+}
+
+/* findSlot
+ * Returns the slot of the variable whose name is the first len
+ * characters of name.  If the variable is not set, returns NULL,
+ * or if insert is 1 the slot where it should be put.
+ */
+static varT * findSlot(const char * name, int len, int insert)
+{
+   unsigned long i = hashName(name, len) & (slots - 1);
+   varT * tomb = NULL, * v;
+
+   while (1)
+   {
+      v = &vars[i];
+      if (v->pair == NULL)
+      {
+         if (!v->deleted) return insert ? (tomb ? tomb : v) : NULL;
+         if (tomb == NULL) tomb = v;
+      } else if (v->nameLen == len && memcmp(v->pair, name, len) == 0)
+         return v;
+      i = (i + 1) & (slots - 1);
+   }
+}
+
+/* hashName
+ * FNV-1a hash of the first len characters of name.
+ */
+static unsigned long hashName(const char * name, int len)
+{
+   unsigned long h = 14695981039346656037UL;
+   int i;
+
+   for (i = 0; i < len; i++)
+   {
+      h ^= (unsigned char) name[i];
+      h *= 1099511628211UL;
+   }
+   return h;
+}
+
+/* growVars
+ * Doubles the hash map, dropping the tombstones.
+ */
+static void growVars()
+{
+   varT * old = vars;
+   int i, oldSlots = slots;
+   varT * v;
+
+   slots *= 2;
+   vars = calloc(slots, sizeof(varT));
+   if (vars == NULL) unixError("calloc error");
+   used = 0;
+   for (i = 0; i < oldSlots; i++)
+   {
+      if (old[i].pair == NULL) continue;
+      v = findSlot(old[i].pair, old[i].nameLen, 1);
+      *v = old[i];
+      used++;
+   }
+   free(old);
+   version++;
+}
+
+/* nameLength
+ * Returns the length of the variable name at the start of
+ * word: a letter or _ followed by letters, digits and _.
+ */
+static int nameLength(const char * word)
+{
+   int len = 0;
+
+   if (!isalpha((unsigned char) word[0]) && word[0] != '_') return 0;
+   while (isalnum((unsigned char) word[len]) || word[len] == '_') len++;
+   return len;
+}
@@ -0,0 +1,22 @@
+/*
+ *  Shell variables and the environment.
+ *  Variables are kept in a hash map.  Exported variables make up
+ *  the environment, which children get as an envp block.  The block
+ *  is only rebuilt when an exported variable changes; a command
+ *  with VAR=value prefixes gets a small overlay on top of it.
+ */
+
+#define ENVINITSIZE 256    /* initial number of hash map slots */
+
+void initEnv();
+char * getVar(const char * name);
+void setVar(const char * name, const char * value, int export);
+int exportVar(const char * name);
+void unsetVar(const char * name);
+int isAssignment(const char * word);
+void assignVar(const char * word, int export);
+char ** envBlock();
+long envBytes();
+char ** envOverlay(char ** assigns, int cnt);
+char * expandVars(const char * word);
+void printExported();
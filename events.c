@@ -0,0 +1,110 @@
+#include "wrappers.h"
+#include "events.h"
+
+typedef struct             /* A registered file descriptor */
+{
+   int fd;
+   short events;           /* POLLIN, POLLOUT, ... */
+   eventHandler handler;   /* called when fd is ready */
+   void * arg;             /* passed to handler */
+} eventT;
+
+static eventT * eventList = NULL;
+static int eventCnt = 0;
+static int eventCap = 0;
+static struct pollfd * pollfds = NULL;
+
+//not needed outside of this file
+static eventT * findEvent(int fd);
+
+/* addEvent
+ * Registers fd with the event loop.  handler is called with
+ * fd, the returned poll events and arg whenever one of the
+ * events occurs.  Registering an fd again replaces the old
+ * registration.
+ */
+void addEvent(int fd, short events, eventHandler handler, void * arg)
+{
+   eventT * ev = findEvent(fd);
+
+   if (ev == NULL)
+   {
+      if (eventCnt == eventCap)
+      {
+         eventCap = eventCap ? eventCap * 2 : 16;
+         eventList = realloc(eventList, eventCap * sizeof(eventT));
+         pollfds = realloc(pollfds, eventCap * sizeof(struct pollfd));
+         if (eventList == NULL || pollfds == NULL) unixError("realloc error");
+      }
+      ev = &eventList[eventCnt++];
+   }
+   ev->fd = fd;
+   ev->events = events;
+   ev->handler = handler;
+   ev->arg = arg;
+}
+
+/* modifyEvent
+ * Changes the poll events that are waited for on fd.
+ */
+void modifyEvent(int fd, short events)
+{
+   eventT * ev = findEvent(fd);
+   if (ev != NULL) ev->events = events;
+}
+
+/* removeEvent
+ * Removes fd from the event loop.  It is safe to call this
+ * from within a handler.
+ */
+void removeEvent(int fd)
+{
+   eventT * ev = findEvent(fd);
+   if (ev != NULL) *ev = eventList[--eventCnt];
+}
+
+/* runEvents
+ * Waits at most timeout milliseconds (-1 waits forever) for
+ * registered descriptors to become ready and calls their
+ * handlers.  Returns the number of handlers called, 0 on a
+ * timeout and -1 if the wait was interrupted by a signal.
+ */
+int runEvents(int timeout)
+{
+   int i, n, cnt = 0;
+   eventT * ev;
+
+   for (i = 0; i < eventCnt; i++)
+   {
+      pollfds[i].fd = eventList[i].fd;
+      pollfds[i].events = eventList[i].events;
+      pollfds[i].revents = 0;
+   }
+   n = eventCnt;
+   if (poll(pollfds, n, timeout) == -1)
+   {
+      if (errno == EINTR) return -1;
+      unixError("poll error");
+   }
+   for (i = 0; i < n; i++)
+   {
+      if (pollfds[i].revents == 0) continue;
+      //a handler may have removed this fd in the meantime
+      ev = findEvent(pollfds[i].fd);
+      if (ev == NULL) continue;
+      ev->handler(ev->fd, pollfds[i].revents, ev->arg);
+      cnt++;
+   }
+   return cnt;
+}
+
+/* findEvent
+ * Returns the registration of fd or NULL.
+ */
+static eventT * findEvent(int fd)
+{
+   int i;
+   for (i = 0; i < eventCnt; i++)
+      if (eventList[i].fd == fd) return &eventList[i];
+   return NULL;
+}
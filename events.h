@@ -0,0 +1,15 @@
+/*
+ *  The event loop.  Modules register a file descriptor along with
+ *  a handler that is called from runEvents when the descriptor is
+ *  ready.  Nothing is done in signal handlers except waking up the
+ *  loop; all the real work happens in the handlers.
+ */
+
+#include <poll.h>
+
+typedef void (*eventHandler)(int fd, short revents, void * arg);
+
+void addEvent(int fd, short events, eventHandler handler, void * arg);
+void modifyEvent(int fd, short events);
+void removeEvent(int fd);
+int runEvents(int timeout);
@@ -0,0 +1,885 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include "wrappers.h"
+#include "env.h"
+#include "inproc.h"
+
+/* characters printf %q leaves unquoted */
+#define SHELLSAFE "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz" \
+                  "0123456789,._+:@%/-="
+
+typedef struct             /* The buffered output of a command */
+{
+   int fd;
+   int len;
+   int error;              /* errno of a failed write; 0 if none */
+   char buf[INPROCBUF];
+} outT;
+
+typedef struct             /* A command run in a thread */
+{
+   char ** args;
+   int outFd, errFd;
+} stageT;
+
+typedef struct             /* The state of a test expression */
+{
+   char ** argv;
+   int argc;
+   int pos;                /* next argument */
+   int error;              /* 1 once a syntax error was printed */
+   char * name;            /* test or [ */
+   int errFd;
+} testT;
+
+static const char * inprocNames[] = {"echo", "true", "false", "pwd", "cd",
+                                     "test", "[", "printf", NULL};
+
+//not needed outside of this file
+static void * runStage(void * arg);
+static int echoCmd(char ** args, outT * out);
+static int pwdCmd(char ** args, outT * out, int errFd, int inPipeline);
+static int cdCmd(char ** args, outT * out, int errFd, int inPipeline);
+static int testCmd(char ** args, int errFd);
+static int testArgs(testT * t, int n);
+static int testOr(testT * t);
+static int testAnd(testT * t);
+static int testTerm(testT * t);
+static int testUnary(testT * t, char * op, char * arg);
+static int testBinary(testT * t, char * a, char * op, char * b);
+static int testInt(testT * t, char * s, long long * n);
+static int isUnaryOp(char * s);
+static int isBinaryOp(char * s);
+static void testError(testT * t, char * fmt, char * arg);
+static int printfCmd(char ** args, outT * out, int errFd);
+static int printfOnce(char * fmt, char *** argv, outT * out, int errFd,
+                      int * status);
+static int numArg(char * arg, long long * i, unsigned long long * u,
+                  long double * d, int errFd);
+static int putEscape(outT * out, char ** p, int octal0);
+static void putBytes(outT * out, char * data, int len);
+static void putChar(outT * out, char c);
+static void putFormat(outT * out, char * fmt, ...);
+static void flushOut(outT * out);
+
+/* isInprocName
+ * Returns 1 if name is a command run inside ush.
+ */
+int isInprocName(char * name)
+{
+   int i;
+
+   for (i = 0; inprocNames[i] != NULL; i++)
+      if (strcmp(name, inprocNames[i]) == 0) return 1;
+   return 0;
+}
+
+/* runInproc
+ * Runs the command in args (see isInprocName) with its output
+ * going to outFd and its errors to errFd.  inPipeline is 1 for a
+ * pipeline stage, which must not change ush.  Returns its wait
+ * status.
+ */
+int runInproc(char ** args, int outFd, int errFd, int inPipeline)
+{
+   outT out;
+   int code = 0;
+
+   out.fd = outFd;
+   out.len = out.error = 0;
+   if (strcmp(args[0], "echo") == 0) code = echoCmd(args, &out);
+   else if (strcmp(args[0], "false") == 0) code = 1;
+   else if (strcmp(args[0], "pwd") == 0) code = pwdCmd(args, &out, errFd, inPipeline);
+   else if (strcmp(args[0], "cd") == 0) code = cdCmd(args, &out, errFd, inPipeline);
+   else if (strcmp(args[0], "test") == 0 || strcmp(args[0], "[") == 0)
+      code = testCmd(args, errFd);
+   else if (strcmp(args[0], "printf") == 0) code = printfCmd(args, &out, errFd);
+   flushOut(&out);
+   if (out.error == EPIPE) return SIGPIPE;
+   if (out.error != 0)
+   {
+      dprintf(errFd, "%s: write error: %s\n", args[0], strerror(out.error));
+      code = 1;
+   }
+   return code << 8;
+}
+
+/* startInproc
+ * Runs the command in args in a new thread with its output going
+ * to outFd and its errors to errFd.  The thread has its own copies
+ * of args and the fds, so the caller may free and close them.
+ */
+void startInproc(char ** args, int outFd, int errFd)
+{
+   stageT * stage = Malloc(sizeof(stageT));
+   pthread_attr_t attr;
+   pthread_t thread;
+   sigset_t all, prev;
+   int i, cnt;
+
+   for (cnt = 0; args[cnt] != NULL; cnt++);
+   stage->args = Malloc((cnt + 1) * sizeof(char *));
+   for (i = 0; i < cnt; i++) stage->args[i] = strdup(args[i]);
+   stage->args[cnt] = NULL;
+   stage->outFd = fcntl(outFd, F_DUPFD_CLOEXEC, 0);
+   stage->errFd = fcntl(errFd, F_DUPFD_CLOEXEC, 0);
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+   //the signals of ush are handled by its main thread
+   sigfillset(&all);
+   pthread_sigmask(SIG_SETMASK, &all, &prev);
+   if (pthread_create(&thread, &attr, runStage, stage) != 0) runStage(stage);
+   pthread_sigmask(SIG_SETMASK, &prev, NULL);
+   pthread_attr_destroy(&attr);
+}
+
+/* runStage
+ * Thread function of startInproc: runs the command of arg and
+ * frees it.
+ */
+static void * runStage(void * arg)
+{
+   stageT * stage = arg;
+   int i;
+
+   runInproc(stage->args, stage->outFd, stage->errFd, 1);
+   close(stage->outFd);
+   close(stage->errFd);
+   for (i = 0; stage->args[i] != NULL; i++) free(stage->args[i]);
+   free(stage->args);
+   free(stage);
+   return NULL;
+}
+
+/* echoCmd
+ * echo [-neE] [string ...]: writes the strings separated by
+ * blanks.  -n leaves off the newline, -e interprets backslash
+ * escapes and -E does not (the default).  An argument is only
+ * taken as options if all its letters are n, e or E.
+ */
+static int echoCmd(char ** args, outT * out)
+{
+   int i, j, newline = 1, escapes = 0;
+   char * p;
+
+   for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0' &&
+        strspn(args[i] + 1, "neE") == strlen(args[i] + 1); i++)
+      for (j = 1; args[i][j] != '\0'; j++)
+         if (args[i][j] == 'n') newline = 0;
+         else escapes = (args[i][j] == 'e');
+   for (; args[i] != NULL; i++)
+   {
+      for (p = args[i]; escapes && *p != '\0'; )
+      {
+         if (*p != '\\' || p[1] == '\0') putChar(out, *p++);
+         else if (p++, putEscape(out, &p, 1)) return 0;   //\c ends the output
+      }
+      if (!escapes) putBytes(out, args[i], strlen(args[i]));
+      if (args[i + 1] != NULL) putChar(out, ' ');
+   }
+   if (newline) putChar(out, '\n');
+   return 0;
+}
+
+/* pwdCmd
+ * pwd [-LP]: writes the working directory; with -L the logical
+ * one in PWD if it names it, else (and by default, like coreutils)
+ * the physical one.  A pipeline stage runs in a thread and does
+ * not look at the variables, so -L acts like -P there.
+ */
+static int pwdCmd(char ** args, outT * out, int errFd, int inPipeline)
+{
+   char cwd[PATH_MAX], * pwd, * opt;
+   int i, logical = 0;
+   struct stat a, b;
+
+   for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+   {
+      if (strcmp(args[i], "--") == 0)
+      {
+         i++;
+         break;
+      }
+      for (opt = args[i] + 1; *opt != '\0'; opt++)
+      {
+         if (*opt != 'L' && *opt != 'P')
+         {
+            dprintf(errFd, "pwd: invalid option -- '%c'\n", *opt);
+            return 1;
+         }
+         logical = (*opt == 'L');
+      }
+   }
+   if (args[i] != NULL) dprintf(errFd, "pwd: ignoring non-option arguments\n");
+   pwd = logical && !inPipeline ? getVar("PWD") : NULL;
+   if (pwd != NULL && pwd[0] == '/' && strstr(pwd, "/./") == NULL &&
+       strstr(pwd, "/../") == NULL && stat(pwd, &a) == 0 && stat(".", &b) == 0 &&
+       a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+   {
+      putBytes(out, pwd, strlen(pwd));
+      putChar(out, '\n');
+      return 0;
+   }
+   if (getcwd(cwd, sizeof(cwd)) == NULL)
+   {
+      dprintf(errFd, "pwd: %s\n", strerror(errno));
+      return 1;
+   }
+   putBytes(out, cwd, strlen(cwd));
+   putChar(out, '\n');
+   return 0;
+}
+
+/* cdCmd
+ * cd [dir | -]: changes the working directory of ush to dir, HOME
+ * by default, or OLDPWD for -, which is also written.  PWD and
+ * OLDPWD are set to the physical directories.  A pipeline stage
+ * only checks that dir can be changed to.
+ */
+static int cdCmd(char ** args, outT * out, int errFd, int inPipeline)
+{
+   char * dir = args[1], cwd[PATH_MAX], old[PATH_MAX];
+   struct stat st;
+
+   if (dir != NULL && args[2] != NULL)
+   {
+      dprintf(errFd, "cd: too many arguments\n");
+      return 1;
+   }
+   if (dir == NULL || strcmp(dir, "-") == 0)
+   {
+      char * var = dir == NULL ? "HOME" : "OLDPWD";
+      //a thread must not touch the variables, which are not locked
+      if (inPipeline) return 0;
+      if ((dir = getVar(var)) == NULL || dir[0] == '\0')
+      {
+         dprintf(errFd, "cd: %s not set\n", var);
+         return 1;
+      }
+   }
+   if (inPipeline)
+   {
+      if (stat(dir, &st) == 0 && !S_ISDIR(st.st_mode)) errno = ENOTDIR;
+      else if (access(dir, X_OK) == 0) return 0;
+      dprintf(errFd, "cd: %s: %s\n", dir, strerror(errno));
+      return 1;
+   }
+   if (getcwd(old, sizeof(old)) == NULL) old[0] = '\0';
+   //dir may be OLDPWD itself, which setVar replaces
+   dir = strdup(dir);
+   if (chdir(dir) < 0)
+   {
+      dprintf(errFd, "cd: %s: %s\n", dir, strerror(errno));
+      free(dir);
+      return 1;
+   }
+   if (old[0] != '\0') setVar("OLDPWD", old, 0);
+   if (getcwd(cwd, sizeof(cwd)) != NULL)
+   {
+      setVar("PWD", cwd, 0);
+      if (strcmp(args[1] != NULL ? args[1] : "", "-") == 0)
+      {
+         putBytes(out, cwd, strlen(cwd));
+         putChar(out, '\n');
+      }
+   }
+   free(dir);
+   return 0;
+}
+
+/* testCmd
+ * test expr or [ expr ]: exits with 0 if expr is true, 1 if it
+ * is false and 2 if it is malformed.  Up to four arguments are
+ * taken as POSIX says (so test -n and test ! -z work); longer
+ * expressions are parsed with ! ( ) -a -o, -a binding tighter.
+ */
+static int testCmd(char ** args, int errFd)
+{
+   testT t;
+   int r;
+
+   t.name = args[0];
+   t.errFd = errFd;
+   t.argv = args + 1;
+   t.pos = t.error = 0;
+   for (t.argc = 0; t.argv[t.argc] != NULL; t.argc++);
+   if (strcmp(t.name, "[") == 0)
+   {
+      if (t.argc == 0 || strcmp(t.argv[t.argc - 1], "]") != 0)
+      {
+         dprintf(errFd, "[: missing ']'\n");
+         return 2;
+      }
+      t.argc--;
+   }
+   r = testArgs(&t, t.argc);
+   if (!t.error && t.pos < t.argc) testError(&t, "extra argument '%s'", t.argv[t.pos]);
+   return t.error ? 2 : !r;
+}
+
+/* testArgs
+ * Evaluates the next n arguments of t by the POSIX rules for that
+ * many arguments, or as an expression if there are more.  Returns
+ * 1 if they are true.
+ */
+static int testArgs(testT * t, int n)
+{
+   char ** a = t->argv + t->pos;
+   int r;
+
+   switch (n)
+   {
+   case 0:
+      return 0;
+   case 1:
+      t->pos++;
+      return a[0][0] != '\0';
+   case 2:
+      if (strcmp(a[0], "!") == 0)
+      {
+         t->pos++;
+         return !testArgs(t, 1);
+      }
+      if (isUnaryOp(a[0]))
+      {
+         t->pos += 2;
+         return testUnary(t, a[0], a[1]);
+      }
+      testError(t, "'%s': unary operator expected", a[0]);
+      return 0;
+   case 3:
+      if (isBinaryOp(a[1]))
+      {
+         t->pos += 3;
+         return testBinary(t, a[0], a[1], a[2]);
+      }
+      if (strcmp(a[1], "-a") == 0 || strcmp(a[1], "-o") == 0) return testOr(t);
+      if (strcmp(a[0], "!") == 0)
+      {
+         t->pos++;
+         return !testArgs(t, 2);
+      }
+      if (strcmp(a[0], "(") == 0 && strcmp(a[2], ")") == 0)
+      {
+         t->pos++;
+         r = testArgs(t, 1);
+         t->pos++;
+         return r;
+      }
+      testError(t, "'%s': binary operator expected", a[1]);
+      return 0;
+   case 4:
+      if (strcmp(a[0], "!") == 0)
+      {
+         t->pos++;
+         return !testArgs(t, 3);
+      }
+      if (strcmp(a[0], "(") == 0 && strcmp(a[3], ")") == 0)
+      {
+         t->pos++;
+         r = testArgs(t, 2);
+         t->pos++;
+         return r;
+      }
+   }
+   return testOr(t);
+}
+
+/* testOr
+ * expr: and [-o expr]
+ */
+static int testOr(testT * t)
+{
+   int r = testAnd(t);
+
+   while (!t->error && t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0)
+   {
+      t->pos++;
+      r = testAnd(t) || r;
+   }
+   return r;
+}
+
+/* testAnd
+ * and: term [-a and]
+ */
+static int testAnd(testT * t)
+{
+   int r = testTerm(t);
+
+   while (!t->error && t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0)
+   {
+      t->pos++;
+      r = testTerm(t) && r;
+   }
+   return r;
+}
+
+/* testTerm
+ * term: ! term | ( expr ) | arg binop arg | unop arg | arg
+ */
+static int testTerm(testT * t)
+{
+   char ** a = t->argv + t->pos;
+   int left = t->argc - t->pos, r;
+
+   if (left <= 0)
+   {
+      testError(t, "argument expected%s", "");
+      return 0;
+   }
+   if (left >= 3 && isBinaryOp(a[1]))
+   {
+      t->pos += 3;
+      return testBinary(t, a[0], a[1], a[2]);
+   }
+   if (strcmp(a[0], "!") == 0)
+   {
+      t->pos++;
+      return !testTerm(t);
+   }
+   if (strcmp(a[0], "(") == 0)
+   {
+      t->pos++;
+      r = testOr(t);
+      if (t->error) return 0;
+      if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0)
+         testError(t, "')' expected%s", "");
+      t->pos++;
+      return r;
+   }
+   if (left >= 2 && isUnaryOp(a[0]))
+   {
+      t->pos += 2;
+      return testUnary(t, a[0], a[1]);
+   }
+   t->pos++;
+   return a[0][0] != '\0';
+}
+
+/* testUnary
+ * Returns 1 if op arg is true.
+ */
+static int testUnary(testT * t, char * op, char * arg)
+{
+   struct stat st;
+   long long fd;
+
+   switch (op[1])
+   {
+   case 'n': return arg[0] != '\0';
+   case 'z': return arg[0] == '\0';
+   case 't': return testInt(t, arg, &fd) && fd >= 0 && fd <= INT_MAX && isatty(fd);
+   case 'r': return eaccess(arg, R_OK) == 0;
+   case 'w': return eaccess(arg, W_OK) == 0;
+   case 'x': return eaccess(arg, X_OK) == 0;
+   case 'h':
+   case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+   }
+   if (stat(arg, &st) < 0) return 0;
+   switch (op[1])
+   {
+   case 'e': return 1;
+   case 'f': return S_ISREG(st.st_mode);
+   case 'd': return S_ISDIR(st.st_mode);
+   case 'b': return S_ISBLK(st.st_mode);
+   case 'c': return S_ISCHR(st.st_mode);
+   case 'p': return S_ISFIFO(st.st_mode);
+   case 'S': return S_ISSOCK(st.st_mode);
+   case 's': return st.st_size > 0;
+   case 'g': return (st.st_mode & S_ISGID) != 0;
+   case 'u': return (st.st_mode & S_ISUID) != 0;
+   case 'k': return (st.st_mode & S_ISVTX) != 0;
+   case 'O': return st.st_uid == geteuid();
+   case 'G': return st.st_gid == getegid();
+   }
+   return 0;
+}
+
+/* testBinary
+ * Returns 1 if a op b is true.
+ */
+static int testBinary(testT * t, char * a, char * op, char * b)
+{
+   long long x, y;
+   struct stat sa, sb;
+   int ea, eb;
+
+   if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+   if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+   if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0)
+   {
+      ea = stat(a, &sa) == 0;
+      eb = stat(b, &sb) == 0;
+      if (op[1] == 'e') return ea && eb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+      //a missing file is older than any other
+      if (op[1] == 'o') return eb && (!ea || sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ||
+                                     (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec &&
+                                      sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec));
+      return ea && (!eb || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+                    (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec &&
+                     sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec));
+   }
+   if (!testInt(t, a, &x) || !testInt(t, b, &y)) return 0;
+   if (strcmp(op, "-eq") == 0) return x == y;
+   if (strcmp(op, "-ne") == 0) return x != y;
+   if (strcmp(op, "-lt") == 0) return x < y;
+   if (strcmp(op, "-le") == 0) return x <= y;
+   if (strcmp(op, "-gt") == 0) return x > y;
+   return x >= y;
+}
+
+/* testInt
+ * Puts the integer in s, which may have blanks around it, in n.
+ * Returns 0 (after a syntax error) if s is not an integer.
+ */
+static int testInt(testT * t, char * s, long long * n)
+{
+   char * end;
+
+   errno = 0;
+   *n = strtoll(s, &end, 10);
+   while (isspace((unsigned char) *end)) end++;
+   if (end == s || *end != '\0' || errno == ERANGE)
+   {
+      testError(t, "invalid integer '%s'", s);
+      return 0;
+   }
+   return 1;
+}
+
+/* isUnaryOp
+ * Returns 1 if s is a unary operator of test.
+ */
+static int isUnaryOp(char * s)
+{
+   return s[0] == '-' && s[1] != '\0' && s[2] == '\0' &&
+          strchr("bcdefgGhLknOprsStuwxz", s[1]) != NULL;
+}
+
+/* isBinaryOp
+ * Returns 1 if s is a binary operator of test other than -a and -o.
+ */
+static int isBinaryOp(char * s)
+{
+   static const char * ops[] = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le",
+                                "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+   int i;
+
+   for (i = 0; ops[i] != NULL; i++)
+      if (strcmp(s, ops[i]) == 0) return 1;
+   return 0;
+}
+
+/* testError
+ * Prints the first syntax error of t; fmt has one %s for arg.
+ */
+static void testError(testT * t, char * fmt, char * arg)
+{
+   if (t->error) return;
+   t->error = 1;
+   dprintf(t->errFd, "%s: ", t->name);
+   dprintf(t->errFd, fmt, arg);
+   dprintf(t->errFd, "\n");
+}
+
+/* printfCmd
+ * printf format [arg ...]: writes the args as format says, like
+ * printf(3) with %b for a string with escapes, %q for one quoted
+ * for the shell and the escapes of echo -e in format.  The format is used again while args are
+ * left.  A numeric arg may be 'c for the code of c.  A bad number
+ * makes the exit status 1 but the output goes on.
+ */
+static int printfCmd(char ** args, outT * out, int errFd)
+{
+   char ** argv;
+   int status = 0, used;
+
+   if (args[1] == NULL)
+   {
+      dprintf(errFd, "printf: missing operand\n");
+      return 1;
+   }
+   argv = args + 2;
+   do
+   {
+      char ** before = argv;
+      if (printfOnce(args[1], &argv, out, errFd, &status)) return status;
+      used = argv > before;
+   } while (used && *argv != NULL);
+   if (*argv != NULL)
+      dprintf(errFd, "printf: warning: ignoring excess arguments, starting with '%s'\n",
+              *argv);
+   return status;
+}
+
+/* printfOnce
+ * Writes format fmt once, taking args from *argv.  Returns 1 if
+ * the output ended (\c, or a bad conversion, which makes *status
+ * 1).
+ */
+static int printfOnce(char * fmt, char *** argv, outT * out, int errFd,
+                      int * status)
+{
+   char * p = fmt, * start, spec[32], * arg;
+   int width, prec, len;
+   long long i;
+   unsigned long long u;
+   long double d;
+
+   while (*p != '\0')
+   {
+      if (*p == '\\' && p[1] != '\0')
+      {
+         p++;
+         if (putEscape(out, &p, 0)) return 1;
+         continue;
+      }
+      if (*p != '%' || p[1] == '%')
+      {
+         putChar(out, *p);
+         p += (*p == '%') ? 2 : 1;
+         continue;
+      }
+      //%[flags][width][.precision]conversion
+      start = p++;
+      p += strspn(p, "-+ #0'");
+      len = p - start;
+      width = 0;
+      prec = -1;
+      if (*p == '*')
+      {
+         p++;
+         i = 0;
+         if (**argv != NULL && numArg(*(*argv)++, &i, NULL, NULL, errFd) < 0)
+            *status = 1;
+         width = i;
+      } else width = strtol(p, &p, 10);
+      if (*p == '.')
+      {
+         p++;
+         if (*p == '*')
+         {
+            p++;
+            i = 0;
+            if (**argv != NULL && numArg(*(*argv)++, &i, NULL, NULL, errFd) < 0)
+               *status = 1;
+            prec = i;
+         } else prec = strtol(p, &p, 10);
+      }
+      //spec holds the flags and *.*ll and the conversion after them
+      if (*p == '\0' || strchr("diouxXcsbqeEfFgGaA", *p) == NULL ||
+          len + 8 > (int) sizeof(spec))
+      {
+         dprintf(errFd, "printf: %.*s: invalid conversion specification\n",
+                 (int) (p - start + (*p != '\0')), start);
+         *status = 1;
+         return 1;
+      }
+      arg = **argv != NULL ? *(*argv)++ : "";
+      //the flags of the spec, then the width and precision as args
+      memcpy(spec, start, len);
+      spec[len] = '\0';
+      strcat(spec, "*.*");
+      switch (*p)
+      {
+      case 'd': case 'i':
+         if (numArg(arg, &i, NULL, NULL, errFd) < 0) *status = 1;
+         strcat(spec, "lld");
+         putFormat(out, spec, width, prec, i);
+         break;
+      case 'o': case 'u': case 'x': case 'X':
+         if (numArg(arg, NULL, &u, NULL, errFd) < 0) *status = 1;
+         len = strlen(spec);
+         sprintf(spec + len, "ll%c", *p);
+         putFormat(out, spec, width, prec, u);
+         break;
+      case 'c':
+         strcat(spec, "c");
+         putFormat(out, spec, width, prec, arg[0]);
+         break;
+      case 's':
+         strcat(spec, "s");
+         putFormat(out, spec, width, prec, arg);
+         break;
+      case 'b':
+         while (*arg != '\0')
+         {
+            if (*arg != '\\' || arg[1] == '\0') putChar(out, *arg++);
+            else if (arg++, putEscape(out, &arg, 1)) return 1;
+         }
+         break;
+      case 'q':
+         //quoted for the shell if it has to be, '\'' for a quote
+         if (arg[0] != '\0' && strspn(arg, SHELLSAFE) == strlen(arg))
+            putBytes(out, arg, strlen(arg));
+         else
+         {
+            putChar(out, '\'');
+            for (; *arg != '\0'; arg++)
+               if (*arg == '\'') putBytes(out, "'\\''", 4);
+               else putChar(out, *arg);
+            putChar(out, '\'');
+         }
+         break;
+      default:
+         if (numArg(arg, NULL, NULL, &d, errFd) < 0) *status = 1;
+         len = strlen(spec);
+         sprintf(spec + len, "L%c", *p);
+         putFormat(out, spec, width, prec, d);
+      }
+      p++;
+   }
+   return 0;
+}
+
+/* numArg
+ * Puts the value of arg in whichever of *i (for %d and %i), *u
+ * (%o, %u, %x and %X) or *d (the others) is not NULL.  'c or "c is the code of c.
+ * Returns 0, or -1 (after saying why) if arg is not wholly a
+ * number; what could be read of it is used.
+ */
+static int numArg(char * arg, long long * i, unsigned long long * u,
+                  long double * d, int errFd)
+{
+   char * end;
+
+   if (arg[0] == '\'' || arg[0] == '"')
+   {
+      if (i != NULL) *i = (unsigned char) arg[1];
+      if (u != NULL) *u = (unsigned char) arg[1];
+      if (d != NULL) *d = (unsigned char) arg[1];
+      return 0;
+   }
+   errno = 0;
+   if (i != NULL) *i = strtoll(arg, &end, 0);
+   else if (u != NULL) *u = strtoull(arg, &end, 0);
+   else *d = strtold(arg, &end);
+   if (end == arg && arg[0] != '\0')
+   {
+      dprintf(errFd, "printf: '%s': expected a numeric value\n", arg);
+      return -1;
+   }
+   if (*end != '\0')
+   {
+      dprintf(errFd, "printf: '%s': value not completely converted\n", arg);
+      return -1;
+   }
+   if (errno == ERANGE)
+   {
+      dprintf(errFd, "printf: '%s': %s\n", arg, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+/* putEscape
+ * Writes the character of the escape at *p (just past its
+ * backslash) and moves *p past it.  With octal0 (echo -e and %b)
+ * an octal escape is \0 and up to 3 digits, else \ and up to 3
+ * digits.  Returns 1 for \c, which ends the output.
+ */
+static int putEscape(outT * out, char ** p, int octal0)
+{
+   static const char from[] = "\\abefnrtv\"", to[] = "\\\a\b\033\f\n\r\t\v\"";
+   char * s = *p, * c;
+   int n = 0, digits;
+
+   if (*s == 'c') return 1;
+   if (*s == 'x' && isxdigit((unsigned char) s[1]))
+   {
+      for (s++, digits = 0; digits < 2 && isxdigit((unsigned char) *s); digits++, s++)
+         n = n * 16 + (isdigit((unsigned char) *s) ? *s - '0' : tolower(*s) - 'a' + 10);
+      putChar(out, n);
+   }
+   else if (*s >= '0' && *s <= '7')
+   {
+      if (octal0 && *s == '0') s++;
+      for (digits = 0; digits < 3 && *s >= '0' && *s <= '7'; digits++, s++)
+         n = n * 8 + *s - '0';
+      putChar(out, n);
+   }
+   else if ((c = strchr(from, *s)) != NULL && *s != '\0')
+   {
+      putChar(out, to[c - from]);
+      s++;
+   }
+   else
+   {
+      putChar(out, '\\');
+      putChar(out, *s++);
+   }
+   *p = s;
+   return 0;
+}
+
+/* putBytes
+ * Adds len bytes of data to the output.
+ */
+static void putBytes(outT * out, char * data, int len)
+{
+   int n;
+
+   while (len > 0 && out->error == 0)
+   {
+      if (out->len == INPROCBUF) flushOut(out);
+      n = INPROCBUF - out->len < len ? INPROCBUF - out->len : len;
+      memcpy(out->buf + out->len, data, n);
+      out->len += n;
+      data += n;
+      len -= n;
+   }
+}
+
+/* putChar
+ * Adds c to the output.
+ */
+static void putChar(outT * out, char c)
+{
+   putBytes(out, &c, 1);
+}
+
+/* putFormat
+ * Adds what printf(3) makes of fmt and the args to the output.
+ */
+static void putFormat(outT * out, char * fmt, ...)
+{
+   char small[256], * s = small;
+   va_list ap;
+   int len;
+
+   va_start(ap, fmt);
+   len = vsnprintf(small, sizeof(small), fmt, ap);
+   va_end(ap);
+   if (len >= (int) sizeof(small))
+   {
+      s = Malloc(len + 1);
+      va_start(ap, fmt);
+      vsnprintf(s, len + 1, fmt, ap);
+      va_end(ap);
+   }
+   if (len > 0) putBytes(out, s, len);
+   if (s != small) free(s);
+}
+
+/* flushOut
+ * Writes the buffered output.  A failed write is kept in error
+ * and the rest of the output dropped.
+ */
+static void flushOut(outT * out)
+{
+   int off = 0, n;
+
+   while (off < out->len && out->error == 0)
+   {
+      n = write(out->fd, out->buf + off, out->len - off);
+      if (n > 0) off += n;
+      else if (n < 0 && errno != EINTR) out->error = errno;
+   }
+   out->len = 0;
+}
@@ -0,0 +1,21 @@
+/*
+ *  Trivial commands run inside ush instead of being forked and
+ *  exec'd: echo, true, false, pwd, cd, test, [ and printf.  They
+ *  behave like the coreutils commands (cd like the one of bash)
+ *  and end with the same exit statuses; a command whose output
+ *  pipe is closed ends as if killed by SIGPIPE, like the
+ *  coreutils one.  None of them reads its input.
+ *  A command by itself runs in ush.  In a pipeline (see runJob in
+ *  ush.c), the last command runs in ush once the other commands
+ *  have started and the others run in short lived threads writing
+ *  into their pipes, so that a slow reader of the pipe does not
+ *  hold up ush.  cd only changes the directory of ush when run
+ *  by itself; in a pipeline it only checks the directory, as the
+ *  subshell of a pipeline stage would.
+ */
+
+#define INPROCBUF 4096     /* output buffered before a write */
+
+int isInprocName(char * name);
+int runInproc(char ** args, int outFd, int errFd, int inPipeline);
+void startInproc(char ** args, int outFd, int errFd);
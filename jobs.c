@@ -1,52 +1,121 @@
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "wrappers.h"
 #include "parser.h"
 #include "jobs.h"
+#include "policy.h"
+#include "events.h"
+#include "state.h"
+#include "procstat.h"
+#include "runtime.h"
 
 #define verbose 0
 
 static int nextjid = 1;
+static int jobLimit = 1;              /* max number of running BG jobs */
+static queuedJobT * queueHead = NULL; /* next job to start */
+static queuedJobT * queueTail = NULL; /* most recently queued job */
+
+typedef struct             /* A job in the long listing */
+{
+   jobT * job;
+   procInfoT * procs;      /* a sample of each pid; state 0 if none */
+   double cpu;             /* sum of the %CPU of the processes */
+   long rss;               /* sum of their RSS in KB */
+   int threads;            /* sum of their threads */
+   double elapsed;         /* age of the oldest process */
+} jobInfoT;
+
+//not needed outside of this file
+static const char * stateName(int state);
+static int byCpu(const void * a, const void * b);
+static int byMem(const void * a, const void * b);
+static char * sizeStr(long kb, char * buf, int size);
+static char * timeStr(double secs, char * buf, int size);
+static void printExpected(char * cmdline);
 
 /* clearJob
  * Takes a pointer to a jobT in the jobs array and
- * clears it.
+ * clears it, freeing its pids and cmdline and closing
+ * its pidfds.
  */
 void clearJob(jobT *job) 
 {
-   int i;
-   for (i = 0; i < MAXPIDS; i++)
-      job->pid[i] = 0;
+   int j;
+
+   for (j = 0; job->pidfd != NULL && j < job->pidCnt; j++)
+   {
+      if (job->pidfd[j] < 0) continue;
+      removeEvent(job->pidfd[j]);
+      close(job->pidfd[j]);
+   }
+   free(job->pid);
+   free(job->pidfd);
+   free(job->cmdline);
+   free(job->stage);
+   job->pid = NULL;
+   job->pidfd = NULL;
+   job->pidCnt = 0;
    job->pgrp = 0;
    job->jid = 0;
    job->state = UNDEF;
-   job->cmdline[0] = '\0';
+   job->cmdline = NULL;
+   job->adopted = 0;
+   job->status = -1;
+   job->started = 0;
+   job->interactive = 0;
+   job->stage = NULL;
+}
+
+/* pidfdOpen
+ * Returns a pidfd for process pid, or -1.
+ */
+int pidfdOpen(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+   return syscall(SYS_pidfd_open, pid, 0);   //close on exec
+#else
+   return -1;
+#endif
 }
 
 /* initJobs
- * Initializes the jobs array.
+ * Initializes the jobs array. The job limit starts out as
+ * the number of online CPUs.
  */  
 void initJobs(jobT jobs[MAXJOBS]) {
    int i;
    for (i = 0; i < MAXJOBS; i++) clearJob(&jobs[i]);
+   setJobLimit(sysconf(_SC_NPROCESSORS_ONLN));
 }
 
 /* maxjid
- * Returns the largest jid in the jobs array.
+ * Returns the largest jid in the jobs array and the queue.
  */
 int maxjid(jobT jobs[MAXJOBS])
 {
    int i, max=0;
+   queuedJobT * q;
 
    for (i = 0; i < MAXJOBS; i++)
       if (jobs[i].jid > max) max = jobs[i].jid;
+   for (q = queueHead; q != NULL; q = q->next)
+      if (q->jid > max) max = q->jid;
    return max;
 }
 
 /* addJob
  * Add a job to the jobs array given
- * the pids of the processes that make up the job, 
+ * the pidCnt pids of the processes that make up the job, 
  * the process group id, the state of the job (background
- * or foreground) and the cmdline.
+ * or foreground), the jid and the cmdline.  A jid of 0 
+ * gives the job a new jid; a job started from the queue
+ * keeps the jid it was given when it was queued, and an
+ * adopted job the jid it had.
  */
-int addJob(pid_t pid[MAXPIDS], int pgrp, int state, 
+int addJob(pid_t * pid, int pidCnt, int pgrp, int state, int jid,
            char *cmdline, jobT jobs[MAXJOBS])
 {
    int i, j;
@@ -55,12 +124,31 @@ int addJob(pid_t pid[MAXPIDS], int pgrp, int state,
    {
       if (jobs[i].state == UNDEF) 
       {
-         for (j = 0; j < MAXPIDS; j++) jobs[i].pid[j] = pid[j];
+         jobs[i].pid = malloc(pidCnt * sizeof(pid_t));
+         jobs[i].pidfd = malloc(pidCnt * sizeof(int));
+         if (jobs[i].pid == NULL || jobs[i].pidfd == NULL)
+         {
+            free(jobs[i].pid);
+            free(jobs[i].pidfd);
+            jobs[i].pid = NULL;
+            jobs[i].pidfd = NULL;
+            break;
+         }
+         memcpy(jobs[i].pid, pid, pidCnt * sizeof(pid_t));
+         //the pids are not reaped yet, so the pidfds get these processes
+         for (j = 0; j < pidCnt; j++) jobs[i].pidfd[j] = pidfdOpen(pid[j]);
+         jobs[i].pidCnt = pidCnt;
          jobs[i].pgrp = pgrp;
          jobs[i].state = state;
-         jobs[i].jid = nextjid++;
-         if (nextjid > MAXJOBS) nextjid = 1;
-         strncpy(jobs[i].cmdline, cmdline, MAXLINE);
+         jobs[i].jid = (jid != 0) ? jid : nextjid++;
+         jobs[i].cmdline = strdup(cmdline);
+         jobs[i].adopted = 0;
+         jobs[i].status = -1;
+         jobs[i].started = seconds();
+         jobs[i].interactive = 0;
+         jobs[i].stage = NULL;
+         if (jobs[i].jid >= nextjid) nextjid = jobs[i].jid + 1;
+         saveJob(&jobs[i], i);
          if(verbose)
          {
             printf("Added job [%d] %s\n", jobs[i].jid, jobs[i].cmdline);
@@ -76,6 +164,8 @@ int addJob(pid_t pid[MAXPIDS], int pgrp, int state,
  * Delete a process whose PID=pid from the job list. 
  * Returns 1 if this causes the job to be deleted
  * because it is the last live process that is part of the job. 
+ * The run time of a deleted job whose last command exited is
+ * learned (see runtime.c); that of an adopted job is not known.
  */
 int deletePid(pid_t pid, jobT jobs[MAXJOBS])
 {
@@ -85,11 +175,17 @@ int deletePid(pid_t pid, jobT jobs[MAXJOBS])
 
    for (i = 0; i < MAXJOBS; i++) 
    {
-      for (j = 0; j < MAXPIDS; j++)
+      for (j = 0; j < jobs[i].pidCnt; j++)
       {
          if (jobs[i].pid[j] == pid) 
          { 
             jobs[i].pid[j] = 0;
+            if (jobs[i].pidfd[j] >= 0)
+            {
+               removeEvent(jobs[i].pidfd[j]);
+               close(jobs[i].pidfd[j]);
+               jobs[i].pidfd[j] = -1;
+            }
             index = i;
             break;
          }
@@ -98,8 +194,19 @@ int deletePid(pid_t pid, jobT jobs[MAXJOBS])
    if (index != -1)
    {
       //see if all process that are part of this job have terminated
-      for (j = 0; j < MAXPIDS; j++) if (jobs[index].pid[j] != 0) return 0;
+      for (j = 0; j < jobs[index].pidCnt; j++) 
+      {
+         if (jobs[index].pid[j] != 0)
+         {
+            saveJob(&jobs[index], index);
+            return 0;
+         }
+      }
+      if (!jobs[index].adopted && jobs[index].status >= 0 &&
+          WIFEXITED(jobs[index].status))
+         recordRuntime(jobs[index].cmdline, seconds() - jobs[index].started);
       clearJob(&jobs[index]);
+      saveJob(&jobs[index], index);
       nextjid = maxjid(jobs)+1;
       return 1;
    }
@@ -128,7 +235,7 @@ jobT *getJobPid(pid_t pid, jobT jobs[MAXJOBS]) {
 
    if (pid < 1) return NULL;
    for (i = 0; i < MAXJOBS; i++)
-      for (j = 0; j < MAXPIDS; j++) 
+      for (j = 0; j < jobs[i].pidCnt; j++) 
          if (jobs[i].pid[j] == pid)
             return &jobs[i];
    return NULL;
@@ -160,7 +267,7 @@ int pid2jid(pid_t pid, jobT jobs[MAXJOBS])
 
    if (pid < 1) return 0;
    for (i = 0; i < MAXJOBS; i++)
-      for (j = 0; j < MAXPIDS; j++)
+      for (j = 0; j < jobs[i].pidCnt; j++)
          if (jobs[i].pid[j] == pid) 
          {
             return jobs[i].jid;
@@ -169,11 +276,14 @@ int pid2jid(pid_t pid, jobT jobs[MAXJOBS])
 }
 
 /* listjobs
- * Prints the job list.
+ * Prints the job list along with the effective scheduling
+ * policy of each job and the run time expected for it.
  */
 void listJobs(jobT jobs[MAXJOBS])
 {
-   int i;
+   int i, j;
+   char policy[64];
+   queuedJobT * q;
 
    for (i = 0; i < MAXJOBS; i++) 
    {
@@ -195,8 +305,306 @@ void listJobs(jobT jobs[MAXJOBS])
                printf("listjobs: Internal error: job[%d].state=%d ",
                       i, jobs[i].state);
          }
+         if (jobs[i].adopted) printf("Adopted ");
+         //show the effective scheduling policy of the first live process
+         for (j = 0; j < jobs[i].pidCnt && jobs[i].pid[j] == 0; j++);
+         if (j < jobs[i].pidCnt)
+         {
+            describePolicy(jobs[i].pid[j], policy, sizeof(policy));
+            printf("(%s) ", policy);
+         }
+         printExpected(jobs[i].cmdline);
          printf("%s &\n", jobs[i].cmdline);
       }
    }
+   for (q = queueHead; q != NULL; q = q->next)
+   {
+      printf("[%d] %s ", q->jid, stateName(QU));
+      printExpected(q->cmdline);
+      printf("%s &\n", q->cmdline);
+   }
+}
+
+/* listJobsLong
+ * Prints the jobs (jobs -l) with a line for each of their
+ * processes showing its state, %CPU, resident memory, number
+ * of threads and elapsed time, and the sums for the job. 
+ * The jobs are ordered by sort: SORTJID, SORTCPU or SORTMEM.
+ * The processes are sampled through the cache in procstat.c.
+ */
+void listJobsLong(jobT jobs[MAXJOBS], int sort)
+{
+   jobInfoT info[MAXJOBS];
+   jobInfoT * ji;
+   procInfoT * pi;
+   char rss[16], elapsed[16], jid[16];
+   int i, j, cnt = 0;
+   queuedJobT * q;
+
+   for (i = 0; i < MAXJOBS; i++)
+   {
+      if (jobs[i].jid == 0) continue;
+      ji = &info[cnt++];
+      ji->job = &jobs[i];
+      ji->procs = calloc(jobs[i].pidCnt, sizeof(procInfoT));
+      ji->cpu = ji->elapsed = 0;
+      ji->rss = ji->threads = 0;
+      for (j = 0; j < jobs[i].pidCnt && ji->procs != NULL; j++)
+      {
+         pi = &ji->procs[j];
+         if (!sampleProc(jobs[i].pid[j], pi))
+         {
+            pi->state = 0;
+            continue;
+         }
+         ji->cpu += pi->cpu;
+         ji->rss += pi->rss;
+         ji->threads += pi->threads;
+         if (pi->elapsed > ji->elapsed) ji->elapsed = pi->elapsed;
+      }
+   }
+   sweepProcs();
+   if (sort == SORTCPU) qsort(info, cnt, sizeof(jobInfoT), byCpu);
+   else if (sort == SORTMEM) qsort(info, cnt, sizeof(jobInfoT), byMem);
+
+   printf("%-6s %-9s %6s %8s %4s %9s  %s\n", "JID", "PID/STATE", "%CPU",
+          "RSS", "THR", "ELAPSED", "COMMAND");
+   for (i = 0; i < cnt; i++)
+   {
+      ji = &info[i];
+      snprintf(jid, sizeof(jid), "[%d]", ji->job->jid);
+      printf("%-6s %-9s %6.1f %8s %4d %9s  %s%s\n", jid,
+             stateName(ji->job->state), ji->cpu,
+             sizeStr(ji->rss, rss, sizeof(rss)), ji->threads,
+             timeStr(ji->elapsed, elapsed, sizeof(elapsed)), 
+             ji->job->adopted ? "(adopted) " : "", ji->job->cmdline);
+      for (j = 0; j < ji->job->pidCnt && ji->procs != NULL; j++)
+      {
+         pi = &ji->procs[j];
+         if (pi->state == 0) continue;
+         printf("%-6s %-7d %c %6.1f %8s %4d %9s\n", "",
+                (int) ji->job->pid[j], pi->state, pi->cpu,
+                sizeStr(pi->rss, rss, sizeof(rss)), pi->threads,
+                timeStr(pi->elapsed, elapsed, sizeof(elapsed)));
+      }
+      free(ji->procs);
+   }
+   for (q = queueHead; q != NULL; q = q->next)
+   {
+      snprintf(jid, sizeof(jid), "[%d]", q->jid);
+      printf("%-6s %-9s %6s %8s %4s %9s  %s\n", jid, stateName(QU), "-", "-",
+             "-", "-", q->cmdline);
+   }
+}
+
+/* freeJobs
+ * Returns the number of unused entries in the jobs array.
+ */
+int freeJobs(jobT jobs[MAXJOBS])
+{
+   int i, cnt = 0;
+
+   for (i = 0; i < MAXJOBS; i++)
+      if (jobs[i].state == UNDEF) cnt++;
+   return cnt;
+}
+
+/* bgJobCount
+ * Returns the number of jobs running in the background.
+ */
+int bgJobCount(jobT jobs[MAXJOBS])
+{
+   int i, cnt = 0;
+
+   for (i = 0; i < MAXJOBS; i++)
+      if (jobs[i].state == BG) cnt++;
+   return cnt;
+}
+
+/* getJobLimit
+ * Returns the maximum number of background jobs that
+ * may run at the same time.
+ */
+int getJobLimit()
+{
+   return jobLimit;
+}
+
+/* setJobLimit
+ * Sets the maximum number of background jobs that may
+ * run at the same time.  The limit is at least 1.
+ */
+void setJobLimit(int limit)
+{
+   jobLimit = (limit < 1) ? 1 : limit;
 }
 
+/* queueJob
+ * Adds cmdline to the end of the queue of jobs waiting for
+ * a run slot. Returns the jid given to the queued job.
+ */
+int queueJob(char *cmdline, jobT jobs[MAXJOBS])
+{
+   queuedJobT * q = Malloc(sizeof(queuedJobT));
+
+   q->jid = nextjid++;
+   q->cmdline = strdup(cmdline);
+   q->queued = seconds();
+   q->next = NULL;
+   if (queueTail == NULL) queueHead = q;
+   else queueTail->next = q;
+   queueTail = q;
+   return q->jid;
+}
+
+/* dequeueJob
+ * Removes the job to start next from the queue: the one with
+ * the least run time expected, less RUNTIMEAGING seconds for
+ * each second it has waited.  A job whose run time is not known
+ * yet is expected to take no time, so it is learned soon, and
+ * ties go to the oldest job.  Returns its cmdline, which the
+ * caller must free, and stores its jid in jid.  Returns NULL if
+ * the queue is empty.
+ */
+char *dequeueJob(int *jid)
+{
+   queuedJobT * q, * best = NULL;
+   double now = seconds(), expected, score, bestScore = 0;
+   char * cmdline;
+
+   for (q = queueHead; q != NULL; q = q->next)
+   {
+      expected = predictRuntime(q->cmdline);
+      score = (expected > 0 ? expected : 0) - RUNTIMEAGING * (now - q->queued);
+      if (best == NULL || score < bestScore)
+      {
+         best = q;
+         bestScore = score;
+      }
+   }
+   if (best == NULL) return NULL;
+   *jid = best->jid;
+   cmdline = best->cmdline;
+   best->cmdline = NULL;
+   removeQueued(best->jid);
+   return cmdline;
+}
+
+/* removeQueued
+ * Removes the job with the given jid from the queue.
+ * Returns 1 if the job was queued and 0 otherwise.
+ */
+int removeQueued(int jid)
+{
+   queuedJobT * q, * prev = NULL;
+
+   for (q = queueHead; q != NULL; prev = q, q = q->next)
+   {
+      if (q->jid == jid)
+      {
+         if (prev == NULL) queueHead = q->next;
+         else prev->next = q->next;
+         if (queueTail == q) queueTail = prev;
+         free(q->cmdline);
+         free(q);
+         return 1;
+      }
+   }
+   return 0;
+}
+
+/* isQueued
+ * Returns 1 if the job with jid is waiting in the queue.
+ */
+int isQueued(int jid)
+{
+   queuedJobT * q;
+
+   for (q = queueHead; q != NULL; q = q->next)
+      if (q->jid == jid) return 1;
+   return 0;
+}
+
+/* queueLength
+ * Returns the number of jobs in the queue.
+ */
+int queueLength()
+{
+   int cnt = 0;
+   queuedJobT * q;
+
+   for (q = queueHead; q != NULL; q = q->next) cnt++;
+   return cnt;
+}
+
+
+/* stateName
+ * Returns the name of a job state as listed by jobs.
+ */
+static const char * stateName(int state)
+{
+   switch (state)
+   {
+      case BG: return "Running";
+      case FG: return "Foreground";
+      case ST: return "Stopped";
+      case QU: return "Queued";
+   }
+   return "Undefined";
+}
+
+/* byCpu
+ * qsort comparison of jobInfoTs, highest %CPU first.
+ */
+static int byCpu(const void * a, const void * b)
+{
+   double x = ((jobInfoT *) a)->cpu, y = ((jobInfoT *) b)->cpu;
+   return (x < y) - (x > y);
+}
+
+/* byMem
+ * qsort comparison of jobInfoTs, largest RSS first.
+ */
+static int byMem(const void * a, const void * b)
+{
+   long x = ((jobInfoT *) a)->rss, y = ((jobInfoT *) b)->rss;
+   return (x < y) - (x > y);
+}
+
+/* sizeStr
+ * Puts kb kilobytes in buf in a short form: 512K, 1.5M, 2.0G.
+ */
+static char * sizeStr(long kb, char * buf, int size)
+{
+   if (kb < 1024) snprintf(buf, size, "%ldK", kb);
+   else if (kb < 1024 * 1024) snprintf(buf, size, "%.1fM", kb / 1024.0);
+   else snprintf(buf, size, "%.1fG", kb / (1024.0 * 1024));
+   return buf;
+}
+
+/* timeStr
+ * Puts secs in buf as [h:]mm:ss.
+ */
+static char * timeStr(double secs, char * buf, int size)
+{
+   long s = (long) secs;
+
+   if (s >= 3600) snprintf(buf, size, "%ld:%02ld:%02ld", s / 3600,
+                           s / 60 % 60, s % 60);
+   else snprintf(buf, size, "%ld:%02ld", s / 60, s % 60);
+   return buf;
+}
+
+/* printExpected
+ * Prints the run time expected for a job running cmdline, as
+ * listed by jobs, if it is known.
+ */
+static void printExpected(char * cmdline)
+{
+   double secs = predictRuntime(cmdline);
+   char buf[16];
+
+   if (secs < 0) return;
+   if (secs < 60) printf("(~%.1fs) ", secs);
+   else printf("(~%s) ", timeStr(secs, buf, sizeof(buf)));
+}
@@ -6,6 +6,16 @@
  *  ST -> BG  : bg command
  *  BG -> FG  : fg command
  *  At most 1 job can be in the FG state.
+ *
+ *  Background jobs beyond the job limit are not started.  They wait
+ *  in the QU state, in a queue outside of the jobs array, and are
+ *  started as running jobs are reaped: the one expected to be the
+ *  shortest first, with aging (see runtime.h).
+ *
+ *  The jobs array is mirrored in the state file (see state.c).
+ *  Each job process is held by a pidfd from the time it is added
+ *  until it is reaped, so signals never reach a reused pid
+ *  (see signals.c).
 */
 
 #include <stdlib.h>
@@ -17,22 +27,47 @@
 #define FG 1    /* running in foreground */
 #define BG 2    /* running in background */
 #define ST 3    /* stopped */
-#define MAXJOBS 16
-#define MAXPIDS 16
+#define QU 4    /* queued, waiting for a run slot */
+#define MAXJOBS 64
+#define JOBSINTERVAL 1000   /* ms between refreshes of jobs --watch */
+
+/* Orders of jobs -l */
+#define SORTJID 0   /* by job id */
+#define SORTCPU 1   /* by %CPU, highest first */
+#define SORTMEM 2   /* by resident memory, largest first */
 
 typedef struct             /* The job struct */
 {
-   pid_t pid[MAXPIDS];     /* PIDs of processes that make up the job */
+   pid_t * pid;            /* PIDs of processes that make up the job */
+   int * pidfd;            /* a pidfd of each process; -1 if none */
+   int pidCnt;             /* number of entries in pid */
    pid_t pgrp;             /* process group id */
    int jid;                /* job ID [1, 2, ...] */
    int state;              /* UNDEF, BG, FG, or ST */
-   char cmdline[MAXLINE];  /* command line */
+   char * cmdline;         /* command line */
+   int adopted;            /* 1 if taken over from an earlier ush */
+   int status;             /* wait status of the last command; -1 until
+                              it ends */
+   double started;         /* monotonic seconds when it was added */
+   int interactive;        /* 1 for a coprocess: it gets the FG policy
+                              and is never throttled */
+   int * stage;            /* pipeline index of each process; NULL if
+                              they are 0, 1, ... (see runJob) */
 } jobT;
 
+typedef struct queuedJob   /* A job waiting in the queue */
+{
+   int jid;                /* job ID, kept when the job starts */
+   char * cmdline;         /* command line */
+   double queued;          /* monotonic seconds when it was queued */
+   struct queuedJob * next;
+} queuedJobT;
+
 void clearJob(jobT *job);
+int pidfdOpen(pid_t pid);
 void initJobs(jobT jobs[MAXJOBS]);
 int maxjid(jobT jobs[MAXJOBS]);
-int addJob(pid_t pid[MAXPIDS], int pgrp, int state, 
+int addJob(pid_t * pid, int pidCnt, int pgrp, int state, int jid,
            char *cmdline, jobT jobs[MAXJOBS]);
 int deletePid(pid_t pid, jobT jobs[MAXJOBS]);
 jobT *fgJob(jobT jobs[MAXJOBS]);
@@ -40,4 +75,14 @@ jobT *getJobPid(pid_t pid, jobT jobs[MAXJOBS]);
 jobT *getJobJid(int jid, jobT jobs[MAXJOBS]);
 int pid2jid(pid_t pid, jobT jobs[MAXJOBS]);
 void listJobs(jobT jobs[MAXJOBS]);
+void listJobsLong(jobT jobs[MAXJOBS], int sort);
+int freeJobs(jobT jobs[MAXJOBS]);
+int bgJobCount(jobT jobs[MAXJOBS]);
+int getJobLimit();
+void setJobLimit(int limit);
+int queueJob(char *cmdline, jobT jobs[MAXJOBS]);
+char *dequeueJob(int *jid);
+int removeQueued(int jid);
+int isQueued(int jid);
+int queueLength();
 
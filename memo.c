@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "wrappers.h"
+#include "parser.h"
+#include "env.h"
+#include "events.h"
+#include "memo.h"
+
+typedef struct             /* A 128 bit hash, two FNV-1a lanes */
+{
+   unsigned long long a, b;
+} hashT;
+
+typedef struct             /* A cache entry, for eviction */
+{
+   char * name;
+   off_t size;
+   struct timespec used;   /* mtime, set on every hit */
+} entryT;
+
+static long maxBytes = MEMOMAXBYTES;
+static int hits = 0;
+static int misses = 0;
+static int teeFd = -1;      /* the entry being written on a miss */
+static off_t teeShown;      /* bytes of it written to stdout so far */
+
+//not needed outside of this file
+static int memoOption(char * opt, char ** p, char *** inputs, int * inputCnt,
+                      char *** vars, int * varCnt, int * content);
+static void addString(char *** list, int * cnt, char * s);
+static void hashBytes(hashT * h, const void * buf, size_t len);
+static void hashString(hashT * h, const char * s);
+static void hashFile(hashT * h, const char * path, int content);
+static void makeKey(cmdArray * cmdlist, char ** inputs, int inputCnt,
+                    char ** vars, int varCnt, int content, char * key);
+static char * cacheDir();
+static int replay(char * path);
+static void teeEvent(int fd, short revents, void * arg);
+static void teeNew();
+static void evict(char * dir);
+static int byUse(const void * a, const void * b);
+static void clearCache(char * dir);
+
+/* memoJob
+ * Handles the memo job prefix:
+ * memo [-i file]... [-e VAR]... [-c] cmdline
+ * -i declares an input file; args of the commands that name
+ *    regular files are inputs too
+ * -e adds a variable to what the job depends on
+ * -c fingerprints the inputs by their content instead of their
+ *    inode, size and mtime
+ * and the cache commands memo --stats, memo --clear and
+ * memo --limit MB.
+ * On a hit the stored output is written to stdout; on a miss the
+ * job is run by run with its stdout going to a new entry, which
+ * is copied to stdout as it grows (an inotify watch on the entry
+ * wakes up the event loop), so the output shows as it comes even
+ * if the job does not exit.  Only jobs that exit are stored.
+ * Returns the wait status of the job, or -1 if it did not exit.
+ */
+int memoJob(char * job, memoRunFn run)
+{
+   char ** inputs = NULL, ** vars = NULL;
+   int inputCnt = 0, varCnt = 0, content = 0, i, j, fd, ino, status = -1;
+   char key[MEMOKEYLEN], * dir, * word, * path, * tmp, * p = job;
+   char header[MEMOHEADER + 1];
+   cmdArray cmdlist;
+   struct stat st;
+
+   free(nextWord(&p));   //memo
+   while (*(p + strspn(p, BLANKS)) == '-')
+   {
+      word = nextWord(&p);
+      i = memoOption(word, &p, &inputs, &inputCnt, &vars, &varCnt, &content);
+      free(word);
+      if (!i) goto done;
+   }
+   p += strspn(p, BLANKS);
+   if (*p == '\0')
+   {
+      if (inputCnt + varCnt + content > 0)
+         printf("usage: memo [-i file]... [-e VAR]... [-c] cmdline\n");
+      goto done;
+   }
+   if ((dir = cacheDir()) == NULL)
+   {
+      printf("memo: no cache directory\n");
+      goto done;
+   }
+
+   //args that name regular files are inputs
+   initCmdList(&cmdlist);
+   parseIntoCmds(p, &cmdlist);
+   expandCmdList(&cmdlist);
+   for (i = 0; i < cmdlist.cnt; i++)
+      for (j = 1; j < cmdlist.cmd[i].argc; j++)
+         if (stat(cmdlist.cmd[i].args[j], &st) == 0 && S_ISREG(st.st_mode))
+            addString(&inputs, &inputCnt, strdup(cmdlist.cmd[i].args[j]));
+   makeKey(&cmdlist, inputs, inputCnt, vars, varCnt, content, key);
+   clearCmdList(&cmdlist);
+
+   path = Malloc(strlen(dir) + MEMOKEYLEN + 16);
+   tmp = Malloc(strlen(dir) + 32);
+   sprintf(path, "%s/%s", dir, key);
+   if ((status = replay(path)) >= 0)
+      hits++;
+   else
+   {
+      misses++;
+      sprintf(tmp, "%s/.tmp-XXXXXX", dir);
+      fd = mkostemp(tmp, O_CLOEXEC);
+      if (fd < 0 || lseek(fd, MEMOHEADER, SEEK_SET) < 0)
+      {
+         //no entry, so just run the job
+         if (fd >= 0)
+         {
+            unlink(tmp);
+            close(fd);
+         }
+         status = run(p, -1);
+      } else
+      {
+         teeFd = fd;
+         teeShown = MEMOHEADER;
+         ino = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+         if (ino >= 0 && inotify_add_watch(ino, tmp, IN_MODIFY) >= 0)
+            addEvent(ino, POLLIN, teeEvent, NULL);
+         status = run(p, fd);
+         if (ino >= 0)
+         {
+            removeEvent(ino);
+            close(ino);
+         }
+         //what came since the last event, or all of it without a watch
+         teeNew();
+         teeFd = -1;
+         if (status >= 0 && WIFEXITED(status))
+         {
+            memset(header, ' ', MEMOHEADER);
+            i = snprintf(header, sizeof(header), "ushmemo %d",
+                         WEXITSTATUS(status));
+            header[i] = ' ';
+            header[MEMOHEADER - 1] = '\n';
+            if (pwrite(fd, header, MEMOHEADER, 0) == MEMOHEADER &&
+                rename(tmp, path) == 0)
+               evict(dir);
+            else unlink(tmp);
+         } else unlink(tmp);
+         close(fd);
+      }
+   }
+   free(path);
+   free(tmp);
+   free(dir);
+done:
+   for (i = 0; i < inputCnt; i++) free(inputs[i]);
+   for (i = 0; i < varCnt; i++) free(vars[i]);
+   free(inputs);
+   free(vars);
+   return status;
+}
+
+/* memoOption
+ * Handles option opt of memo; p points past it for options
+ * that take a word.  Returns 0 if the job is not to be run.
+ */
+static int memoOption(char * opt, char ** p, char *** inputs, int * inputCnt,
+                      char *** vars, int * varCnt, int * content)
+{
+   char * dir, * word;
+
+   if (strcmp(opt, "-c") == 0)
+   {
+      *content = 1;
+      return 1;
+   }
+   if (strcmp(opt, "--stats") == 0)
+   {
+      printf("memo: %d hits, %d misses, limit %ldM\n", hits, misses,
+             maxBytes >> 20);
+      return 0;
+   }
+   if (strcmp(opt, "--clear") == 0)
+   {
+      if ((dir = cacheDir()) != NULL) clearCache(dir);
+      free(dir);
+      return 0;
+   }
+   word = nextWord(p);
+   if (word == NULL)
+      printf("usage: memo [-i file]... [-e VAR]... [-c] cmdline\n");
+   else if (strcmp(opt, "-i") == 0)
+   {
+      addString(inputs, inputCnt, word);
+      return 1;
+   } else if (strcmp(opt, "-e") == 0)
+   {
+      addString(vars, varCnt, word);
+      return 1;
+   } else if (strcmp(opt, "--limit") == 0 && atol(word) > 0)
+      maxBytes = atol(word) << 20;
+   else printf("memo: bad option %s\n", opt);
+   free(word);
+   return 0;
+}
+
+
+/* addString
+ * Appends s to the list of cnt strings.
+ */
+static void addString(char *** list, int * cnt, char * s)
+{
+   *list = realloc(*list, (*cnt + 1) * sizeof(char *));
+   if (*list == NULL) unixError("realloc error");
+   (*list)[(*cnt)++] = s;
+}
+
+/* makeKey
+ * Puts the key of the cache entry of the job in key: the hash of
+ * its args, the working directory, PATH, the declared variables
+ * and the fingerprints of the inputs, in hex.
+ */
+static void makeKey(cmdArray * cmdlist, char ** inputs, int inputCnt,
+                    char ** vars, int varCnt, int content, char * key)
+{
+   hashT h = { 14695981039346656037ULL, 0x6c62272e07bb0142ULL };
+   char cwd[4096], * value;
+   int i, j;
+
+   for (i = 0; i < cmdlist->cnt; i++)
+   {
+      for (j = 0; j < cmdlist->cmd[i].argc; j++)
+         hashString(&h, cmdlist->cmd[i].args[j]);
+      hashString(&h, "|");
+   }
+   if (getcwd(cwd, sizeof(cwd)) != NULL) hashString(&h, cwd);
+   value = getVar("PATH");
+   hashString(&h, value ? value : "");
+   for (i = 0; i < varCnt; i++)
+   {
+      hashString(&h, vars[i]);
+      value = getVar(vars[i]);
+      hashString(&h, value ? value : "\1unset");
+   }
+   for (i = 0; i < inputCnt; i++) hashFile(&h, inputs[i], content);
+   snprintf(key, MEMOKEYLEN, "%016llx%016llx", h.a, h.b);
+}
+
+/* hashBytes
+ * Adds len bytes to both lanes of h.
+ */
+static void hashBytes(hashT * h, const void * buf, size_t len)
+{
+   const unsigned char * p = buf;
+   size_t i;
+
+   for (i = 0; i < len; i++)
+   {
+      h->a = (h->a ^ p[i]) * 1099511628211ULL;
+      h->b = (h->b ^ p[i]) * 0x100000001b3ULL + (h->b >> 29);
+   }
+}
+
+/* hashString
+ * Adds s and its NUL to h, so that "ab" "c" and "a" "bc" differ.
+ */
+static void hashString(hashT * h, const char * s)
+{
+   hashBytes(h, s, strlen(s) + 1);
+}
+
+/* hashFile
+ * Adds the fingerprint of file path to h: its device, inode,
+ * size and mtime, or its contents if content is 1.
+ */
+static void hashFile(hashT * h, const char * path, int content)
+{
+   struct stat st;
+   long long fp[5];
+   void * map;
+   int fd;
+
+   hashString(h, path);
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0)
+   {
+      hashString(h, "\1missing");
+      if (fd >= 0) close(fd);
+      return;
+   }
+   if (content && st.st_size > 0 &&
+       (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+   {
+      hashBytes(h, map, st.st_size);
+      munmap(map, st.st_size);
+   } else
+   {
+      fp[0] = st.st_dev;
+      fp[1] = st.st_ino;
+      fp[2] = st.st_size;
+      fp[3] = st.st_mtim.tv_sec;
+      fp[4] = st.st_mtim.tv_nsec;
+      hashBytes(h, fp, sizeof(fp));
+   }
+   close(fd);
+}
+
+/* cacheDir
+ * Returns the cache directory, $USH_MEMO or ~/.cache/ush-memo,
+ * in new space, making it if needed.  Returns NULL if there is
+ * none (see cachePath).
+ */
+static char * cacheDir()
+{
+   char * dir = cachePath(getVar("USH_MEMO"), getVar("HOME"), "ush-memo");
+
+   if (dir == NULL) return NULL;
+   if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+   {
+      free(dir);
+      return NULL;
+   }
+   return dir;
+}
+
+/* replay
+ * Writes the output stored in the entry at path to stdout and
+ * marks the entry as used.  Returns the stored exit status as a
+ * wait status, or -1 if there is no such entry.
+ */
+static int replay(char * path)
+{
+   char header[MEMOHEADER + 1];
+   struct stat st;
+   off_t off = MEMOHEADER;
+   int fd, status;
+   ssize_t n;
+
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+   if (fstat(fd, &st) < 0 || pread(fd, header, MEMOHEADER, 0) != MEMOHEADER)
+   {
+      close(fd);
+      return -1;
+   }
+   header[MEMOHEADER] = '\0';
+   if (sscanf(header, "ushmemo %d", &status) != 1)
+   {
+      close(fd);
+      return -1;
+   }
+   futimens(fd, NULL);     //the mtime is the time of the last use
+   fflush(stdout);
+   while (off < st.st_size)
+   {
+      n = sendfile(1, fd, &off, st.st_size - off);
+      if (n > 0) continue;
+      if (n < 0 && errno == EINTR) continue;
+      break;
+   }
+   //sendfile cannot write to every stdout
+   while (off < st.st_size)
+   {
+      char buf[65536];
+      n = pread(fd, buf, sizeof(buf), off);
+      if (n <= 0 || write(1, buf, n) != n) break;
+      off += n;
+   }
+   close(fd);
+   return W_EXITCODE(status, 0);
+}
+
+/* teeEvent
+ * Event handler for the inotify watch on the entry being written:
+ * copies what the job added to it to stdout.
+ */
+static void teeEvent(int fd, short revents, void * arg)
+{
+   char buf[4096];
+
+   while (read(fd, buf, sizeof(buf)) > 0);
+   teeNew();
+}
+
+/* teeNew
+ * Copies the part of the entry being written that is not on
+ * stdout yet to stdout.
+ */
+static void teeNew()
+{
+   char buf[65536];
+   ssize_t n;
+
+   fflush(stdout);
+   while ((n = pread(teeFd, buf, sizeof(buf), teeShown)) > 0)
+   {
+      if (write(1, buf, n) < 0) break;
+      teeShown += n;
+   }
+}
+
+/* evict
+ * Removes the least recently used entries of the cache in dir
+ * until it is within maxBytes and MEMOMAXENTRIES, and .tmp- files
+ * not written to for MEMOTMPAGE seconds.
+ */
+static void evict(char * dir)
+{
+   DIR * d = opendir(dir);
+   struct dirent * de;
+   struct stat st;
+   entryT * entries = NULL;
+   int cnt = 0, cap = 0, i;
+   long long total = 0;
+   time_t now = time(NULL);
+
+   if (d == NULL) return;
+   while ((de = readdir(d)) != NULL)
+   {
+      if (fstatat(dirfd(d), de->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode))
+         continue;
+      //a memo that is running keeps writing to its file
+      if (strncmp(de->d_name, ".tmp-", 5) == 0 &&
+          st.st_mtime < now - MEMOTMPAGE)
+         unlinkat(dirfd(d), de->d_name, 0);
+      if (de->d_name[0] == '.') continue;
+      if (cnt == cap)
+      {
+         cap = cap ? 2 * cap : 64;
+         entries = realloc(entries, cap * sizeof(entryT));
+         if (entries == NULL) unixError("realloc error");
+      }
+      entries[cnt].name = strdup(de->d_name);
+      entries[cnt].size = st.st_size;
+      entries[cnt].used = st.st_mtim;
+      total += st.st_size;
+      cnt++;
+   }
+   qsort(entries, cnt, sizeof(entryT), byUse);
+   for (i = 0; i < cnt; i++)
+   {
+      if (total > maxBytes || cnt - i > MEMOMAXENTRIES)
+      {
+         unlinkat(dirfd(d), entries[i].name, 0);
+         total -= entries[i].size;
+      }
+      free(entries[i].name);
+   }
+   free(entries);
+   closedir(d);
+}
+
+/* byUse
+ * qsort comparison of entryTs, least recently used first.
+ */
+static int byUse(const void * a, const void * b)
+{
+   const struct timespec * x = &((entryT *) a)->used;
+   const struct timespec * y = &((entryT *) b)->used;
+
+   if (x->tv_sec != y->tv_sec) return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+   return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/* clearCache
+ * Removes all entries of the cache in dir.
+ */
+static void clearCache(char * dir)
+{
+   DIR * d = opendir(dir);
+   struct dirent * de;
+
+   if (d == NULL) return;
+   while ((de = readdir(d)) != NULL)
+      if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0)
+         unlinkat(dirfd(d), de->d_name, 0);
+   closedir(d);
+}
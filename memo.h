@@ -0,0 +1,23 @@
+/*
+ *  Memoization of the output of deterministic jobs.
+ *  memo cmdline runs cmdline with its stdout captured to a cache
+ *  entry whose name is a hash of the args, the working directory,
+ *  PATH, declared variables and fingerprints of the input files.
+ *  When the same job is run again with the same inputs, the output
+ *  and exit status are replayed from the entry without forking.
+ *  Entries are evicted least recently used first once the cache
+ *  grows past its limits.  An entry is written to a .tmp- file that
+ *  is renamed once it is complete.
+ */
+
+#define MEMOMAXBYTES (64L << 20)   /* default size limit of the cache */
+#define MEMOMAXENTRIES 1024        /* most entries kept */
+#define MEMOHEADER 32              /* bytes of the header of an entry */
+#define MEMOKEYLEN 33              /* 32 hex digits and a NUL */
+#define MEMOTMPAGE 86400           /* seconds before a .tmp- file left by
+                                      a ush that died is removed */
+
+/* runs job with its stdout on outFd; returns its wait status or -1 */
+typedef int (*memoRunFn)(char * job, int outFd);
+
+int memoJob(char * job, memoRunFn run);
@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include "wrappers.h"
+#include "events.h"
+#include "output.h"
+
+#define OUTPREFIX 16       /* longest [jid] prefix */
+#define OUTREAD 65536      /* bytes read from a pipe at a time */
+
+typedef struct output      /* The output of a background job */
+{
+   int jid;
+   int fd;                 /* read end of the job's pipe; -1 at EOF */
+   char ring[OUTRING];     /* output not written yet */
+   int head;               /* offset of the first byte in ring */
+   int len;                /* bytes in ring */
+   int spill;              /* temporary file for output the ring */
+                           /* has no room for; -1 if none */
+   off_t spillRead;        /* spill[spillRead..spillWrite) comes */
+   off_t spillWrite;       /* after the ring */
+   int noSpill;            /* 1 once there is no spill file or it
+                              failed; then the pipe is only read as
+                              far as the ring has room */
+   char * held;            /* output read when the spill file failed,
+                              which comes after the spill file; NULL
+                              if none */
+   int heldLen;
+   int paused;             /* 1 while the pipe is not polled */
+   struct output * next;
+} outputT;
+
+static int mux = 0;        /* 1 if background output is multiplexed */
+static int prefix = 1;     /* 1 if lines are prefixed with [jid] */
+static outputT * outputs = NULL;
+static outputT * nextOutput = NULL;  /* the job to write from next */
+static char pending[OUTRING + OUTPREFIX + 1];  /* lines being written */
+static int pendingLen = 0;
+static int pendingOff = 0;
+
+//not needed outside of this file
+static void readOutput(int fd, short revents, void * arg);
+static void writeOutput(int fd, short revents, void * arg);
+static void storeOutput(outputT * o, char * buf, int n);
+static int ringPut(outputT * o, char * buf, int n);
+static int refillRing(outputT * o);
+static void holdOutput(outputT * o, char * buf, int n);
+static int takeLines(outputT * o, char * out);
+static void freeOutput(outputT * o);
+
+/* outputMux
+ * Returns 1 if the output of background jobs is multiplexed.
+ */
+int outputMux()
+{
+   return mux;
+}
+
+/* openOutput
+ * Makes the pipe for the output of a background job in fds
+ * (close on exec; a child dup2s the write end onto 1 and 2).
+ * Returns 0 if output is not multiplexed or there is no pipe.
+ */
+int openOutput(int fds[2])
+{
+   return mux && pipe2(fds, O_CLOEXEC) == 0;
+}
+
+/* addOutput
+ * Starts draining fd, the read end of the pipe of job jid.
+ */
+void addOutput(int fd, int jid)
+{
+   outputT * o = Malloc(sizeof(outputT));
+
+   o->jid = jid;
+   o->fd = fd;
+   o->head = 0;
+   o->len = 0;
+   o->spill = -1;
+   o->spillRead = 0;
+   o->spillWrite = 0;
+   o->noSpill = 0;
+   o->held = NULL;
+   o->heldLen = 0;
+   o->paused = 0;
+   o->next = outputs;
+   outputs = o;
+   fcntl(fd, F_SETFL, O_NONBLOCK);
+   addEvent(fd, POLLIN, readOutput, o);
+}
+
+/* outputCmd
+ * The output builtin. Without args shows the mode:
+ * output
+ * mux - background jobs get pipes of their own: output mux
+ * direct - background jobs write to the terminal: output direct
+ * prefix, noprefix - turns the [jid] prefix of lines on or off
+ */
+void outputCmd(char ** args)
+{
+   int i;
+
+   if (args[1] == NULL)
+      printf("output %s %s\n", mux ? "mux" : "direct",
+             prefix ? "prefix" : "noprefix");
+   for (i = 1; args[i] != NULL; i++)
+   {
+      if (strcmp(args[i], "mux") == 0) mux = 1;
+      else if (strcmp(args[i], "direct") == 0) mux = 0;
+      else if (strcmp(args[i], "prefix") == 0) prefix = 1;
+      else if (strcmp(args[i], "noprefix") == 0) prefix = 0;
+      else printf("usage: output [mux|direct] [prefix|noprefix]\n");
+   }
+}
+
+/* readOutput
+ * Event handler for the pipe of a job.  Reads what the job
+ * wrote and has it written to the terminal when it is ready.
+ * Without a spill file, the pipe is read only as far as the ring
+ * has room and stops being polled while it has none (takeLines
+ * polls it again), so the job blocks instead of losing output.
+ */
+static void readOutput(int fd, short revents, void * arg)
+{
+   outputT * o = arg;
+   char buf[OUTREAD];
+   int n, size = sizeof(buf);
+
+   if (o->noSpill)
+   {
+      size = (o->held == NULL && o->spillRead == o->spillWrite) ?
+             OUTRING - o->len : 0;
+      if (size > sizeof(buf)) size = sizeof(buf);
+   }
+   if (size == 0)
+   {
+      removeEvent(fd);
+      o->paused = 1;
+      addEvent(1, POLLOUT, writeOutput, NULL);
+      return;
+   }
+   n = read(fd, buf, size);
+   if (n > 0) storeOutput(o, buf, n);
+   else if (n == 0 || (errno != EINTR && errno != EAGAIN))
+   {
+      removeEvent(fd);
+      close(fd);
+      o->fd = -1;
+   }
+   addEvent(1, POLLOUT, writeOutput, NULL);
+}
+
+/* writeOutput
+ * Event handler for the terminal, registered while there is
+ * output to write.  Takes the lines of one job at a time, in
+ * turns, and writes them out before taking the next batch.  At
+ * most PIPE_BUF bytes are written at a time, which a pipe that
+ * polls writable takes without blocking, ending at the end of
+ * a line if there is one, so that the shell's own messages do
+ * not land in the middle of a line.
+ */
+static void writeOutput(int fd, short revents, void * arg)
+{
+   outputT * o, * next;
+   char * nl;
+   int n;
+
+   if (pendingOff == pendingLen)
+   {
+      pendingOff = pendingLen = 0;
+      //start after the job written last and wrap around once
+      for (o = nextOutput; o != NULL && pendingLen == 0; o = o->next)
+      {
+         nextOutput = o->next;
+         pendingLen = takeLines(o, pending);
+      }
+      for (o = outputs; o != NULL && pendingLen == 0; o = o->next)
+      {
+         nextOutput = o->next;
+         pendingLen = takeLines(o, pending);
+      }
+      //let go of jobs that are done and written out
+      for (o = outputs; o != NULL; o = next)
+      {
+         next = o->next;
+         if (o->fd == -1 && o->len == 0 && o->spillRead == o->spillWrite &&
+             o->held == NULL)
+            freeOutput(o);
+      }
+   }
+   if (pendingLen == 0)
+   {
+      removeEvent(1);
+      return;
+   }
+   n = pendingLen - pendingOff;
+   if (n > PIPE_BUF)
+   {
+      n = PIPE_BUF;
+      nl = memrchr(&pending[pendingOff], '\n', n);
+      if (nl != NULL) n = nl - &pending[pendingOff] + 1;
+   }
+   n = write(1, &pending[pendingOff], n);
+   if (n > 0) pendingOff += n;
+   else if (errno != EINTR && errno != EAGAIN) pendingOff = pendingLen;
+}
+
+/* storeOutput
+ * Adds n bytes of output of a job to its ring buffer.  What does
+ * not fit goes to the spill file, as does everything after it
+ * until the spilled output is back in the ring (see refillRing).
+ * What the spill file does not take is held (see holdOutput).
+ */
+static void storeOutput(outputT * o, char * buf, int n)
+{
+   int cnt;
+
+   if (o->spillRead == o->spillWrite && o->held == NULL)
+   {
+      cnt = ringPut(o, buf, n);
+      buf += cnt;
+      n -= cnt;
+   }
+   if (n == 0) return;
+   if (o->spill == -1 && !o->noSpill)
+   {
+      o->spill = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+      if (o->spill == -1)
+      {
+         char path[] = "/tmp/ush-outXXXXXX";
+         o->spill = mkostemp(path, O_CLOEXEC);
+         if (o->spill != -1) unlink(path);
+      }
+   }
+   if (o->spill != -1 && !o->noSpill &&
+       (cnt = pwrite(o->spill, buf, n, o->spillWrite)) > 0)
+   {
+      o->spillWrite += cnt;
+      buf += cnt;
+      n -= cnt;
+   }
+   if (n > 0) holdOutput(o, buf, n);
+}
+
+/* holdOutput
+ * Keeps n bytes of output of job o that there was nowhere to put,
+ * and stops using the spill file for it (see readOutput).  Warns
+ * the first time.
+ */
+static void holdOutput(outputT * o, char * buf, int n)
+{
+   if (!o->noSpill)
+      printf("ush: [%d] no room to spill output; the job waits for the "
+             "terminal\n", o->jid);
+   o->noSpill = 1;
+   o->held = realloc(o->held, o->heldLen + n);
+   if (o->held == NULL) unixError("realloc error");
+   memcpy(o->held + o->heldLen, buf, n);
+   o->heldLen += n;
+}
+
+/* ringPut
+ * Copies as much of the n bytes in buf to the ring buffer of
+ * job o as fits.  Returns the number of bytes copied.
+ */
+static int ringPut(outputT * o, char * buf, int n)
+{
+   int tail, cnt, done = 0;
+
+   while (done < n && o->len < OUTRING)
+   {
+      tail = (o->head + o->len) % OUTRING;
+      cnt = (tail >= o->head) ? OUTRING - tail : o->head - tail;
+      if (cnt > n - done) cnt = n - done;
+      memcpy(&o->ring[tail], &buf[done], cnt);
+      o->len += cnt;
+      done += cnt;
+   }
+   return done;
+}
+
+/* refillRing
+ * Moves spilled output of job o back to its ring buffer, and then
+ * held output.  Returns the number of bytes moved.
+ */
+static int refillRing(outputT * o)
+{
+   char buf[OUTREAD];
+   off_t left = o->spillWrite - o->spillRead;
+   int n, room = OUTRING - o->len;
+
+   if (left == 0 && o->held != NULL)
+   {
+      n = ringPut(o, o->held, o->heldLen);
+      o->heldLen -= n;
+      memmove(o->held, o->held + n, o->heldLen);
+      if (o->heldLen == 0)
+      {
+         free(o->held);
+         o->held = NULL;
+      }
+      return n;
+   }
+   if (left == 0 || room == 0) return 0;
+   if (room > sizeof(buf)) room = sizeof(buf);
+   n = pread(o->spill, buf, left < room ? left : room, o->spillRead);
+   if (n <= 0) return 0;
+   ringPut(o, buf, n);
+   o->spillRead += n;
+   if (o->spillRead == o->spillWrite)
+   {
+      //start the file over so it does not keep growing
+      o->spillRead = o->spillWrite = 0;
+      if (ftruncate(o->spill, 0) < 0) return n;
+   }
+   return n;
+}
+
+/* takeLines
+ * Moves the complete lines in the ring buffer of job o to out,
+ * each with the [jid] prefix if it is on.  A line that fills
+ * the whole ring, or the last line of a job that is done, is
+ * taken without a newline at its end and gets one.
+ * Returns the number of bytes put in out.
+ */
+static int takeLines(outputT * o, char * out)
+{
+   int n = 0, len, first, newline, p;
+   char pre[OUTPREFIX], * nl;
+
+   refillRing(o);
+   p = prefix ? snprintf(pre, sizeof(pre), "[%d] ", o->jid) : 0;
+   while (o->len > 0)
+   {
+      //the ring holds o->len bytes from head on, which may wrap
+      first = (o->len < OUTRING - o->head) ? o->len : OUTRING - o->head;
+      nl = memchr(&o->ring[o->head], '\n', first);
+      if (nl != NULL) len = nl - &o->ring[o->head] + 1;
+      else if ((nl = memchr(o->ring, '\n', o->len - first)) != NULL)
+         len = first + (nl - o->ring) + 1;
+      else len = o->len;
+      newline = (nl != NULL);
+      if (!newline && o->len < OUTRING)
+      {
+         //the rest of the line may be in the spill file
+         if (o->spillRead != o->spillWrite || o->held != NULL)
+         {
+            if (refillRing(o) > 0) continue;
+            break;
+         }
+         if (o->fd != -1) break;
+      }
+      if (n + p + len + !newline > sizeof(pending)) break;
+      memcpy(&out[n], pre, p);
+      n += p;
+      if (len <= first) memcpy(&out[n], &o->ring[o->head], len);
+      else
+      {
+         memcpy(&out[n], &o->ring[o->head], first);
+         memcpy(&out[n + first], o->ring, len - first);
+      }
+      n += len;
+      if (!newline) out[n++] = '\n';
+      o->head = (o->head + len) % OUTRING;
+      o->len -= len;
+      if (o->len == 0) o->head = 0;
+   }
+   if (o->paused && o->held == NULL && o->spillRead == o->spillWrite &&
+       o->len < OUTRING)
+   {
+      o->paused = 0;
+      addEvent(o->fd, POLLIN, readOutput, o);
+   }
+   return n;
+}
+
+/* freeOutput
+ * Removes job o from the list of outputs and frees it.
+ */
+static void freeOutput(outputT * o)
+{
+   outputT ** p;
+
+   for (p = &outputs; *p != o; p = &(*p)->next);
+   *p = o->next;
+   if (nextOutput == o) nextOutput = o->next;
+   if (o->spill != -1) close(o->spill);
+   free(o->held);
+   free(o);
+}
@@ -0,0 +1,16 @@
+/*
+ *  Output multiplexing for background jobs.
+ *  In mux mode each background job writes its stdout and stderr
+ *  to a pipe of its own.  The event loop drains the pipes into a
+ *  ring buffer per job and writes whole lines to the terminal,
+ *  optionally prefixed with [jid], so lines of concurrent jobs do
+ *  not interleave.  A job whose output is not taken by the terminal
+ *  fast enough spills to a temporary file instead of blocking.
+ */
+
+#define OUTRING 65536      /* size of the ring buffer of a job */
+
+int outputMux();
+int openOutput(int fds[2]);
+void addOutput(int fd, int jid);
+void outputCmd(char ** args);
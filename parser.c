@@ -1,174 +1,241 @@
-#include <ctype.h>
 #include "parser.h"
 #include "wrappers.h"
+#include "tokenize.h"
+#include "wildcard.h"
+#include "env.h"
 
 //not needed outside of this file
-static void clearJobList(jobList joblist[MAXJOBSPERCMDLN]);
-static void clearCmdList(cmdList cmdlist[MAXCMDSPERJOB]);
-static char * trimWhiteSpace(char * str);
+static void * spill(void * inlineBuf, size_t inlineSize, size_t size);
+static void expandCmd(cmdList * cmd);
 
 /* getCndCount
  * Returns a count of the number of commands in the cmdlist.
  */
-int getCmdCount(cmdList cmdlist[MAXCMDSPERJOB])
+int getCmdCount(cmdArray * cmdlist)
 {
-   int i;
-   for (i = 0; cmdlist[i].filled == 1 && i < MAXCMDSPERJOB; i++);
-   return i;
+   return cmdlist->cnt;
 }
 
 /* parseIntoCmds
  * Takes as input a job and parses the job into commands. Jobs
  * are separated by &. Commands are separated by |.
- * The cmdlist array is filled with the parsed job.
+ * The cmdlist is filled with the parsed job.
  * For example, if job is equal to
  *
  * "cmd1 23 45 | cmd2 a"
  *
- * then the cmdlist array is initialized as follows:
+ * then the cmdlist is initialized as follows:
+ *
+ * cmdlist->cnt = 2
+ * cmdlist->cmd[0].cmd = "cmd1 23 45"
+ * cmdlist->cmd[0].pipe = 1
+ * cmdlist->cmd[0].argc = 3
+ * cmdlist->cmd[0].args[0] = "cmd1"
+ * cmdlist->cmd[0].args[1] = "23"
+ * cmdlist->cmd[0].args[2] = "45"
+ * cmdlist->cmd[0].args[3] = NULL
+ * cmdlist->cmd[1].cmd = "cmd2 a"
+ * cmdlist->cmd[1].pipe = 0
+ * cmdlist->cmd[1].argc = 2
+ * cmdlist->cmd[1].args[0] = "cmd2"
+ * cmdlist->cmd[1].args[1] = "a"
+ * cmdlist->cmd[1].args[2] = NULL
  *
- * cmdlist[0].cmd = "cmd1 23 45"
- * cmdlist[0].filled = 1
- * cmdlist[0].pipe = 1
- * cmdlist[0].args[0] = "cmd1"
- * cmdlist[0].args[1] = "23"
- * cmdlist[0].args[2] = "45"
- * cmdlist[0].args[3] = "NULL"
- * cmdlist[1].cmd = "cmd2 a"
- * cmdlist[1].filled = 1
- * cmdlist[1].pipe = 0
- * cmdlist[1].args[0] = "a"
- * cmdlist[1].args[1] = NULL"
- * cmdlist[2].cmd = NULL;
- * 
- * The NULL values are initialized by the clearCmdList function.
+ * The job is broken into words and | operators in one pass by
+ * tokenize (see tokenize.c); any blank separates arguments.
+ * The commands are counted first so the command array, the
+ * args of all commands and the strings are each allocated
+ * (or taken from the inline storage) once.
  */
-void parseIntoCmds(char * job, cmdList cmdlist[MAXCMDSPERJOB])
+void parseIntoCmds(char * job, cmdArray * cmdlist)
 {
-   int i, j, pipe = 0;
-   char input[MAXLINE];
-   char * token;
-
-   //look for pipe at very end
-   if (job[strlen(job) - 1] == '|') pipe = 1;
+   int len = strlen(job);
+   int i = 0, j, t = 0, first, end, words = 0, cmds = 0;
+   tokenList tokens;
+   tokenT * tok;
+   char * cmdText, * argText;
+   char ** argv;
+   cmdList * cmd;
 
    clearCmdList(cmdlist);
+   initTokens(&tokens);
+   tokenize(job, len, &tokens);
+   tok = tokens.tok;
 
-   memset(input, '\0', MAXLINE);
-   strncpy(input, job, MAXLINE);
-   token = strtok(input, "|");
-   i = 0;
-   //commands are separated by | characters
-   while (token != NULL)
+   for (t = 0; t < tokens.cnt; t++)
    {
-      token = trimWhiteSpace(token);
-      if (i == MAXCMDSPERJOB) unixError("number of commands exceeded");
-      cmdlist[i].cmd = strdup(token);
-      cmdlist[i].filled = 1;
-      cmdlist[i].pipe = 1;
-      token = strtok(NULL, "|");
-      i++;
+      if (tok[t].type != TOK_WORD) continue;
+      words++;
+      if (t == 0 || tok[t - 1].type != TOK_WORD) cmds++;
    }
-   if (i >= 1) cmdlist[i-1].pipe = pipe;
+   cmdlist->cmd = spill(cmdlist->inlineCmd, sizeof(cmdlist->inlineCmd),
+                        cmds * sizeof(cmdList));
+   cmdlist->argv = spill(cmdlist->inlineArgv, sizeof(cmdlist->inlineArgv),
+                         (words + cmds) * sizeof(char *));
+   //one copy of the job for the cmd strings and one for the args
+   cmdlist->text = spill(cmdlist->inlineText, sizeof(cmdlist->inlineText),
+                         2 * (len + 1));
+   cmdText = cmdlist->text;
+   argText = cmdlist->text + len + 1;
+   memcpy(cmdText, job, len + 1);
+   memcpy(argText, job, len + 1);
+   argv = cmdlist->argv;
 
-   //command arguments are separate by whitespace
-   for (i = 0; cmdlist[i].filled == 1; i++)
+   //commands are separated by | characters and
+   //command arguments are the words between them
+   t = 0;
+   while (t < tokens.cnt)
    {
-      memset(input, '\0', MAXLINE);
-      strncpy(input, cmdlist[i].cmd, MAXLINE);
-      token = strtok(input, " ");
-      j = 0;
-      while (token != NULL)
+      for (first = t; t < tokens.cnt && tok[t].type == TOK_WORD; t++);
+      if (t > first)
       {
-         token = trimWhiteSpace(token);
-         if (j == MAXARGS) unixError("number of arguments exceeded");
-         cmdlist[i].args[j] = strdup(token);
-         token = strtok(NULL, " ");
-         j++;
+         cmd = &cmdlist->cmd[i++];
+         end = tok[t - 1].start + tok[t - 1].len;
+         cmdText[end] = '\0';
+         cmd->cmd = &cmdText[tok[first].start];
+         cmd->args = argv;
+         cmd->argc = t - first;
+         cmd->pipe = 1;
+         cmd->expanded = 0;
+         for (j = first; j < t; j++)
+         {
+            argText[tok[j].start + tok[j].len] = '\0';
+            *argv++ = &argText[tok[j].start];
+         }
+         *argv++ = NULL;
       }
+      t++;     //skip the |
    }
+   cmdlist->cnt = i;
+   //look for pipe at very end
+   if (i >= 1)
+      cmdlist->cmd[i-1].pipe = (tok[tokens.cnt - 1].type == TOK_PIPE);
+   freeTokens(&tokens);
 }
-         
-/* initCmdList
- * Initializes the cmdlist array to NULLs and 0s
+
+/* expandCmdList
+ * Replaces $NAME and ${NAME} in the args of each command with
+ * the values of the variables (see env.c) and then the wildcard
+ * patterns with the paths they match (see wildcard.c). For example,
+ *
+ * "wc -l *.c"  becomes  "wc" "-l" "jobs.c" "parser.c" "ush.c"
+ *
+ * The cmd strings are left as they are.
  */
-void initCmdList(cmdList cmdlist[MAXJOBSPERCMDLN])
+void expandCmdList(cmdArray * cmdlist)
 {
    int i, j;
-   for (i = 0; i < MAXCMDSPERJOB; i++)
+   for (i = 0; i < cmdlist->cnt; i++)
    {
-      cmdlist[i].cmd = NULL;
-      for (j = 0; j < MAXARGS; j++) 
-         cmdlist[i].args[j] = NULL; 
-      cmdlist[i].filled = 0;
-      cmdlist[i].pipe = 0;
+      for (j = 0; j < cmdlist->cmd[i].argc; j++)
+      {
+         if (hasWildcard(cmdlist->cmd[i].args[j]) ||
+             strchr(cmdlist->cmd[i].args[j], '$') != NULL)
+         {
+            expandCmd(&cmdlist->cmd[i]);
+            break;
+         }
+      }
    }
 }
 
-/* clearCmdList
- * Clears a cmdList array, freeing the space allocated for 
- * strings.
+/* expandCmd
+ * Expands the args of cmd into a new args block: the NULL ended
+ * array of pointers followed by the strings, in one allocation.
  */
-void clearCmdList(cmdList cmdlist[MAXJOBSPERCMDLN])
+static void expandCmd(cmdList * cmd)
 {
-   int i, j;
-   for (i = 0; i < MAXCMDSPERJOB; i++)
+   char *** matches = Malloc(cmd->argc * sizeof(char **));
+   char ** words = Malloc(cmd->argc * sizeof(char *));
+   int * cnt = Malloc(cmd->argc * sizeof(int));
+   int i, k, argc = 0;
+   size_t size = 0, len;
+   char ** args;
+   char * text, * vars;
+
+   for (i = 0; i < cmd->argc; i++)
+   {
+      matches[i] = NULL;
+      cnt[i] = 0;
+      vars = expandVars(cmd->args[i]);
+      words[i] = vars ? vars : cmd->args[i];
+      if (hasWildcard(words[i]))
+         matches[i] = expandWildcard(words[i], &cnt[i]);
+      if (matches[i] == NULL)
+      {
+         argc++;
+         size += strlen(words[i]) + 1;
+      }
+      for (k = 0; k < cnt[i]; k++) size += strlen(matches[i][k]) + 1;
+      argc += cnt[i];
+   }
+   args = Malloc((argc + 1) * sizeof(char *) + size);
+   text = (char *) &args[argc + 1];
+   argc = 0;
+   for (i = 0; i < cmd->argc; i++)
    {
-      if (cmdlist[i].filled)
+      for (k = 0; k < cnt[i] || (k == 0 && matches[i] == NULL); k++)
       {
-         free(cmdlist[i].cmd);
-         cmdlist[i].cmd = NULL;
-         for (j = 0; j < MAXARGS; j++) 
-            if (cmdlist[i].args[j] != NULL) 
-            {
-               free(cmdlist[i].args[j]);
-               cmdlist[i].args[j] = NULL;
-            }
-         cmdlist[i].filled = 0;
-         cmdlist[i].pipe = 0;
+         char * arg = matches[i] ? matches[i][k] : words[i];
+         len = strlen(arg) + 1;
+         memcpy(text, arg, len);
+         args[argc++] = text;
+         text += len;
       }
+      if (matches[i] != NULL) freeExpansion(matches[i], cnt[i]);
+      if (words[i] != cmd->args[i]) free(words[i]);
    }
+   args[argc] = NULL;
+   free(matches);
+   free(words);
+   free(cnt);
+   if (cmd->expanded) free(cmd->args);
+   cmd->args = args;
+   cmd->argc = argc;
+   cmd->expanded = 1;
 }
 
-/* printCmdList
- * Outputs the contents of the cmdlist array.
+/* initCmdList
+ * Initializes an empty cmdlist.
  */
-void printCmdList(cmdList cmdlist[MAXCMDSPERJOB])
+void initCmdList(cmdArray * cmdlist)
+{
+   cmdlist->cmd = cmdlist->inlineCmd;
+   cmdlist->argv = cmdlist->inlineArgv;
+   cmdlist->text = cmdlist->inlineText;
+   cmdlist->cnt = 0;
+}
+
+/* clearCmdList
+ * Clears a cmdlist, freeing the space allocated on the heap.
+ */
+void clearCmdList(cmdArray * cmdlist)
 {
    int i;
-   int j;
-   for (i = 0; i < MAXCMDSPERJOB; i++)
-   {
-      if (cmdlist[i].filled)
-      {
-         printf("command: %s ", cmdlist[i].cmd);
-         for (j = 0; cmdlist[i].args[j] != NULL; j++)
-         {
-            printf("arg%d: %s ", j, cmdlist[i].args[j]);
-         }
-         printf("pipe: %d\n", cmdlist[i].pipe);
-      }
-   }
+   for (i = 0; i < cmdlist->cnt; i++)
+      if (cmdlist->cmd[i].expanded) free(cmdlist->cmd[i].args);
+   if (cmdlist->cmd != cmdlist->inlineCmd) free(cmdlist->cmd);
+   if (cmdlist->argv != cmdlist->inlineArgv) free(cmdlist->argv);
+   if (cmdlist->text != cmdlist->inlineText) free(cmdlist->text);
+   initCmdList(cmdlist);
 }
 
-/* trimWhiteSpace
- * Removes the white space from the beginning and the
- * end of a string.
+/* printCmdList
+ * Outputs the contents of the cmdlist.
  */
-char * trimWhiteSpace(char * str)
+void printCmdList(cmdArray * cmdlist)
 {
-   char * end;
-   char * begin = str;
-   while (*begin == ' ') begin++;
-   end = begin;
-   while (*end != '\0') end++;
-   end--;
-   while (end > begin && isspace(*end)) 
+   int i;
+   int j;
+   for (i = 0; i < cmdlist->cnt; i++)
    {
-      *end = '\0';
-      end--;
+      printf("command: %s ", cmdlist->cmd[i].cmd);
+      for (j = 0; cmdlist->cmd[i].args[j] != NULL; j++)
+      {
+         printf("arg%d: %s ", j, cmdlist->cmd[i].args[j]);
+      }
+      printf("pipe: %d\n", cmdlist->cmd[i].pipe);
    }
-   return begin;
 }
 
 /* parseIntoJobs
@@ -177,85 +244,98 @@ char * trimWhiteSpace(char * str)
  *
  * "cmd1 ab c | cmd2 12 & cmd3 & cmd4 123"
  *
- * then the joblist array is initialized as follows:
+ * then the joblist is initialized as follows:
+ *
+ * joblist->cnt = 3
+ * joblist->job[0].job = "cmd1 ab c | cmd2 12"
+ * joblist->job[0].bg = 1
+ * joblist->job[1].job = "cmd3"
+ * joblist->job[1].bg = 1
+ * joblist->job[2].job = "cmd4 123"
+ * joblist->job[2].bg = 0
  *
- * joblist[0].job = "cmd1 ab c | cmd2 12"
- * joblist[0].filled = 1
- * joblist[0].bg = 1
- * joblist[1].job = "cmd3"
- * joblist[1].filled = 1
- * joblist[1].bg = 1
- * joblist[2].job = "cmd4 123"
- * joblist[1].filled = 1
- * joblist[1].bg = 0
+ * Empty jobs (as in "cmd1 & & cmd2") are skipped.
  */
-void parseIntoJobs(char * cmdline, jobList joblist[MAXJOBSPERCMDLN])
+void parseIntoJobs(char * cmdline, jobArray * joblist)
 {
-   int i = 0, bg = 0;
+   int len = strlen(cmdline);
+   int i = 0, t, first, end, jobs = 0;
+   tokenList tokens;
+   tokenT * tok;
+
    clearJobList(joblist);
-   cmdline = trimWhiteSpace(cmdline);
-   if (cmdline[strlen(cmdline) - 1] == '&') bg = 1;
-   char input[MAXLINE];
-   strncpy(input, cmdline, MAXLINE);
-   char * token = strtok(input, "&");
-   while (token != NULL)
+   initTokens(&tokens);
+   tokenize(cmdline, len, &tokens);
+   tok = tokens.tok;
+
+   for (t = 0; t < tokens.cnt; t++)
+      if (tok[t].type != TOK_AMP && (t == 0 || tok[t - 1].type == TOK_AMP))
+         jobs++;
+   joblist->job = spill(joblist->inlineJob, sizeof(joblist->inlineJob),
+                        jobs * sizeof(jobList));
+   joblist->text = spill(joblist->inlineText, sizeof(joblist->inlineText),
+                         len + 1);
+   memcpy(joblist->text, cmdline, len + 1);
+
+   t = 0;
+   while (t < tokens.cnt)
    {
-      token = trimWhiteSpace(token);
-      if (i == MAXJOBSPERCMDLN) unixError("too many jobs in commandline");
-      joblist[i].job = strdup(token);
-      joblist[i].filled = 1;
-      joblist[i].bg = 1;
-      token = strtok(NULL, "&");
-      i++;
+      for (first = t; t < tokens.cnt && tok[t].type != TOK_AMP; t++);
+      if (t > first)
+      {
+         end = tok[t - 1].start + tok[t - 1].len;
+         joblist->text[end] = '\0';
+         joblist->job[i].job = &joblist->text[tok[first].start];
+         joblist->job[i].bg = 1;
+         i++;
+      }
+      t++;     //skip the &
    }
-   if (i > 0) joblist[i-1].bg = bg; 
+   joblist->cnt = i;
+   if (i > 0)
+      joblist->job[i-1].bg = (tok[tokens.cnt - 1].type == TOK_AMP);
+   freeTokens(&tokens);
 }
 
 /* initJobList
- * Initialize a job list to NULLs and 0s
+ * Initialize an empty job list.
  */
-void initJobList(jobList joblist[MAXJOBSPERCMDLN])
+void initJobList(jobArray * joblist)
 {
-   int i;
-   for (i = 0; i < MAXJOBSPERCMDLN; i++)
-   {
-      joblist[i].filled = 0;
-      joblist[i].bg = 0;
-      joblist[i].job = NULL;
-   }
+   joblist->job = joblist->inlineJob;
+   joblist->text = joblist->inlineText;
+   joblist->cnt = 0;
 }
 
 /* clearJobList
  * Clears the job list, freeing the space allocated
- * for strings.
+ * on the heap.
  */
-void clearJobList(jobList joblist[MAXJOBSPERCMDLN])
+void clearJobList(jobArray * joblist)
 {
-   int i;
-   for (i = 0; i < MAXJOBSPERCMDLN; i++)
-   {
-      if (joblist[i].filled == 1) 
-      {
-         free(joblist[i].job);
-         joblist[i].job = NULL;
-      }
-      joblist[i].filled = 0;
-      joblist[i].bg = 0;
-   }
+   if (joblist->job != joblist->inlineJob) free(joblist->job);
+   if (joblist->text != joblist->inlineText) free(joblist->text);
+   initJobList(joblist);
 }
 
 /* printJobList
  * Outputs the job list.
  */
-void printJobList(jobList joblist[MAXJOBSPERCMDLN])
+void printJobList(jobArray * joblist)
 {
    int i;
-   for (i = 0; i < MAXJOBSPERCMDLN; i++)
+   for (i = 0; i < joblist->cnt; i++)
    {
-      if (joblist[i].filled == 1)
-      {
-         printf("job: %s bg: %d\n", joblist[i].job, joblist[i].bg);
-      }
+      printf("job: %s bg: %d\n", joblist->job[i].job, joblist->job[i].bg);
    }
 }
 
+/* spill
+ * Returns inlineBuf if size bytes fit in it and space
+ * allocated on the heap otherwise.
+ */
+static void * spill(void * inlineBuf, size_t inlineSize, size_t size)
+{
+   if (size <= inlineSize) return inlineBuf;
+   return Malloc(size);
+}
@@ -1,32 +1,60 @@
-#define MAXLINE                500  /* max line size */
-#define MAXARGS                10   /* max number of command line args */
-#define MAXLEN                 50   /* max length of an individual argument */
-#define MAXJOBSPERCMDLN        10   /* max number of jobs in a command line */
-#define MAXCMDSPERJOB          10   /* max number of commands in a job */
+
+/* There are no limits on the size of a command line or on the number
+ * of jobs, commands and arguments in it.  Small command lines are
+ * parsed into storage inside the jobArray and cmdArray structs;
+ * larger ones spill to the heap.  Because of the inline storage these
+ * structs must not be copied.
+ */
+#define INLINEJOBS             4    /* jobs stored in a jobArray */
+#define INLINECMDS             4    /* commands stored in a cmdArray */
+#define INLINEARGS             32   /* args (and NULLs) stored in a cmdArray */
+#define INLINETEXT             256  /* bytes of text stored in either */
 
 typedef struct
 {
    char * job;      /* the commands that make up a job: cmd1 23 | cmd2 */
-   int filled;      /* 1 ifthis job entry is filled */
    int bg;          /* 1 if the job runs in the background */
 } jobList;
 
+typedef struct             /* The jobs of a command line */
+{
+   jobList * job;          /* the jobs: inlineJob or the heap */
+   int cnt;                /* number of jobs */
+   char * text;            /* the job strings: inlineText or the heap */
+   jobList inlineJob[INLINEJOBS];
+   char inlineText[INLINETEXT];
+} jobArray;
+
 typedef struct
 {
    char * cmd;            /* a single command and its arguments */
-   char * args[MAXARGS];  /* the parsed command and its args */
-   int filled;            /* 1 if this cmdlist entry is filled */
+   char ** args;          /* the parsed command and its args, NULL ended */
+   int argc;              /* number of args */
    int pipe;              /* 1 if the output of this command is piped */
+   int expanded;          /* 1 if args is a heap block from expandCmdList */
 } cmdList;
 
+typedef struct             /* The commands of a job */
+{
+   cmdList * cmd;          /* the commands: inlineCmd or the heap */
+   int cnt;                /* number of commands */
+   char ** argv;           /* the args of all commands: inlineArgv or heap */
+   char * text;            /* cmd and arg strings: inlineText or the heap */
+   cmdList inlineCmd[INLINECMDS];
+   char * inlineArgv[INLINEARGS];
+   char inlineText[INLINETEXT];
+} cmdArray;
+
 //jobs are separated by &
-void initJobList(jobList joblist[MAXJOBSPERCMDLN]);
-void parseIntoJobs(char * cmdline, jobList joblist[MAXJOBSPERCMDLN]); 
-void printJobList(jobList joblist[MAXJOBSPERCMDLN]); 
+void initJobList(jobArray * joblist);
+void parseIntoJobs(char * cmdline, jobArray * joblist);
+void printJobList(jobArray * joblist);
+void clearJobList(jobArray * joblist);
 
 //commands are jobs separated by |
-void initCmdList(cmdList cmdlist[MAXCMDSPERJOB]);
-void parseIntoCmds(char * job, cmdList cmdlist[MAXCMDSPERJOB]); 
-void printCmdList(cmdList cmdlist[MAXCMDSPERJOB]); 
-int getCmdCount(cmdList cmdlist[MAXCMDSPERJOB]);
-
+void initCmdList(cmdArray * cmdlist);
+void parseIntoCmds(char * job, cmdArray * cmdlist);
+void printCmdList(cmdArray * cmdlist);
+int getCmdCount(cmdArray * cmdlist);
+void expandCmdList(cmdArray * cmdlist);
+void clearCmdList(cmdArray * cmdlist);
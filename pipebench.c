@@ -0,0 +1,118 @@
+/*
+ *  pipebench [N ...]
+ *  Times setting up and running an N stage pipeline of /bin/true
+ *  two ways: the way ush used to (all pipes made up front, every
+ *  stage closing all the others) and the way it does now (close on
+ *  exec pipes made one stage at a time, each stage dup2-ing only its
+ *  own ends).  The first way makes O(N^2) close calls.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "wrappers.h"
+
+#define RUNS 5   /* runs averaged for each N */
+
+static char * args[] = {"true", NULL};
+
+
+/* allPipes
+ * Runs n stages with n - 1 pipes made up front; each stage
+ * closes every pipe fd it does not use.
+ */
+static void allPipes(int n)
+{
+   int (*fd)[2] = malloc(n * sizeof(*fd));
+   int i, j;
+
+   for (i = 0; i < n - 1; i++) pipe(fd[i]);
+   for (i = 0; i < n; i++)
+   {
+      if (fork() == 0)
+      {
+         if (i > 0) dup2(fd[i - 1][0], 0);
+         if (i < n - 1) dup2(fd[i][1], 1);
+         for (j = 0; j < n - 1; j++)
+         {
+            close(fd[j][0]);
+            close(fd[j][1]);
+         }
+         execvp(args[0], args);
+         _exit(127);
+      }
+   }
+   for (i = 0; i < n - 1; i++)
+   {
+      close(fd[i][0]);
+      close(fd[i][1]);
+   }
+   while (wait(NULL) > 0);
+   free(fd);
+}
+
+/* stagePipes
+ * Runs n stages with close on exec pipes made one stage at a
+ * time; each stage only dup2s its own ends.
+ */
+static void stagePipes(int n)
+{
+   int i, in = -1, fd[2];
+
+   for (i = 0; i < n; i++)
+   {
+      if (i < n - 1) pipe2(fd, O_CLOEXEC);
+      if (fork() == 0)
+      {
+         if (in >= 0) dup2(in, 0);
+         if (i < n - 1) dup2(fd[1], 1);
+         execvp(args[0], args);
+         _exit(127);
+      }
+      if (in >= 0) close(in);
+      if (i < n - 1)
+      {
+         close(fd[1]);
+         in = fd[0];
+      }
+   }
+   while (wait(NULL) > 0);
+}
+
+int main(int argc, char ** argv)
+{
+   int defaults[] = {2, 10, 50, 100, 200, 400};
+   int i, r, n, cnt = argc > 1 ? argc - 1 : 6;
+   double t, old, new;
+   struct rlimit lim;
+
+   //the up front pipes of a long pipeline need many fds
+   getrlimit(RLIMIT_NOFILE, &lim);
+   lim.rlim_cur = lim.rlim_max;
+   setrlimit(RLIMIT_NOFILE, &lim);
+   printf("%6s %14s %14s %8s\n", "stages", "all pipes ms", "per stage ms",
+          "ratio");
+   for (i = 0; i < cnt; i++)
+   {
+      n = argc > 1 ? atoi(argv[i + 1]) : defaults[i];
+      if (n < 1) continue;
+      old = new = 0;
+      for (r = 0; r < RUNS; r++)
+      {
+         t = seconds();
+         allPipes(n);
+         old += seconds() - t;
+         t = seconds();
+         stagePipes(n);
+         new += seconds() - t;
+      }
+      old /= RUNS;
+      new /= RUNS;
+      printf("%6d %14.2f %14.2f %8.2f\n", n, old * 1e3, new * 1e3, old / new);
+   }
+   return 0;
+}
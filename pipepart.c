@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "events.h"
+#include "pipepart.h"
+
+typedef struct             /* A chunk of the file and its copy */
+{
+   char * data;            /* the chunk in the mapping */
+   size_t len;
+   size_t fed;             /* bytes of it in the pipe so far */
+   int inFd;               /* write end of the copy's input; -1 once done */
+   int outFd;              /* read end of its output; -1 at EOF */
+   char * buf;             /* output not written yet */
+   size_t bufLen, bufCap;
+   size_t pos;             /* start of the unwritten output in buf */
+   int jid;
+} partT;
+
+static partT * parts = NULL;
+static int partCnt = 0;
+static int openCnt = 0;     /* outputs not at EOF yet */
+static int current = 0;     /* the chunk concat output is at */
+static int sorted = 0;      /* 1 for --merge sort */
+
+//not needed outside of this file
+static void feedPart(int fd, short revents, void * arg);
+static void drainPart(int fd, short revents, void * arg);
+static void emitConcat();
+static void emitSorted();
+static char * lineEnd(partT * p);
+static char * cLocale(char * cmdline);
+
+/* pipepartCmd
+ * The pipepart builtin (see pipepart.h).  job is the job as
+ * typed; the copies of its cmdline are started with run and fed
+ * and drained by the event loop until they are done.
+ */
+void pipepartCmd(char * job, partRunFn run, jobT jobs[MAXJOBS])
+{
+   char * p = job, * word, * path = NULL, * cmdline, * map, * start, * end;
+   int i, n = sysconf(_SC_NPROCESSORS_ONLN), fd, in[2], out[2], bad = 0;
+   struct stat st;
+
+   sorted = 0;
+   free(nextWord(&p));   //pipepart
+   while (!bad && (word = nextWord(&p)) != NULL)
+   {
+      if (strcmp(word, "-j") == 0 && (free(word), word = nextWord(&p)) != NULL)
+         n = atoi(word);
+      else if (strcmp(word, "--merge") == 0 &&
+               (free(word), word = nextWord(&p)) != NULL &&
+               (strcmp(word, "sort") == 0 || strcmp(word, "concat") == 0))
+         sorted = (word[0] == 's');
+      else if (strcmp(word, "<") == 0) ;
+      else if (word[0] != '-') path = word, word = NULL;
+      else bad = 1;
+      free(word);
+      if (path != NULL) break;
+   }
+   p += strspn(p, BLANKS);
+   if (bad || path == NULL || *p == '\0' || n < 1)
+   {
+      printf("usage: pipepart [-j N] [--merge concat|sort] [<] file cmdline\n");
+      free(path);
+      return;
+   }
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0)
+   {
+      printf("pipepart: %s: %s\n", path, strerror(errno));
+      if (fd >= 0) close(fd);
+      free(path);
+      return;
+   }
+   //one jobs entry stays free for other foreground jobs
+   if (n > freeJobs(jobs) - 1) n = freeJobs(jobs) - 1;
+   map = MAP_FAILED;
+   if (st.st_size == 0) printf("pipepart: %s: empty file\n", path);
+   else if (n < 1) printf("pipepart: no free job entries\n");
+   else if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+            == MAP_FAILED)
+      printf("pipepart: %s: %s\n", path, strerror(errno));
+   close(fd);
+   free(path);
+   if (map == MAP_FAILED) return;
+   madvise(map, st.st_size, MADV_SEQUENTIAL);
+   cmdline = sorted ? cLocale(p) : strdup(p);
+   parts = calloc(n, sizeof(partT));
+   if (parts == NULL) unixError("calloc error");
+   partCnt = openCnt = current = 0;
+   //split on line boundaries; small files get fewer chunks
+   for (start = map, i = 0; i < n && start < map + st.st_size; i++)
+   {
+      end = (i == n - 1) ? map + st.st_size : start + (map + st.st_size - start) / (n - i);
+      //a chunk has at least one byte, so end[-1] is in it
+      while (end < map + st.st_size && (end == start || end[-1] != '\n'))
+         end++;
+      Pipe2(in, O_CLOEXEC);
+      Pipe2(out, O_CLOEXEC);
+      fcntl(in[1], F_SETPIPE_SZ, PARTPIPESIZE);
+      fcntl(out[0], F_SETPIPE_SZ, PARTPIPESIZE);
+      fcntl(in[1], F_SETFL, O_NONBLOCK);
+      partT * part = &parts[partCnt++];
+      part->data = start;
+      part->len = end - start;
+      part->jid = run(cmdline, in[0], out[1]);
+      close(in[0]);
+      close(out[1]);
+      part->inFd = in[1];
+      part->outFd = out[0];
+      addEvent(in[1], POLLOUT, feedPart, part);
+      addEvent(out[0], POLLIN, drainPart, part);
+      openCnt++;
+      start = end;
+   }
+   while (openCnt > 0) runEvents(-1);
+   //the copies are done once their outputs are; wait to reap them
+   for (i = 0; i < partCnt; i++)
+   {
+      while (parts[i].jid != 0 && getJobJid(parts[i].jid, jobs) != NULL)
+         runEvents(-1);
+      if (parts[i].inFd >= 0)
+      {
+         removeEvent(parts[i].inFd);
+         close(parts[i].inFd);
+      }
+      free(parts[i].buf);
+   }
+   fflush(stdout);
+   munmap(map, st.st_size);
+   free(parts);
+   free(cmdline);
+   parts = NULL;
+   partCnt = 0;
+}
+
+/* feedPart
+ * Event handler for the input pipe of a copy: moves more of its
+ * chunk into the pipe.  vmsplice maps the pages of the file into
+ * the pipe instead of copying them; if it cannot, they are written.
+ */
+static void feedPart(int fd, short revents, void * arg)
+{
+   partT * p = arg;
+   struct iovec iov;
+   ssize_t n;
+
+   iov.iov_base = p->data + p->fed;
+   iov.iov_len = p->len - p->fed;
+   n = vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+   if (n < 0 && errno != EAGAIN) n = write(fd, iov.iov_base, iov.iov_len);
+   if (n > 0) p->fed += n;
+   //the copy may have quit early, like head; then stop feeding it
+   //(ush catches SIGPIPE, so the write fails with EPIPE)
+   if (p->fed == p->len || (n < 0 && errno != EAGAIN) || (revents & POLLERR))
+   {
+      removeEvent(fd);
+      close(fd);
+      p->inFd = -1;
+   }
+}
+
+/* drainPart
+ * Event handler for the output pipe of a copy: reads what it
+ * wrote and emits what can be written in order.
+ */
+static void drainPart(int fd, short revents, void * arg)
+{
+   partT * p = arg;
+   ssize_t n;
+
+   if (p->bufCap - p->bufLen < PARTREAD)
+   {
+      //drop what was written before growing
+      memmove(p->buf, p->buf + p->pos, p->bufLen - p->pos);
+      p->bufLen -= p->pos;
+      p->pos = 0;
+      if (p->bufCap - p->bufLen < PARTREAD)
+      {
+         p->bufCap = 2 * p->bufCap + PARTREAD;
+         p->buf = realloc(p->buf, p->bufCap);
+         if (p->buf == NULL) unixError("realloc error");
+      }
+   }
+   n = read(fd, p->buf + p->bufLen, p->bufCap - p->bufLen);
+   if (n < 0 && errno == EINTR) return;
+   if (n > 0) p->bufLen += n;
+   else
+   {
+      removeEvent(fd);
+      close(fd);
+      p->outFd = -1;
+      openCnt--;
+   }
+   if (sorted) emitSorted();
+   else emitConcat();
+}
+
+/* emitConcat
+ * Writes the output of the chunk concat is at, and moves on to the
+ * next chunk once it is at EOF.
+ */
+static void emitConcat()
+{
+   partT * p;
+
+   while (current < partCnt)
+   {
+      p = &parts[current];
+      fwrite(p->buf + p->pos, 1, p->bufLen - p->pos, stdout);
+      p->pos = p->bufLen;
+      if (p->outFd >= 0) return;
+      current++;
+   }
+}
+
+/* emitSorted
+ * Writes the smallest line at the front of the outputs for as
+ * long as every output has a whole line at its front or is at
+ * EOF; until then a smaller line may still come.
+ */
+static void emitSorted()
+{
+   int i, best;
+   char * e, * bestEnd = NULL;
+   size_t len, bestLen = 0;
+   partT * p;
+
+   while (1)
+   {
+      best = -1;
+      for (i = 0; i < partCnt; i++)
+      {
+         p = &parts[i];
+         if ((e = lineEnd(p)) == NULL)
+         {
+            if (p->outFd >= 0) return;
+            continue;
+         }
+         len = e - (p->buf + p->pos);
+         if (best < 0 || memcmp(p->buf + p->pos, parts[best].buf + parts[best].pos,
+                                len < bestLen ? len : bestLen) < 0 ||
+             (len < bestLen && memcmp(p->buf + p->pos, parts[best].buf +
+                                      parts[best].pos, len) == 0))
+         {
+            best = i;
+            bestEnd = e;
+            bestLen = len;
+         }
+      }
+      if (best < 0) return;
+      p = &parts[best];
+      fwrite(p->buf + p->pos, 1, bestLen, stdout);
+      fputc('\n', stdout);
+      //past the newline, unless the line was the last without one
+      p->pos += bestLen + (bestEnd < p->buf + p->bufLen);
+   }
+}
+
+/* lineEnd
+ * Returns the end (the newline) of the line at the front of the
+ * output of p, the end of the output for a last line without a
+ * newline, or NULL if there is no whole line yet.
+ */
+static char * lineEnd(partT * p)
+{
+   char * e = memchr(p->buf + p->pos, '\n', p->bufLen - p->pos);
+
+   if (e != NULL) return e;
+   if (p->outFd < 0 && p->pos < p->bufLen) return p->buf + p->bufLen;
+   return NULL;
+}
+
+/* cLocale
+ * Returns cmdline in new space with LC_ALL=C in front of each of
+ * its commands.
+ */
+static char * cLocale(char * cmdline)
+{
+   char * s = Malloc(strlen(cmdline) * 2 + 16), * d = s, * c;
+
+   d += sprintf(d, "LC_ALL=C ");
+   for (c = cmdline; *c != '\0'; c++)
+   {
+      *d++ = *c;
+      if (*c == '|') d += sprintf(d, " LC_ALL=C ");
+   }
+   *d = '\0';
+   return s;
+}
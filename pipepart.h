@@ -0,0 +1,24 @@
+/*
+ *  The pipepart builtin: runs a filter over a file on all cores.
+ *  pipepart [-j N] [--merge concat|sort] [<] file cmdline
+ *  The file is mapped and split on line boundaries into N chunks
+ *  (one per online CPU by default) and N copies of cmdline are
+ *  started as foreground jobs, each reading its chunk from a pipe
+ *  the chunk is vmspliced into straight from the mapping.
+ *  With --merge concat (the default) the outputs are written in
+ *  chunk order, as a line by line filter like grep would write
+ *  them for the whole file; the output of a chunk is held until
+ *  the chunks before it are done.  With --merge sort the sorted
+ *  outputs are merged line by line as they arrive, which gives
+ *  sort over the whole file.  The merge compares bytes, so each
+ *  command of the copies is run with LC_ALL=C to sort the same way.
+ */
+
+#define PARTPIPESIZE (1 << 20)   /* size asked for the pipes */
+#define PARTREAD 65536           /* bytes read from an output at once */
+
+/* starts cmdline in the foreground reading inFd and writing outFd
+ * without waiting for it; returns its jid or 0 */
+typedef int (*partRunFn)(char * cmdline, int inFd, int outFd);
+
+void pipepartCmd(char * job, partRunFn run, jobT jobs[MAXJOBS]);
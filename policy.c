@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "wrappers.h"
+#include "parser.h"
+#include "jobs.h"
+#include "policy.h"
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+
+static policyT fgPolicy = { POL_NORMAL, 0, IOP_NONE, 0 };
+static policyT bgPolicy = { POL_BATCH, 10, IOP_IDLE, 0 };
+static int baseNice = 0;   /* nice value of the shell itself */
+
+static const char * schedNames[] = { "normal", "batch", "idle" };
+static const char * ioNames[] = { "none", "rt", "be", "idle" };
+
+//not needed outside of this file
+static int parsePolicy(char * args[], policyT * pol);
+static void printPolicy(char * name, policyT * pol);
+
+/* initPolicies
+ * Records the nice value of the shell.  The nice offsets
+ * of the policies are relative to it.
+ */
+void initPolicies()
+{
+   errno = 0;
+   baseNice = getpriority(PRIO_PROCESS, 0);
+   if (errno != 0) baseNice = 0;
+}
+
+/* applyPolicy
+ * Applies the policy for the given job state (FG or BG) to
+ * the process pid.  A pid of 0 means the calling process,
+ * which is how children apply their policy before the exec.
+ * This is best effort: an unprivileged shell can lower the
+ * priority of a process but not raise it again, so moving
+ * a job from BG to FG may leave it with its BG policy.
+ */
+void applyPolicy(pid_t pid, int state)
+{
+   policyT * pol = (state == BG) ? &bgPolicy : &fgPolicy;
+   struct sched_param param;
+   int sched = SCHED_OTHER;
+
+   if (pol->sched == POL_BATCH) sched = SCHED_BATCH;
+   if (pol->sched == POL_IDLE) sched = SCHED_IDLE;
+   param.sched_priority = 0;
+   sched_setscheduler(pid, sched, &param);
+   setpriority(PRIO_PROCESS, pid, baseNice + pol->nice);
+   syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid,
+           IOPRIO_VALUE(pol->ioclass, pol->iolevel));
+}
+
+/* describePolicy
+ * Writes the effective policy of process pid, as reported by
+ * the kernel, into buf. For example: "batch nice 10 io idle"
+ */
+void describePolicy(pid_t pid, char * buf, int len)
+{
+   int sched, nice, io, ioclass;
+   const char * name = "?";
+
+   sched = sched_getscheduler(pid);
+   if (sched == SCHED_OTHER) name = schedNames[POL_NORMAL];
+   if (sched == SCHED_BATCH) name = schedNames[POL_BATCH];
+   if (sched == SCHED_IDLE) name = schedNames[POL_IDLE];
+   errno = 0;
+   nice = getpriority(PRIO_PROCESS, pid);
+   if (errno != 0) nice = 0;
+   io = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+   ioclass = (io < 0) ? IOP_NONE : (io >> IOPRIO_CLASS_SHIFT) & 3;
+   if (ioclass == IOP_BE || ioclass == IOP_RT)
+      snprintf(buf, len, "%s nice %d io %s/%d", name, nice,
+               ioNames[ioclass], io & 7);
+   else
+      snprintf(buf, len, "%s nice %d io %s", name, nice, ioNames[ioclass]);
+}
+
+/* policyCmd
+ * Handles the policy builtin. args[0] is "policy".
+ * policy                 - prints the FG and BG policies
+ * policy bg|fg class [nice N] [io none|idle|be N]
+ *                        - sets the policy used for a state;
+ *                          class is normal, batch or idle
+ * For example:
+ *    policy bg idle io idle
+ *    policy bg batch nice 5 io be 7
+ * Returns 0 on success and -1 if the arguments are bad.
+ */
+int policyCmd(char * args[])
+{
+   policyT pol;
+
+   if (args[1] == NULL)
+   {
+      printPolicy("fg", &fgPolicy);
+      printPolicy("bg", &bgPolicy);
+      return 0;
+   }
+   if (strcmp(args[1], "fg") != 0 && strcmp(args[1], "bg") != 0)
+   {
+      printf("usage: policy [fg|bg normal|batch|idle [nice N] "
+             "[io none|idle|be N]]\n");
+      return -1;
+   }
+   pol = (args[1][0] == 'f') ? fgPolicy : bgPolicy;
+   if (parsePolicy(&args[2], &pol) == -1)
+   {
+      printf("policy: bad policy\n");
+      return -1;
+   }
+   if (args[1][0] == 'f') fgPolicy = pol;
+   else bgPolicy = pol;
+   return 0;
+}
+
+/* parsePolicy
+ * Fills pol from the words "class [nice N] [io class [N]]".
+ * Returns -1 if a word is not understood.
+ */
+static int parsePolicy(char * args[], policyT * pol)
+{
+   int i, j;
+
+   for (i = 0; args[i] != NULL; i++)
+   {
+      for (j = POL_NORMAL; j <= POL_IDLE; j++)
+         if (strcmp(args[i], schedNames[j]) == 0) break;
+      if (j <= POL_IDLE)
+      {
+         pol->sched = j;
+      } else if (strcmp(args[i], "nice") == 0 && args[i + 1] != NULL)
+      {
+         pol->nice = atoi(args[++i]);
+         if (pol->nice < -20 || pol->nice > 19) return -1;
+      } else if (strcmp(args[i], "io") == 0 && args[i + 1] != NULL)
+      {
+         i++;
+         if (strcmp(args[i], "none") == 0) pol->ioclass = IOP_NONE;
+         else if (strcmp(args[i], "idle") == 0) pol->ioclass = IOP_IDLE;
+         else if (strcmp(args[i], "be") == 0) pol->ioclass = IOP_BE;
+         else return -1;
+         pol->iolevel = 0;
+         if (pol->ioclass == IOP_BE && args[i + 1] != NULL
+             && isdigit((unsigned char) args[i + 1][0]))
+         {
+            pol->iolevel = atoi(args[++i]);
+            if (pol->iolevel > 7) return -1;
+         }
+      } else return -1;
+   }
+   return 0;
+}
+
+/* printPolicy
+ * Outputs a policy.
+ */
+static void printPolicy(char * name, policyT * pol)
+{
+   printf("%s: %s nice %+d io %s", name, schedNames[pol->sched],
+          pol->nice, ioNames[pol->ioclass]);
+   if (pol->ioclass == IOP_BE) printf(" %d", pol->iolevel);
+   printf("\n");
+}
@@ -0,0 +1,33 @@
+/*
+ *  Scheduling policies for jobs.
+ *  Every child applies the policy for its job state (FG or BG)
+ *  right before it execs.  When a job moves between FG and BG the
+ *  shell re-applies the policy of the new state to each of its
+ *  processes.
+ */
+
+#include <sys/types.h>
+
+/* Scheduling classes */
+#define POL_NORMAL 0   /* SCHED_OTHER */
+#define POL_BATCH  1   /* SCHED_BATCH */
+#define POL_IDLE   2   /* SCHED_IDLE */
+
+/* I/O priority classes (see ioprio_set(2)) */
+#define IOP_NONE   0   /* derived from the nice value */
+#define IOP_RT     1   /* real time */
+#define IOP_BE     2   /* best effort */
+#define IOP_IDLE   3   /* only when the disk is otherwise idle */
+
+typedef struct             /* The policy struct */
+{
+   int sched;              /* POL_NORMAL, POL_BATCH or POL_IDLE */
+   int nice;               /* offset added to the shell's nice value */
+   int ioclass;            /* IOP_NONE, IOP_BE or IOP_IDLE */
+   int iolevel;            /* 0 (highest) - 7 (lowest) for IOP_BE */
+} policyT;
+
+void initPolicies();
+void applyPolicy(pid_t pid, int state);
+void describePolicy(pid_t pid, char * buf, int len);
+int policyCmd(char * args[]);
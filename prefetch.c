@@ -0,0 +1,585 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <elf.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "events.h"
+#include "env.h"
+#include "prefetch.h"
+
+typedef struct             /* A command in the statistics */
+{
+   char * path;            /* NULL if the slot is unused */
+   int gen;                /* bumped when the slot is reused */
+   long uses;
+   double score;           /* as of last */
+   time_t last;            /* when it was last run */
+   long coldCnt, warmCnt;  /* runs that started cold and warm */
+   double coldMs, warmMs;  /* their total ms */
+   int libCnt;             /* -1 until its libraries are looked up */
+   char * lib[PREFETCHLIBS];
+   int cold;               /* 1 if the last round left a file of it out
+                              of the page cache, 0 if not or it ran
+                              since; -1 if not known */
+} cmdStatT;
+
+typedef struct             /* A run being timed */
+{
+   int entry;              /* -1 if the probe is free */
+   int gen;                /* of the entry when the run started */
+   int cold;
+   double start;
+} probeT;
+
+static cmdStatT stats[PREFETCHMAX];
+static probeT probes[PREFETCHPROBES];
+static long budget = PREFETCHBUDGET;
+static int timerFd = -1;
+static int dirty = 0;          /* stats changed since they were saved */
+static pid_t owner;            /* the ush that saves the stats */
+static long roundFiles = 0, roundBytes = 0;   /* of the last round */
+static time_t roundTime = 0;
+
+static const char * libDirs[] = {
+#if defined(__x86_64__)
+   "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu",
+#elif defined(__aarch64__)
+   "/lib/aarch64-linux-gnu", "/usr/lib/aarch64-linux-gnu",
+#endif
+   "/lib64", "/usr/lib64", "/lib", "/usr/lib", "/usr/local/lib", NULL};
+
+//not needed outside of this file
+static void readTimer(int fd, short revents, void * arg);
+static void probeDone(int fd, short revents, void * arg);
+static void prefetchRound(int report);
+static long prefetchFile(char * path, long left);
+static long residentBytes(int fd, long size);
+static void findLibs(cmdStatT * s);
+static int libPath(char * name, char * path);
+static int resolve(char * name, char * path);
+static int findEntry(char * path);
+static double scoreNow(cmdStatT * s, time_t now);
+static void loadStats();
+static void saveStats();
+static void writeStats(FILE * fp);
+static void listStats();
+
+/* initPrefetch
+ * Loads the statistics and reads ahead the best scoring commands.
+ * The statistics are saved after each idle round and when ush
+ * exits.
+ */
+void initPrefetch()
+{
+   int i;
+
+   for (i = 0; i < PREFETCHMAX; i++) stats[i].libCnt = stats[i].cold = -1;
+   for (i = 0; i < PREFETCHPROBES; i++) probes[i].entry = -1;
+   owner = getpid();
+   loadStats();
+   atexit(saveStats);
+   timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (timerFd < 0) unixError("timerfd_create error");
+   addEvent(timerFd, POLLIN, readTimer, NULL);
+   prefetchRound(0);
+}
+
+/* prefetchIdle
+ * Called with 1 when ush prompts for input and 0 when it has a
+ * command line to run: a round runs once the prompt has been idle
+ * for PREFETCHIDLE ms.
+ */
+void prefetchIdle(int idle)
+{
+   struct itimerspec its;
+
+   if (timerFd < 0) return;
+   memset(&its, 0, sizeof(its));
+   if (idle)
+   {
+      its.it_value.tv_sec = PREFETCHIDLE / 1000;
+      its.it_value.tv_nsec = PREFETCHIDLE % 1000 * 1000000L;
+   }
+   timerfd_settime(timerFd, 0, &its, NULL);
+}
+
+/* probeExec
+ * Called before forking the process that will exec name: counts
+ * the run in the statistics and notes whether it starts cold, as
+ * the last round found it (looking at the page cache here would
+ * hold up the fork).  Returns a probe to pass to probeStarted
+ * with the pid, or -1 if the run is not timed (name is not found,
+ * whether it is cold is not known, or PREFETCHPROBES runs are
+ * being timed already).
+ */
+int probeExec(char * name)
+{
+   char path[PATH_MAX];
+   int i, p, cold;
+   time_t now = time(NULL);
+   cmdStatT * s;
+
+   if (timerFd < 0 || name == NULL || !resolve(name, path)) return -1;
+   if ((i = findEntry(path)) < 0) return -1;
+   s = &stats[i];
+   s->score = scoreNow(s, now) + 1;
+   s->last = now;
+   s->uses++;
+   dirty = 1;
+   cold = s->cold;
+   //the run pages in what it needs
+   s->cold = 0;
+   for (p = 0; p < PREFETCHPROBES && probes[p].entry >= 0; p++);
+   if (p == PREFETCHPROBES || cold < 0) return -1;
+   probes[p].entry = i;
+   probes[p].gen = s->gen;
+   probes[p].cold = cold;
+   probes[p].start = seconds();
+   return p;
+}
+
+/* probeStarted
+ * Starts watching the process pid of probe for its exit.
+ */
+void probeStarted(int probe, pid_t pid)
+{
+   int fd;
+
+   if (probe < 0) return;
+   if ((fd = pidfdOpen(pid)) < 0)
+   {
+      probes[probe].entry = -1;
+      return;
+   }
+   addEvent(fd, POLLIN, probeDone, &probes[probe]);
+}
+
+/* prefetchCmd
+ * The prefetch builtin:
+ * prefetch [list] lists the commands by score with the average
+ * ms of their cold and warm runs, prefetch now runs a round,
+ * prefetch budget [SIZE[k|m|g]] shows or sets the budget of a
+ * round and prefetch clear drops the statistics.
+ */
+void prefetchCmd(char ** args)
+{
+   char * end;
+   long size;
+   int i;
+
+   if (args[1] == NULL || strcmp(args[1], "list") == 0) listStats();
+   else if (strcmp(args[1], "now") == 0) prefetchRound(1);
+   else if (strcmp(args[1], "budget") == 0 && args[2] == NULL)
+      printf("prefetch budget: %ldk\n", budget >> 10);
+   else if (strcmp(args[1], "budget") == 0)
+   {
+      size = strtol(args[2], &end, 10);
+      if (*end == 'k' || *end == 'K') size <<= 10, end++;
+      else if (*end == 'm' || *end == 'M') size <<= 20, end++;
+      else if (*end == 'g' || *end == 'G') size <<= 30, end++;
+      if (*end != '\0' || size < 0) printf("prefetch: bad size %s\n", args[2]);
+      else budget = size;
+   }
+   else if (strcmp(args[1], "clear") == 0)
+   {
+      for (i = 0; i < PREFETCHMAX; i++)
+      {
+         if (stats[i].path == NULL) continue;
+         free(stats[i].path);
+         while (stats[i].libCnt > 0) free(stats[i].lib[--stats[i].libCnt]);
+         memset(&stats[i], 0, sizeof(cmdStatT));
+         stats[i].libCnt = stats[i].cold = -1;
+         stats[i].gen++;
+      }
+      dirty = 1;
+      saveStats();
+   }
+   else printf("usage: prefetch [list | now | budget [SIZE] | clear]\n");
+}
+
+/* readTimer
+ * Event handler for the idle timer: runs a round.
+ */
+static void readTimer(int fd, short revents, void * arg)
+{
+   unsigned long long expirations;
+
+   if (read(fd, &expirations, sizeof(expirations)) > 0) prefetchRound(0);
+}
+
+/* probeDone
+ * Event handler for the pidfd of a timed run: the process exited,
+ * so its time goes to the cold or warm runs of its command.
+ */
+static void probeDone(int fd, short revents, void * arg)
+{
+   probeT * p = arg;
+   cmdStatT * s = &stats[p->entry];
+   double ms = (seconds() - p->start) * 1000;
+
+   //the slot may have been given to another command meanwhile
+   if (s->path != NULL && s->gen == p->gen)
+   {
+      if (p->cold) s->coldCnt++, s->coldMs += ms;
+      else s->warmCnt++, s->warmMs += ms;
+      dirty = 1;
+   }
+   removeEvent(fd);
+   close(fd);
+   p->entry = -1;
+}
+
+/* prefetchRound
+ * Reads ahead the binaries and libraries of the PREFETCHTOP best
+ * scoring commands, best first, for at most budget bytes that are
+ * not in the page cache yet; a file that does not fit in what is
+ * left is skipped, and leaves the commands that need it cold.
+ * Prints what it did if report is 1, and saves the statistics.
+ */
+static void prefetchRound(int report)
+{
+   char * seen[PREFETCHTOP * (PREFETCHLIBS + 1)];
+   long got[PREFETCHTOP * (PREFETCHLIBS + 1)];
+   int picked[PREFETCHMAX] = {0};
+   int i, j, k, best, seenCnt = 0;
+   time_t now = time(NULL);
+   long bytes;
+   char * file;
+
+   roundFiles = roundBytes = 0;
+   for (k = 0; k < PREFETCHTOP; k++)
+   {
+      for (best = -1, i = 0; i < PREFETCHMAX; i++)
+         if (stats[i].path != NULL && !picked[i] &&
+             (best < 0 || scoreNow(&stats[i], now) > scoreNow(&stats[best], now)))
+            best = i;
+      if (best < 0) break;
+      picked[best] = 1;
+      findLibs(&stats[best]);
+      stats[best].cold = 0;
+      for (j = -1; j < stats[best].libCnt; j++)
+      {
+         file = j < 0 ? stats[best].path : stats[best].lib[j];
+         //libc and friends are needed by most commands
+         for (i = 0; i < seenCnt && strcmp(seen[i], file) != 0; i++);
+         if (i == seenCnt)
+         {
+            seen[seenCnt] = file;
+            got[seenCnt++] = bytes = prefetchFile(file, budget - roundBytes);
+            if (bytes > 0)
+            {
+               roundFiles++;
+               roundBytes += bytes;
+            }
+         }
+         if (got[i] < 0) stats[best].cold = 1;
+      }
+   }
+   roundTime = now;
+   if (report)
+      printf("prefetch: read ahead %ld files, %ldk of a %ldk budget\n",
+             roundFiles, roundBytes >> 10, budget >> 10);
+   saveStats();
+}
+
+/* prefetchFile
+ * Starts reading ahead the file at path if the bytes of it not in
+ * the page cache are at most left.  Returns those bytes, 0 if all
+ * of it is cached or -1 if it was not read ahead.
+ */
+static long prefetchFile(char * path, long left)
+{
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   struct stat st;
+   long missing = -1;
+
+   if (fd < 0) return -1;
+   if (fstat(fd, &st) == 0)
+   {
+      missing = st.st_size - residentBytes(fd, st.st_size);
+      if (missing > left) missing = -1;
+      else if (missing > 0) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+   }
+   close(fd);
+   return missing;
+}
+
+/* residentBytes
+ * Returns how many of the size bytes of the file open on fd are
+ * in the page cache (a page counts as a whole page), or size if
+ * that cannot be told.
+ */
+static long residentBytes(int fd, long size)
+{
+   long page = sysconf(_SC_PAGESIZE), pages = (size + page - 1) / page, i, cnt = 0;
+   unsigned char * vec;
+   void * map;
+
+   if (size == 0) return 0;
+   map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+   if (map == MAP_FAILED) return size;
+   vec = Malloc(pages);
+   if (mincore(map, size, vec) < 0) cnt = pages;
+   else for (i = 0; i < pages; i++) cnt += vec[i] & 1;
+   free(vec);
+   munmap(map, size);
+   return cnt * page < size ? cnt * page : size;
+}
+
+/* findLibs
+ * Looks up the libraries the binary of s needs, once: the
+ * dynamic linker it names and the DT_NEEDED entries of its
+ * dynamic section, found like libPath does (64 bit ELF only).
+ */
+static void findLibs(cmdStatT * s)
+{
+   int fd, i;
+   struct stat st;
+   char * map, * name, path[PATH_MAX];
+   Elf64_Ehdr * eh;
+   Elf64_Phdr * ph;
+   Elf64_Dyn * dyn = NULL;
+   long dynCnt = 0, strOff = -1, strAddr = -1;
+
+   if (s->libCnt >= 0) return;
+   s->libCnt = 0;
+   if ((fd = open(s->path, O_RDONLY | O_CLOEXEC)) < 0) return;
+   map = fstat(fd, &st) == 0 && st.st_size >= sizeof(Elf64_Ehdr) ?
+         mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+   close(fd);
+   if (map == MAP_FAILED) return;
+   eh = (Elf64_Ehdr *) map;
+   if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+       eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+       eh->e_phoff + eh->e_phnum * sizeof(Elf64_Phdr) > st.st_size)
+   {
+      munmap(map, st.st_size);
+      return;
+   }
+   ph = (Elf64_Phdr *) (map + eh->e_phoff);
+   for (i = 0; i < eh->e_phnum; i++)
+   {
+      if (ph[i].p_offset + ph[i].p_filesz > st.st_size) continue;
+      if (ph[i].p_type == PT_DYNAMIC)
+      {
+         dyn = (Elf64_Dyn *) (map + ph[i].p_offset);
+         dynCnt = ph[i].p_filesz / sizeof(Elf64_Dyn);
+      }
+      //the dynamic linker is paged in first of all
+      else if (ph[i].p_type == PT_INTERP && ph[i].p_filesz > 1 &&
+               map[ph[i].p_offset + ph[i].p_filesz - 1] == '\0' &&
+               s->libCnt < PREFETCHLIBS)
+         s->lib[s->libCnt++] = strdup(map + ph[i].p_offset);
+   }
+   for (i = 0; i < dynCnt && dyn[i].d_tag != DT_NULL; i++)
+      if (dyn[i].d_tag == DT_STRTAB) strAddr = dyn[i].d_un.d_ptr;
+   //the string table is given by address; find where it is in the file
+   for (i = 0; strAddr >= 0 && i < eh->e_phnum; i++)
+      if (ph[i].p_type == PT_LOAD && strAddr >= ph[i].p_vaddr &&
+          strAddr < ph[i].p_vaddr + ph[i].p_filesz)
+         strOff = strAddr - ph[i].p_vaddr + ph[i].p_offset;
+   for (i = 0; strOff >= 0 && i < dynCnt && dyn[i].d_tag != DT_NULL &&
+        s->libCnt < PREFETCHLIBS; i++)
+   {
+      if (dyn[i].d_tag != DT_NEEDED || strOff + dyn[i].d_un.d_val >= st.st_size)
+         continue;
+      name = map + strOff + dyn[i].d_un.d_val;
+      if (memchr(name, '\0', st.st_size - (name - map)) != NULL &&
+          libPath(name, path))
+         s->lib[s->libCnt++] = strdup(path);
+   }
+   munmap(map, st.st_size);
+}
+
+/* libPath
+ * Finds the library name in LD_LIBRARY_PATH or the usual library
+ * directories and puts its path in path.  Returns 0 if it is not
+ * found.  The RUNPATH of the binary and ld.so.cache are not
+ * looked at, which finds the libraries of most commands.
+ */
+static int libPath(char * name, char * path)
+{
+   char * dirs = getVar("LD_LIBRARY_PATH"), * dir, * save, * copy;
+   int i, found = 0;
+
+   if (strchr(name, '/') != NULL) return 0;
+   if (dirs != NULL)
+   {
+      copy = strdup(dirs);
+      for (dir = strtok_r(copy, ":", &save); dir != NULL && !found;
+           dir = strtok_r(NULL, ":", &save))
+      {
+         snprintf(path, PATH_MAX, "%s/%s", dir, name);
+         found = access(path, R_OK) == 0;
+      }
+      free(copy);
+   }
+   for (i = 0; libDirs[i] != NULL && !found; i++)
+   {
+      snprintf(path, PATH_MAX, "%s/%s", libDirs[i], name);
+      found = access(path, R_OK) == 0;
+   }
+   return found;
+}
+
+/* resolve
+ * Puts the path execvp would run for name in path: name itself
+ * (made absolute) if it has a slash, else the first executable
+ * regular file named name in PATH.  Returns 0 if there is none.
+ */
+static int resolve(char * name, char * path)
+{
+   char * dirs = getVar("PATH"), * start, * end;
+   struct stat st;
+   int len;
+
+   if (strchr(name, '/') != NULL)
+      return realpath(name, path) != NULL && access(path, X_OK) == 0;
+   if (dirs == NULL) return 0;
+   for (start = dirs; ; start = end + 1)
+   {
+      end = strchrnul(start, ':');
+      len = end - start;
+      //an empty entry is the working directory
+      snprintf(path, PATH_MAX, "%.*s%s%s", len, start, len ? "/" : "", name);
+      if (access(path, X_OK) == 0 && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+         return len > 0 || realpath(name, path) != NULL;
+      if (*end == '\0') return 0;
+   }
+}
+
+/* findEntry
+ * Returns the slot of path in the statistics, adding it if it is
+ * new; when they are full the command with the lowest score gives
+ * up its slot.
+ */
+static int findEntry(char * path)
+{
+   int i, slot = -1;
+   time_t now = time(NULL);
+
+   for (i = 0; i < PREFETCHMAX; i++)
+   {
+      if (stats[i].path != NULL && strcmp(stats[i].path, path) == 0) return i;
+      if (slot < 0 || (stats[slot].path != NULL &&
+          (stats[i].path == NULL || scoreNow(&stats[i], now) < scoreNow(&stats[slot], now))))
+         slot = i;
+   }
+   free(stats[slot].path);
+   while (stats[slot].libCnt > 0) free(stats[slot].lib[--stats[slot].libCnt]);
+   i = stats[slot].gen + 1;
+   memset(&stats[slot], 0, sizeof(cmdStatT));
+   stats[slot].gen = i;
+   stats[slot].libCnt = stats[slot].cold = -1;
+   stats[slot].path = strdup(path);
+   return slot;
+}
+
+/* scoreNow
+ * Returns the score of s at now: it halves every
+ * PREFETCHHALFLIFE seconds since its last run.
+ */
+static double scoreNow(cmdStatT * s, time_t now)
+{
+   return s->score * exp2(-(now - s->last) / PREFETCHHALFLIFE);
+}
+
+/* loadStats
+ * Reads the statistics saved by saveStats, if there are any.
+ */
+static void loadStats()
+{
+   char * path = cachePath(getVar("USH_PREFETCH"), getVar("HOME"), "ush-prefetch");
+   char * line = NULL;
+   FILE * fp = path != NULL ? fopen(path, "r") : NULL;
+   size_t cap = 0;
+   int len, n, i = 0;
+   long last;
+   cmdStatT * s;
+
+   free(path);
+   if (fp == NULL) return;
+   while (i < PREFETCHMAX && (len = getline(&line, &cap, fp)) > 0)
+   {
+      if (line[len - 1] == '\n') line[len - 1] = '\0';
+      s = &stats[i];
+      if (line[0] == '#' ||
+          sscanf(line, "%lf %ld %ld %ld %lf %ld %lf %n", &s->score, &last,
+                 &s->uses, &s->coldCnt, &s->coldMs, &s->warmCnt,
+                 &s->warmMs, &n) < 7 || line[n] != '/')
+         continue;
+      s->last = last;
+      s->path = strdup(line + n);
+      i++;
+   }
+   free(line);
+   fclose(fp);
+}
+
+/* saveStats
+ * Writes the statistics (see saveAtomic) if they changed.
+ */
+static void saveStats()
+{
+   char * path;
+
+   if (!dirty || getpid() != owner) return;
+   path = cachePath(getVar("USH_PREFETCH"), getVar("HOME"), "ush-prefetch");
+   if (path != NULL && saveAtomic(path, writeStats)) dirty = 0;
+   free(path);
+}
+
+/* writeStats
+ * Writes the statistics to fp, for saveStats.
+ */
+static void writeStats(FILE * fp)
+{
+   cmdStatT * s;
+
+   fprintf(fp, "# ush prefetch: score last uses cold_runs cold_ms "
+           "warm_runs warm_ms path\n");
+   for (s = stats; s < stats + PREFETCHMAX; s++)
+      if (s->path != NULL)
+         fprintf(fp, "%.3f %ld %ld %ld %.1f %ld %.1f %s\n", s->score,
+                 (long) s->last, s->uses, s->coldCnt, s->coldMs,
+                 s->warmCnt, s->warmMs, s->path);
+}
+
+/* listStats
+ * Prints the commands by score, best first, and the last round.
+ */
+static void listStats()
+{
+   int done[PREFETCHMAX] = {0};
+   int i, best;
+   time_t now = time(NULL);
+   char cold[32], warm[32];
+   cmdStatT * s;
+
+   printf("   SCORE   USES  COLD  COLD MS  WARM  WARM MS  PATH\n");
+   while (1)
+   {
+      for (best = -1, i = 0; i < PREFETCHMAX; i++)
+         if (stats[i].path != NULL && !done[i] &&
+             (best < 0 || scoreNow(&stats[i], now) > scoreNow(&stats[best], now)))
+            best = i;
+      if (best < 0) break;
+      done[best] = 1;
+      s = &stats[best];
+      if (s->coldCnt > 0) sprintf(cold, "%.1f", s->coldMs / s->coldCnt);
+      else strcpy(cold, "-");
+      if (s->warmCnt > 0) sprintf(warm, "%.1f", s->warmMs / s->warmCnt);
+      else strcpy(warm, "-");
+      printf("%8.2f %6ld %5ld %8s %5ld %8s  %s\n", scoreNow(s, now), s->uses,
+             s->coldCnt, cold, s->warmCnt, warm, s->path);
+   }
+   if (roundTime > 0)
+      printf("last round %lds ago: read ahead %ld files, %ldk of a %ldk budget\n",
+             (long) (now - roundTime), roundFiles, roundBytes >> 10, budget >> 10);
+}
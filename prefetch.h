@@ -0,0 +1,35 @@
+/*
+ *  History driven prefetching of the commands ush runs.
+ *  For each command path run, ush keeps how often and how recently
+ *  it was run (a score that halves every PREFETCHHALFLIFE seconds
+ *  without a run) in $USH_PREFETCH or ~/.cache/ush-prefetch.  At
+ *  startup and whenever the prompt has been idle for PREFETCHIDLE
+ *  ms, the binaries of the PREFETCHTOP best scoring commands and
+ *  the libraries they need (their DT_NEEDED entries) are read
+ *  ahead with posix_fadvise(WILLNEED), which starts the reads and
+ *  returns, for at most budget bytes not already in the page cache.
+ *  A run is cold if the last round found a page of its binary or
+ *  libraries not in the page cache and could not read it ahead
+ *  (and the command did not run since), and warm otherwise; the
+ *  time from the fork until the process exits is kept for both,
+ *  so for short commands the difference shows what paging in
+ *  cost.  The first run of a command no round has looked at is not
+ *  timed.
+ *  prefetch lists the statistics, prefetch now runs a round,
+ *  prefetch budget SIZE sets the budget and prefetch clear drops
+ *  the statistics.
+ */
+
+#define PREFETCHMAX 256          /* commands kept in the statistics */
+#define PREFETCHTOP 16           /* commands read ahead per round */
+#define PREFETCHBUDGET (64L << 20)   /* default bytes read ahead per round */
+#define PREFETCHIDLE 2000        /* ms idle at the prompt before a round */
+#define PREFETCHHALFLIFE (7 * 86400.0)   /* seconds for a score to halve */
+#define PREFETCHLIBS 32          /* DT_NEEDED libraries kept per command */
+#define PREFETCHPROBES 16        /* runs timed at once at most */
+
+void initPrefetch();
+void prefetchIdle(int idle);
+int probeExec(char * name);
+void probeStarted(int probe, pid_t pid);
+void prefetchCmd(char ** args);
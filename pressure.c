@@ -0,0 +1,462 @@
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "events.h"
+#include "signals.h"
+#include "state.h"
+#include "pressure.h"
+
+typedef struct             /* A resource PSI reports on */
+{
+   const char * name;
+   const char * path;
+   int pct;                /* threshold in %; 0 if none */
+   int fd;                 /* its trigger; -1 if none */
+   int fired;              /* 1 if it fired since the gap last ended */
+   double avg10;           /* % of the last 10s some task stalled on it */
+} resourceT;
+
+typedef struct             /* A job stopped by throttling */
+{
+   int jid;
+   pid_t pgrp;             /* to tell it from a later job with its jid */
+} heldT;
+
+static resourceT resources[] = {
+   {"cpu", "/proc/pressure/cpu", 0, -1, 0, 0},
+   {"memory", "/proc/pressure/memory", 0, -1, 0, 0},
+   {"io", "/proc/pressure/io", 0, -1, 0, 0}};
+#define RESOURCECNT ((int) (sizeof(resources) / sizeof(resources[0])))
+
+static jobT * jobList;
+static heldT held[MAXJOBS];
+static int heldCnt = 0;
+static int timerFd = -1;
+static double lastAction = 0;       /* when a job was last stopped or continued */
+static char actions[PSILOG][PSILINE];   /* the last actions, oldest first */
+static int actionCnt = 0;           /* actions logged so far */
+static pid_t owner;                 /* the ush that continues the jobs at exit */
+
+//not needed outside of this file
+static void armTrigger(resourceT * r);
+static void triggerFired(int fd, short revents, void * arg);
+static void readTimer(int fd, short revents, void * arg);
+static void setTimer();
+static void checkPressure();
+static double readAvg10(resourceT * r);
+static jobT * pickJob(int stopped);
+static int jobNice(jobT * job);
+static void stopJob(jobT * job, char * reason);
+static void continueHeld(jobT * job, char * reason);
+static void releaseAll(char * reason);
+static void releaseAtExit();
+static void pruneHeld();
+static heldT * findHeld(jobT * job);
+static void logAction(const char * fmt, ...);
+static void showPressure();
+
+/* initPressure
+ * Sets the jobs array throttling works on.  No resource has a
+ * threshold until throttle sets one.
+ */
+void initPressure(jobT jobs[MAXJOBS])
+{
+   jobList = jobs;
+   owner = getpid();
+   timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (timerFd < 0) unixError("timerfd_create error");
+   addEvent(timerFd, POLLIN, readTimer, NULL);
+   atexit(releaseAtExit);
+}
+
+/* throttledJobs
+ * Returns the number of jobs stopped by throttling, which still
+ * hold their run slots (see startQueuedJobs in ush.c).
+ */
+int throttledJobs()
+{
+   pruneHeld();
+   return heldCnt;
+}
+
+/* throttleCmd
+ * The throttle builtin: throttle shows the state of throttling,
+ * throttle cpu|memory|io PCT sets a threshold (0 drops it) and
+ * throttle off drops them all and continues the stopped jobs.
+ */
+void throttleCmd(char ** args)
+{
+   int i, pct;
+
+   if (args[1] == NULL)
+   {
+      showPressure();
+      return;
+   }
+   if (strcmp(args[1], "off") == 0 && args[2] == NULL)
+   {
+      for (i = 0; i < RESOURCECNT; i++)
+      {
+         resources[i].pct = 0;
+         armTrigger(&resources[i]);
+      }
+      releaseAll("throttle off");
+      setTimer();
+      return;
+   }
+   for (i = 0; i < RESOURCECNT && strcmp(args[1], resources[i].name) != 0; i++);
+   if (i == RESOURCECNT || args[2] == NULL || args[3] != NULL ||
+       args[2][strspn(args[2], "0123456789")] != '\0' ||
+       (pct = atoi(args[2])) > 100)
+   {
+      printf("usage: throttle [cpu|memory|io PCT | off]\n");
+      return;
+   }
+   resources[i].pct = pct;
+   armTrigger(&resources[i]);
+   if (pct > 0 && resources[i].fd < 0)
+      printf("throttle: no PSI trigger for %s, reading its averages every %dms\n",
+             resources[i].name, PSIPOLL);
+   setTimer();
+}
+
+/* armTrigger
+ * Replaces the PSI trigger of r with one for its threshold: the
+ * fd gets POLLPRI when tasks stalled on r for pct% of a window of
+ * PSIWINDOW us.  If it cannot be armed (no PSI, or no permission)
+ * r is only polled.
+ */
+static void armTrigger(resourceT * r)
+{
+   char trigger[64];
+
+   if (r->fd >= 0)
+   {
+      removeEvent(r->fd);
+      close(r->fd);
+      r->fd = -1;
+   }
+   r->fired = 0;
+   if (r->pct == 0) return;
+   if ((r->fd = open(r->path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0) return;
+   snprintf(trigger, sizeof(trigger), "some %ld %d",
+            (long) r->pct * (PSIWINDOW / 100), PSIWINDOW);
+   if (write(r->fd, trigger, strlen(trigger) + 1) < 0)
+   {
+      close(r->fd);
+      r->fd = -1;
+      return;
+   }
+   addEvent(r->fd, POLLPRI, triggerFired, r);
+}
+
+/* triggerFired
+ * Event handler for the trigger of a resource.  POLLERR means the
+ * trigger is gone; then the resource is only polled.
+ */
+static void triggerFired(int fd, short revents, void * arg)
+{
+   resourceT * r = arg;
+
+   if (revents & POLLERR)
+   {
+      removeEvent(fd);
+      close(fd);
+      r->fd = -1;
+      return;
+   }
+   r->fired = 1;
+   checkPressure();
+}
+
+/* readTimer
+ * Event handler for the poll timer.
+ */
+static void readTimer(int fd, short revents, void * arg)
+{
+   uint64_t ticks;
+
+   if (read(fd, &ticks, sizeof(ticks)) < 0) return;
+   checkPressure();
+}
+
+/* setTimer
+ * Runs the poll timer while a resource has a threshold or a job
+ * is stopped, and stops it otherwise.
+ */
+static void setTimer()
+{
+   struct itimerspec its;
+   int i, on = (heldCnt > 0);
+
+   for (i = 0; i < RESOURCECNT; i++) on |= (resources[i].pct > 0);
+   memset(&its, 0, sizeof(its));
+   if (on)
+   {
+      its.it_value.tv_sec = its.it_interval.tv_sec = PSIPOLL / 1000;
+      its.it_value.tv_nsec = its.it_interval.tv_nsec = PSIPOLL % 1000 * 1000000L;
+   }
+   timerfd_settime(timerFd, 0, &its, NULL);
+}
+
+/* checkPressure
+ * Reads the pressure on the resources with thresholds and stops
+ * a job if one is over its threshold (or its trigger fired), or
+ * continues one if all are below half of theirs.  At most one
+ * job is stopped or continued every PSIGAP ms; a trigger that
+ * fires before the gap is over is kept for the check that ends
+ * it, so the next job is stopped only for a trigger that fired, or
+ * an avg10 read, after the last action.
+ */
+static void checkPressure()
+{
+   char reason[PSILINE];
+   int i, calm = 1, len = 0;
+   resourceT * r, * over = NULL;
+   jobT * job;
+
+   for (i = 0; i < RESOURCECNT; i++)
+   {
+      r = &resources[i];
+      if (r->pct == 0) continue;
+      r->avg10 = readAvg10(r);
+      if (over == NULL && (r->fired || r->avg10 >= r->pct)) over = r;
+      if (r->fired || r->avg10 >= r->pct / 2.0) calm = 0;
+   }
+   pruneHeld();
+   if ((seconds() - lastAction) * 1000 >= PSIGAP)
+   {
+      if (over != NULL && (job = pickJob(0)) != NULL)
+      {
+         if (over->avg10 >= over->pct)
+            snprintf(reason, sizeof(reason), "%s pressure %.1f%% >= %d%%",
+                     over->name, over->avg10, over->pct);
+         else snprintf(reason, sizeof(reason), "%s stalls over %d%% of %ds",
+                       over->name, over->pct, PSIWINDOW / 1000000);
+         stopJob(job, reason);
+      }
+      else if (calm && (job = pickJob(1)) != NULL)
+      {
+         len = snprintf(reason, sizeof(reason), "pressure down:");
+         for (i = 0; i < RESOURCECNT; i++)
+            if (resources[i].pct > 0 && len < (int) sizeof(reason))
+               len += snprintf(reason + len, sizeof(reason) - len, " %s %.1f%%",
+                               resources[i].name, resources[i].avg10);
+         continueHeld(job, reason);
+      }
+      for (i = 0; i < RESOURCECNT; i++) resources[i].fired = 0;
+   }
+   setTimer();
+}
+
+/* readAvg10
+ * Returns the some avg10 of r, or 0 if it cannot be read.
+ */
+static double readAvg10(resourceT * r)
+{
+   char buf[256];
+   double avg = 0;
+   int fd = open(r->path, O_RDONLY | O_CLOEXEC), n;
+
+   if (fd < 0) return 0;
+   n = read(fd, buf, sizeof(buf) - 1);
+   close(fd);
+   if (n <= 0) return 0;
+   buf[n] = '\0';
+   sscanf(buf, "some avg10=%lf", &avg);
+   return avg;
+}
+
+/* pickJob
+ * Returns the running background job to stop next, the one with
+ * the lowest priority (the highest nice value, then the most
+ * recently started), or if stopped is 1 the stopped job to
+ * continue next, the one with the highest.  Returns NULL if there
+ * is none.
+ */
+static jobT * pickJob(int stopped)
+{
+   int i, nice, bestNice = 0, better;
+   jobT * job, * best = NULL;
+
+   for (i = 0; i < MAXJOBS; i++)
+   {
+      job = &jobList[i];
+      //a coprocess is waited on by queries, so it is never stopped
+      if (job->jid == 0 || job->pgrp <= 0 || job->interactive) continue;
+      if (stopped ? findHeld(job) == NULL : job->state != BG) continue;
+      nice = jobNice(job);
+      if (best == NULL) better = 1;
+      else if (nice != bestNice) better = stopped ? nice < bestNice : nice > bestNice;
+      else better = stopped ? job->started < best->started : job->started > best->started;
+      if (better)
+      {
+         best = job;
+         bestNice = nice;
+      }
+   }
+   return best;
+}
+
+/* jobNice
+ * Returns the nice value of the first live process of job.
+ */
+static int jobNice(jobT * job)
+{
+   int j, nice;
+
+   for (j = 0; j < job->pidCnt && job->pid[j] == 0; j++);
+   if (j == job->pidCnt) return 0;
+   errno = 0;
+   nice = getpriority(PRIO_PROCESS, job->pid[j]);
+   return errno == 0 ? nice : 0;
+}
+
+/* stopJob
+ * Stops job for reason.  It is Stopped right away; the SIGSTOP
+ * also shows up as a stop when its processes are reaped.
+ */
+static void stopJob(jobT * job, char * reason)
+{
+   if (signalJob(job, SIGSTOP) == 0) return;
+   job->state = ST;
+   saveJob(job, job - jobList);
+   held[heldCnt].jid = job->jid;
+   held[heldCnt].pgrp = job->pgrp;
+   heldCnt++;
+   lastAction = seconds();
+   logAction("[%d] throttled (%s) %s", job->jid, reason, job->cmdline);
+}
+
+/* continueHeld
+ * Continues job, stopped by throttling, for reason.  It runs in
+ * the background again.
+ */
+static void continueHeld(jobT * job, char * reason)
+{
+   heldT * h = findHeld(job);
+
+   *h = held[--heldCnt];
+   job->state = BG;
+   saveJob(job, job - jobList);
+   signalJob(job, SIGCONT);
+   lastAction = seconds();
+   logAction("[%d] resumed (%s) %s", job->jid, reason, job->cmdline);
+}
+
+/* releaseAll
+ * Continues all the jobs stopped by throttling, for reason.
+ */
+static void releaseAll(char * reason)
+{
+   jobT * job;
+
+   pruneHeld();
+   while ((job = pickJob(1)) != NULL) continueHeld(job, reason);
+}
+
+/* releaseAtExit
+ * Continues the stopped jobs when ush exits, since nothing would
+ * continue them later.
+ */
+static void releaseAtExit()
+{
+   int i;
+   jobT * job;
+
+   if (getpid() != owner) return;
+   pruneHeld();
+   for (i = 0; i < heldCnt; i++)
+   {
+      job = getJobJid(held[i].jid, jobList);
+      job->state = BG;
+      saveJob(job, job - jobList);
+      signalJob(job, SIGCONT);
+   }
+   heldCnt = 0;
+}
+
+/* pruneHeld
+ * Forgets the stopped jobs that are gone or were continued some
+ * other way (fg, bg, kill).
+ */
+static void pruneHeld()
+{
+   int i = 0;
+   jobT * job;
+
+   while (i < heldCnt)
+   {
+      job = getJobJid(held[i].jid, jobList);
+      if (job == NULL || job->pgrp != held[i].pgrp || job->state != ST)
+         held[i] = held[--heldCnt];
+      else i++;
+   }
+}
+
+/* findHeld
+ * Returns the entry of job among the jobs stopped by throttling,
+ * or NULL if it is not one of them.
+ */
+static heldT * findHeld(jobT * job)
+{
+   int i;
+
+   for (i = 0; i < heldCnt; i++)
+      if (held[i].jid == job->jid && held[i].pgrp == job->pgrp) return &held[i];
+   return NULL;
+}
+
+/* logAction
+ * Prints a throttle action and keeps it, with the time, for
+ * throttle.
+ */
+static void logAction(const char * fmt, ...)
+{
+   char * line = actions[actionCnt % PSILOG];
+   time_t now = time(NULL);
+   va_list ap;
+   int len;
+
+   len = strftime(line, PSILINE, "%H:%M:%S ", localtime(&now));
+   va_start(ap, fmt);
+   vsnprintf(line + len, PSILINE - len, fmt, ap);
+   va_end(ap);
+   actionCnt++;
+   printf("%s\n", line + len);
+   fflush(stdout);
+}
+
+/* showPressure
+ * Prints the thresholds and pressure of the resources, the jobs
+ * stopped by throttling and the last actions.
+ */
+static void showPressure()
+{
+   int i;
+   resourceT * r;
+   jobT * job;
+
+   printf("RESOURCE  THRESHOLD   AVG10  WATCH\n");
+   for (i = 0; i < RESOURCECNT; i++)
+   {
+      r = &resources[i];
+      r->avg10 = readAvg10(r);
+      if (r->pct > 0) printf("%-9s %8d%% %6.1f%%  %s\n", r->name, r->pct, r->avg10,
+                             r->fd >= 0 ? "trigger" : "poll");
+      else printf("%-9s %9s %6.1f%%  -\n", r->name, "-", r->avg10);
+   }
+   pruneHeld();
+   for (i = 0; i < heldCnt; i++)
+   {
+      job = getJobJid(held[i].jid, jobList);
+      printf("[%d] Stopped (throttled) %s &\n", job->jid, job->cmdline);
+   }
+   i = actionCnt > PSILOG ? actionCnt - PSILOG : 0;
+   for (; i < actionCnt; i++) printf("%s\n", actions[i % PSILOG]);
+}
@@ -0,0 +1,33 @@
+/*
+ *  Throttling of background jobs under resource pressure.
+ *  throttle cpu|memory|io PCT sets a threshold on the share of time
+ *  some task stalled on the resource (Linux PSI, /proc/pressure).
+ *  ush arms a PSI trigger for it (stalls of PCT% of PSIWINDOW),
+ *  whose fd becomes ready with POLLPRI in the event loop as soon as
+ *  the threshold is crossed, and also reads the avg10 of the
+ *  resources every PSIPOLL ms, which is all it does when triggers
+ *  cannot be armed.  While a resource is over its threshold the
+ *  lowest priority running background job (the highest nice value,
+ *  then the most recently started; never a coprocess, see coproc.h)
+ *  is stopped with SIGSTOP, one job every PSIGAP ms, each for a
+ *  trigger that fired or an avg10 read after the previous action;
+ *  once every resource is below half its threshold the stopped
+ *  jobs get SIGCONT, the highest priority first, one every PSIGAP
+ *  ms.
+ *  Stopped jobs are listed as Stopped and keep their run slots, so
+ *  queued jobs do not start in their place.
+ *  Each action is printed with its reason and kept for throttle,
+ *  which shows the thresholds, the pressure, the stopped jobs and
+ *  the last PSILOG actions.  throttle off drops the thresholds and
+ *  continues the stopped jobs, as does quitting ush.
+ */
+
+#define PSIWINDOW 2000000      /* us of a trigger window */
+#define PSIPOLL 1000           /* ms between reads of the averages */
+#define PSIGAP 2000            /* ms between throttle actions */
+#define PSILOG 16              /* actions kept for throttle */
+#define PSILINE 160            /* longest logged action */
+
+void initPressure(jobT jobs[MAXJOBS]);
+int throttledJobs();
+void throttleCmd(char ** args);
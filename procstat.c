@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <time.h>
+#include "wrappers.h"
+#include "procstat.h"
+
+typedef struct             /* A cached process */
+{
+   pid_t pid;              /* 0 if the slot is free */
+   int statFd;             /* /proc/PID/stat */
+   int statmFd;            /* /proc/PID/statm */
+   unsigned long long ticks;   /* utime + stime at the last sample */
+   double time;            /* time ticks was taken at; 0 if none */
+   double cpu;             /* %CPU found then */
+   int used;               /* 1 if sampled since the last sweep */
+} procT;
+
+static procT * procs = NULL;
+static int slots = 0;      /* size of procs, a power of 2 */
+static int procCnt = 0;    /* slots in use */
+
+//not needed outside of this file
+static procT * findProc(pid_t pid);
+static int openProc(procT * p, pid_t pid);
+static int readProc(procT * p, char * stat, int statSize, char * statm,
+                    int statmSize);
+static void rehash(int size, int keepUnused);
+
+/* sampleProc
+ * Fills info with a sample of process pid.  The %CPU is the
+ * share of a CPU the process used since it was last sampled, or
+ * since it started for the first sample.  Returns 0 if there is
+ * no such process.
+ */
+int sampleProc(pid_t pid, procInfoT * info)
+{
+   static long hz = 0, pageKB = 0;
+   char stat[1024], statm[256], * p;
+   unsigned long utime, stime;
+   unsigned long long start, ticks;
+   long threads, rss;
+   struct timespec ts;
+   double now;
+   procT * proc;
+
+   if (hz == 0)
+   {
+      hz = sysconf(_SC_CLK_TCK);
+      pageKB = sysconf(_SC_PAGESIZE) / 1024;
+   }
+   if (pid < 1) return 0;
+   proc = findProc(pid);
+   if (proc->pid == 0)
+   {
+      if (!openProc(proc, pid)) return 0;
+      procCnt++;
+   }
+   proc->used = 1;
+   if (!readProc(proc, stat, sizeof(stat), statm, sizeof(statm)))
+   {
+      //the fds stick to the process that had pid; it may be reused
+      close(proc->statFd);
+      close(proc->statmFd);
+      if (!openProc(proc, pid) ||
+          !readProc(proc, stat, sizeof(stat), statm, sizeof(statm)))
+      {
+         proc->statFd = proc->statmFd = -1;
+         return 0;
+      }
+   }
+   //the command name can hold spaces, so parse from its end
+   if ((p = strrchr(stat, ')')) == NULL ||
+       sscanf(p + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu "
+              "%*d %*d %*d %*d %ld %*d %llu", &info->state, &utime, &stime,
+              &threads, &start) != 5 ||
+       sscanf(statm, "%*u %ld", &rss) != 1)
+      return 0;
+   clock_gettime(CLOCK_BOOTTIME, &ts);
+   now = ts.tv_sec + ts.tv_nsec / 1e9;
+   ticks = utime + stime;
+   info->threads = threads;
+   info->rss = rss * pageKB;
+   info->elapsed = now - (double) start / hz;
+   //a clock tick is too coarse for short intervals; keep the last %CPU
+   if (proc->time > 0 && now - proc->time < PROCMINSECS)
+   {
+      info->cpu = proc->cpu;
+      return 1;
+   }
+   if (proc->time > 0)
+      info->cpu = 100.0 * (ticks - proc->ticks) / hz / (now - proc->time);
+   else if (info->elapsed > 0)
+      info->cpu = 100.0 * ticks / hz / info->elapsed;
+   else info->cpu = 0;
+   proc->ticks = ticks;
+   proc->time = now;
+   proc->cpu = info->cpu;
+   return 1;
+}
+
+/* sweepProcs
+ * Closes the fds of the processes that were not sampled since
+ * the last sweep.
+ */
+void sweepProcs()
+{
+   if (slots > 0) rehash(slots, 0);
+}
+
+/* findProc
+ * Returns the cache slot of pid: the slot it is in or the free
+ * slot it goes in.
+ */
+static procT * findProc(pid_t pid)
+{
+   unsigned int i;
+
+   if (slots == 0 || 2 * (procCnt + 1) > slots)
+      rehash(slots ? 2 * slots : PROCINITSIZE, 1);
+   i = ((unsigned int) pid * 2654435761u) & (slots - 1);
+   while (procs[i].pid != 0 && procs[i].pid != pid) i = (i + 1) & (slots - 1);
+   return &procs[i];
+}
+
+/* openProc
+ * Opens the /proc files of pid in slot p. Returns 0 if there
+ * is no such process.
+ */
+static int openProc(procT * p, pid_t pid)
+{
+   char path[64];
+
+   snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+   if ((p->statFd = open(path, O_RDONLY | O_CLOEXEC)) < 0) return 0;
+   snprintf(path, sizeof(path), "/proc/%d/statm", (int) pid);
+   if ((p->statmFd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+   {
+      close(p->statFd);
+      return 0;
+   }
+   p->pid = pid;
+   p->ticks = 0;
+   p->time = 0;
+   p->cpu = 0;
+   return 1;
+}
+
+/* readProc
+ * Reads the /proc files of slot p into stat and statm.
+ * Returns 0 if the process is gone.
+ */
+static int readProc(procT * p, char * stat, int statSize, char * statm,
+                    int statmSize)
+{
+   int n, m;
+
+   if (p->statFd < 0) return 0;
+   n = pread(p->statFd, stat, statSize - 1, 0);
+   m = pread(p->statmFd, statm, statmSize - 1, 0);
+   if (n <= 0 || m <= 0) return 0;
+   stat[n] = '\0';
+   statm[m] = '\0';
+   return 1;
+}
+
+/* rehash
+ * Moves the cache to a table of size slots.  Unless keepUnused
+ * is 1, processes not sampled since the last sweep are dropped
+ * and their fds closed.  The others are marked unused.
+ */
+static void rehash(int size, int keepUnused)
+{
+   procT * old = procs;
+   int i, oldSlots = slots;
+   unsigned int j;
+
+   procs = calloc(size, sizeof(procT));
+   if (procs == NULL) unixError("calloc error");
+   slots = size;
+   procCnt = 0;
+   for (i = 0; i < oldSlots; i++)
+   {
+      if (old[i].pid == 0) continue;
+      if (!keepUnused && !old[i].used)
+      {
+         if (old[i].statFd >= 0) close(old[i].statFd);
+         if (old[i].statmFd >= 0) close(old[i].statmFd);
+         continue;
+      }
+      j = ((unsigned int) old[i].pid * 2654435761u) & (slots - 1);
+      while (procs[j].pid != 0) j = (j + 1) & (slots - 1);
+      procs[j] = old[i];
+      if (!keepUnused) procs[j].used = 0;
+      procCnt++;
+   }
+   free(old);
+}
@@ -0,0 +1,25 @@
+/*
+ *  Cached sampling of processes from /proc.
+ *  /proc/PID/stat and /proc/PID/statm of a process are opened once
+ *  and read again with pread on every sample, so watching many
+ *  processes costs two preads per process instead of opens, reads
+ *  and closes.  The fds of processes that are no longer sampled are
+ *  closed by sweepProcs.
+ */
+
+#include <sys/types.h>
+
+#define PROCINITSIZE 64    /* initial number of cache slots */
+#define PROCMINSECS 0.25   /* shortest interval a %CPU is measured over */
+
+typedef struct             /* A sample of a process */
+{
+   char state;             /* R, S, D, T, Z, ... */
+   double cpu;             /* %CPU since the last sample (or start) */
+   long rss;               /* resident set size in KB */
+   int threads;            /* number of threads */
+   double elapsed;         /* seconds since the process started */
+} procInfoT;
+
+int sampleProc(pid_t pid, procInfoT * info);
+void sweepProcs();
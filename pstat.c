@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "pstat.h"
+
+typedef struct             /* A sample of a stage of a pipeline */
+{
+   pid_t pid;              /* 0 once the stage is done */
+   char state;             /* R, S, D, ... from /proc/PID/stat */
+   unsigned long long rchar;   /* bytes read so far */
+   unsigned long long wchar;   /* bytes written so far */
+   int inFill;             /* bytes in the input pipe; -1 if none */
+   int inSize;             /* capacity of the input pipe */
+} stageT;
+
+//not needed outside of this file
+static double sample(jobT * job, stageT * stages);
+static void readIo(pid_t pid, stageT * s);
+static char readState(pid_t pid);
+static void readPipe(pid_t pid, stageT * s);
+static void printStages(jobT * job, stageT * prev, stageT * cur, double secs);
+static int isFull(stageT * s);
+static int isEmpty(stageT * s);
+static int stageOf(jobT * job, int i);
+static char * rate(double bytes, char * buf, int size);
+
+/* pstatCmd
+ * The pstat builtin: pstat %jid [--watch]
+ * Samples the stages of the job twice, PSTATINTERVAL apart,
+ * and shows their throughput.  With --watch the view is
+ * refreshed until the job is done or wait returns 0.
+ */
+void pstatCmd(char ** args, jobT jobs[MAXJOBS], watchFn wait)
+{
+   jobT * job = NULL;
+   stageT * prev, * cur, * tmp;
+   double t0, t1;
+   int jid, stop, watch = (args[1] != NULL && args[2] != NULL &&
+                           strcmp(args[2], "--watch") == 0);
+
+   if (args[1] != NULL && args[1][0] == '%')
+      job = getJobJid(atoi(&args[1][1]), jobs);
+   if (job == NULL)
+   {
+      printf("usage: pstat %%jid [--watch]\n");
+      return;
+   }
+   jid = job->jid;
+   prev = Malloc(job->pidCnt * sizeof(stageT));
+   cur = Malloc(job->pidCnt * sizeof(stageT));
+   t0 = sample(job, prev);
+   while (1)
+   {
+      stop = !wait(PSTATINTERVAL, watch);
+      //the job is gone once all of its processes are reaped
+      if (getJobJid(jid, jobs) != job)
+      {
+         printf("[%d] done\n", jid);
+         break;
+      }
+      t1 = sample(job, cur);
+      if (watch && isatty(1)) printf("\033[H\033[J");
+      printStages(job, prev, cur, t1 - t0);
+      fflush(stdout);
+      if (!watch || stop) break;
+      tmp = prev;
+      prev = cur;
+      cur = tmp;
+      t0 = t1;
+   }
+   free(prev);
+   free(cur);
+}
+
+/* sample
+ * Fills stages with a sample of each stage of job. Returns
+ * the time of the sample in seconds.
+ */
+static double sample(jobT * job, stageT * stages)
+{
+   struct timespec now;
+   int i;
+
+   for (i = 0; i < job->pidCnt; i++)
+   {
+      stages[i].pid = job->pid[i];
+      stages[i].state = '-';
+      stages[i].rchar = stages[i].wchar = 0;
+      stages[i].inFill = -1;
+      stages[i].inSize = 0;
+      if (job->pid[i] == 0) continue;
+      stages[i].state = readState(job->pid[i]);
+      readIo(job->pid[i], &stages[i]);
+      if (stageOf(job, i) > 0) readPipe(job->pid[i], &stages[i]);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* readIo
+ * Reads the rchar and wchar counts of process pid.
+ */
+static void readIo(pid_t pid, stageT * s)
+{
+   char path[64], buf[512], * p;
+   int fd, n;
+
+   snprintf(path, sizeof(path), "/proc/%d/io", (int) pid);
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) return;
+   n = read(fd, buf, sizeof(buf) - 1);
+   close(fd);
+   if (n <= 0) return;
+   buf[n] = '\0';
+   if ((p = strstr(buf, "rchar:")) != NULL) s->rchar = strtoull(p + 6, NULL, 10);
+   if ((p = strstr(buf, "wchar:")) != NULL) s->wchar = strtoull(p + 6, NULL, 10);
+}
+
+/* readState
+ * Returns the state letter of process pid (field 3 of
+ * /proc/pid/stat) or - if there is no such process.
+ */
+static char readState(pid_t pid)
+{
+   char path[64], buf[512], * p;
+   int fd, n;
+
+   snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) return '-';
+   n = read(fd, buf, sizeof(buf) - 1);
+   close(fd);
+   if (n <= 0) return '-';
+   buf[n] = '\0';
+   p = strrchr(buf, ')');
+   return (p != NULL && p[1] == ' ') ? p[2] : '-';
+}
+
+/* readPipe
+ * Finds out how full the pipe process pid reads from (its
+ * fd 0) is, opening the pipe through /proc for a moment.
+ */
+static void readPipe(pid_t pid, stageT * s)
+{
+   char path[64];
+   struct stat st;
+   int fd, fill;
+
+   snprintf(path, sizeof(path), "/proc/%d/fd/0", (int) pid);
+   if ((fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) return;
+   if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) &&
+       ioctl(fd, FIONREAD, &fill) == 0)
+   {
+      s->inFill = fill;
+      s->inSize = fcntl(fd, F_GETPIPE_SZ);
+   }
+   close(fd);
+}
+
+/* printStages
+ * Outputs the throughput of each stage between the samples
+ * prev and cur, taken secs apart, and the fill level of its
+ * input pipe.  A stage whose input pipe is full in both
+ * samples while its output pipe (the input of the next stage)
+ * is empty in both is marked as the bottleneck.  Stages run in
+ * ush are not processes of the job and are left out; the others
+ * keep their place in the pipeline as their number.
+ */
+static void printStages(jobT * job, stageT * prev, stageT * cur, double secs)
+{
+   char rbuf[16], wbuf[16], fill[32];
+   int i, next, last = job->pidCnt - 1;
+
+   if (secs <= 0) secs = 1;
+   printf("[%d] %s\n", job->jid, job->cmdline);
+   printf("%-6s %-8s %-5s %10s %10s %15s\n", "stage", "pid", "state",
+          "read/s", "write/s", "input pipe");
+   for (i = 0; i <= last; i++)
+   {
+      if (cur[i].pid == 0 || prev[i].pid != cur[i].pid)
+      {
+         printf("%-6d %-8s done\n", stageOf(job, i), "-");
+         continue;
+      }
+      if (cur[i].inFill < 0) snprintf(fill, sizeof(fill), "-");
+      else snprintf(fill, sizeof(fill), "%d/%d", cur[i].inFill, cur[i].inSize);
+      printf("%-6d %-8d %-5c %10s %10s %15s", stageOf(job, i),
+             (int) cur[i].pid, cur[i].state,
+             rate((cur[i].rchar - prev[i].rchar) / secs, rbuf, sizeof(rbuf)),
+             rate((cur[i].wchar - prev[i].wchar) / secs, wbuf, sizeof(wbuf)),
+             fill);
+      //the next stage may have run in ush; then nothing reads the output
+      next = i < last && stageOf(job, i + 1) == stageOf(job, i) + 1;
+      if (isFull(&prev[i]) && isFull(&cur[i]) &&
+          (!next || (isEmpty(&prev[i + 1]) && isEmpty(&cur[i + 1]))))
+         printf("  <- bottleneck");
+      printf("\n");
+   }
+}
+
+/* isFull
+ * Returns 1 if the input pipe of stage s is (nearly) full.
+ */
+static int isFull(stageT * s)
+{
+   return s->inFill >= 0 && s->inSize > 0 && s->inFill >= s->inSize * 3 / 4;
+}
+
+/* isEmpty
+ * Returns 1 if the input pipe of stage s is (nearly) empty.
+ */
+static int isEmpty(stageT * s)
+{
+   return s->inFill >= 0 && s->inFill <= s->inSize / 4;
+}
+
+/* stageOf
+ * Returns the place in the pipeline of process i of job.
+ */
+static int stageOf(jobT * job, int i)
+{
+   return job->stage != NULL ? job->stage[i] : i;
+}
+
+/* rate
+ * Puts bytes per second in buf in a short form: 512, 3.2K, 1.5M.
+ */
+static char * rate(double bytes, char * buf, int size)
+{
+   const char * units = "KMGT";
+   int u = -1;
+
+   while (bytes >= 1024 && u < 3)
+   {
+      bytes /= 1024;
+      u++;
+   }
+   if (u < 0) snprintf(buf, size, "%.0f", bytes);
+   else snprintf(buf, size, "%.1f%c", bytes, units[u]);
+   return buf;
+}
@@ -0,0 +1,16 @@
+/*
+ *  The pstat builtin: live throughput of the stages of a pipeline.
+ *  Each stage is sampled from /proc: the bytes it read and wrote
+ *  (/proc/PID/io) and how full the pipe it reads from is.  ush does
+ *  not keep the pipes open, since that would keep a stage from seeing
+ *  EOF or SIGPIPE; the pipe is opened through /proc/PID/fd/0 just for
+ *  the FIONREAD.  A stage whose input pipe stays full while its output
+ *  pipe stays empty is the bottleneck.
+ */
+
+#define PSTATINTERVAL 1000   /* milliseconds between samples */
+
+/* waits ms milliseconds; if watch is 1 returns 0 early to stop watching */
+typedef int (*watchFn)(int ms, int watch);
+
+void pstatCmd(char ** args, jobT jobs[MAXJOBS], watchFn wait);
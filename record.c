@@ -0,0 +1,168 @@
+#include <time.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "pstat.h"
+#include "record.h"
+
+typedef struct             /* A command of a replayed session */
+{
+   long offset;            /* ms after the start it was read at */
+   int status;             /* wait status recorded; -1 if none */
+   char * cmdline;
+} entryT;
+
+static FILE * recordFp = NULL;
+static double recordStart;
+
+//not needed outside of this file
+static int readLog(char * path, entryT ** entries);
+static int byDouble(const void * a, const void * b);
+static double percentile(double * sorted, int cnt, double p);
+
+/* recordOpen
+ * Starts recording the session to the file at path.  Returns 0
+ * (after saying why) if it cannot be written.
+ */
+int recordOpen(char * path)
+{
+   if ((recordFp = fopen(path, "w")) == NULL)
+   {
+      fprintf(stderr, "ush: %s: %s\n", path, strerror(errno));
+      return 0;
+   }
+   fprintf(recordFp, "# ush session: offset_ms duration_ms status cmdline\n");
+   fflush(recordFp);
+   recordStart = seconds();
+   return 1;
+}
+
+/* recordLine
+ * Evaluates cmdline with eval and logs it to the recording.  The
+ * line is flushed at once, so the log survives ush being killed.
+ */
+void recordLine(char * cmdline, recordEvalFn eval)
+{
+   double start = seconds();
+   int status = eval(cmdline);
+   double end = seconds();
+
+   if (recordFp == NULL) return;
+   fprintf(recordFp, "%ld %ld %d %s\n", (long) ((start - recordStart) * 1000),
+           (long) ((end - start) * 1000), status, cmdline);
+   fflush(recordFp);
+}
+
+/* replaySession
+ * Replays the session logged in the file at path (see record.h)
+ * through eval, speed times as fast as it was recorded or as
+ * fast as possible if speed is 0.  wait runs the event loop for
+ * the pauses between commands and until the background jobs are
+ * done.  Prints the report and returns 0, or 1 if the log cannot
+ * be read.
+ */
+int replaySession(char * path, double speed, recordEvalFn eval,
+                  watchFn wait, jobT jobs[MAXJOBS])
+{
+   entryT * entries = NULL;
+   double start, t, ran, * latency;
+   int i, cnt, status, diverged = 0;
+
+   if ((cnt = readLog(path, &entries)) < 0) return 1;
+   latency = Malloc((cnt + 1) * sizeof(double));
+   start = seconds();
+   for (i = 0; i < cnt; i++)
+   {
+      if (strcmp(entries[i].cmdline, "quit") == 0) break;
+      //keep the recorded pace; the event loop runs in the pauses
+      if (speed > 0)
+      {
+         t = entries[i].offset / speed / 1000.0 - (seconds() - start);
+         if (t > 0) wait(t * 1000, 0);
+      }
+      t = seconds();
+      status = eval(entries[i].cmdline);
+      latency[i] = seconds() - t;
+      if (status != entries[i].status && diverged++ < REPLAYDIVERGED)
+         printf("replay: line %d diverged: status %d, recorded %d: %s\n",
+                i + 1, status, entries[i].status, entries[i].cmdline);
+   }
+   cnt = i;
+   ran = seconds() - start;
+   while (bgJobCount(jobs) > 0 || queueLength() > 0) wait(100, 0);
+   t = seconds() - start;
+   qsort(latency, cnt, sizeof(double), byDouble);
+   printf("replay: %d commands in %.2fs, %.1f commands/s", cnt, ran,
+          ran > 0 ? cnt / ran : 0.0);
+   printf("; background jobs done after %.2fs\n", t);
+   if (cnt > 0)
+      printf("replay: latency ms min %.2f p50 %.2f p90 %.2f p99 %.2f "
+             "max %.2f\n", latency[0] * 1000,
+             percentile(latency, cnt, 0.5) * 1000,
+             percentile(latency, cnt, 0.9) * 1000,
+             percentile(latency, cnt, 0.99) * 1000, latency[cnt - 1] * 1000);
+   printf("replay: %d of %d statuses diverged from the recording\n",
+          diverged, cnt);
+   for (i = 0; entries != NULL && entries[i].cmdline != NULL; i++)
+      free(entries[i].cmdline);
+   free(entries);
+   free(latency);
+   return 0;
+}
+
+/* readLog
+ * Reads the entries of the log at path into a new array ended
+ * by an entry with a NULL cmdline.  Returns the number of
+ * entries, or -1 (after saying why) if the log cannot be read.
+ */
+static int readLog(char * path, entryT ** entries)
+{
+   FILE * fp = fopen(path, "r");
+   char * line = NULL;
+   size_t cap = 0;
+   int cnt = 0, n, len;
+   long offset, duration;
+   int status;
+
+   if (fp == NULL)
+   {
+      fprintf(stderr, "ush: %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+   *entries = Malloc(sizeof(entryT));
+   while ((len = getline(&line, &cap, fp)) > 0)
+   {
+      if (line[len - 1] == '\n') line[len - 1] = '\0';
+      if (line[0] == '#' ||
+          sscanf(line, "%ld %ld %d %n", &offset, &duration, &status, &n) < 3)
+         continue;
+      *entries = realloc(*entries, (cnt + 2) * sizeof(entryT));
+      if (*entries == NULL) unixError("realloc error");
+      (*entries)[cnt].offset = offset;
+      (*entries)[cnt].status = status;
+      (*entries)[cnt].cmdline = strdup(line + n);
+      cnt++;
+   }
+   (*entries)[cnt].cmdline = NULL;
+   free(line);
+   fclose(fp);
+   return cnt;
+}
+
+
+/* byDouble
+ * qsort comparison of doubles, smallest first.
+ */
+static int byDouble(const void * a, const void * b)
+{
+   double x = *(const double *) a, y = *(const double *) b;
+   return (x > y) - (x < y);
+}
+
+/* percentile
+ * Returns percentile p (0 to 1) of the cnt sorted values.
+ */
+static double percentile(double * sorted, int cnt, double p)
+{
+   int i = (int) (p * cnt);
+   return sorted[i < cnt ? i : cnt - 1];
+}
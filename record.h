@@ -0,0 +1,24 @@
+/*
+ *  Recording and replaying sessions.
+ *  ush --record file logs each command line read along with when
+ *  it was read (ms since the session started, on the monotonic
+ *  clock), how long it took and the wait status of its foreground
+ *  job (-1 if it had none):
+ *      offset_ms duration_ms status cmdline
+ *  ush --replay file [--speed X | --max] runs the lines of such a
+ *  log again, at their recorded pace (X times faster with --speed)
+ *  or back to back with --max, waits for the background jobs and
+ *  reports the commands run per second, the distribution of their
+ *  latencies and the commands whose status differs from the log.
+ */
+
+#define REPLAYDIVERGED 10   /* diverged commands listed at most */
+
+/* evaluates cmdline; returns the wait status of its foreground
+ * job or -1 if it had none */
+typedef int (*recordEvalFn)(char * cmdline);
+
+int recordOpen(char * path);
+void recordLine(char * cmdline, recordEvalFn eval);
+int replaySession(char * path, double speed, recordEvalFn eval,
+                  watchFn wait, jobT jobs[MAXJOBS]);
@@ -0,0 +1,211 @@
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "wrappers.h"
+#include "env.h"
+#include "runtime.h"
+
+typedef struct             /* The average run time of a shape */
+{
+   char * key;             /* the shape; NULL if the slot is unused */
+   double avg;             /* seconds */
+   long runs;
+   time_t last;            /* when it last ended */
+} runtimeT;
+
+static runtimeT runtimes[RUNTIMEMAX];
+static int dirty = 0;          /* runtimes changed since they were saved */
+static time_t saved = 0;       /* when they were last saved */
+static pid_t owner;            /* the ush that saves them */
+
+//not needed outside of this file
+static void shapeOf(char * cmdline, char * key);
+static void shapeWord(char * word, char * shape, int size);
+static runtimeT * findRuntime(char * key, int add);
+static void loadRuntimes();
+static void saveRuntimes();
+static void writeRuntimes(FILE * fp);
+
+/* initRuntimes
+ * Loads the run times saved by an earlier ush; they are saved
+ * again when ush exits.
+ */
+void initRuntimes()
+{
+   owner = getpid();
+   saved = time(NULL);
+   loadRuntimes();
+   atexit(saveRuntimes);
+}
+
+/* predictRuntime
+ * Returns the seconds a job running cmdline is expected to take,
+ * or -1 if no job of its shape has ended yet.
+ */
+double predictRuntime(char * cmdline)
+{
+   char key[RUNTIMEKEYLEN];
+   runtimeT * r;
+
+   shapeOf(cmdline, key);
+   r = findRuntime(key, 0);
+   return r != NULL ? r->avg : -1;
+}
+
+/* recordRuntime
+ * Folds secs, the wall time of a job running cmdline that ended
+ * normally, into the average of its shape.
+ */
+void recordRuntime(char * cmdline, double secs)
+{
+   char key[RUNTIMEKEYLEN];
+   runtimeT * r;
+
+   shapeOf(cmdline, key);
+   if (key[0] == '\0') return;
+   r = findRuntime(key, 1);
+   r->avg = r->runs > 0 ? r->avg + RUNTIMEWEIGHT * (secs - r->avg) : secs;
+   r->runs++;
+   r->last = time(NULL);
+   dirty = 1;
+   //a ush that is killed keeps most of what it learned
+   if (r->last - saved >= RUNTIMESAVE) saveRuntimes();
+}
+
+/* shapeOf
+ * Puts the shape of cmdline (see runtime.h) in key, a buffer of
+ * RUNTIMEKEYLEN bytes: the words of its commands, separated by
+ * blanks and | between the commands, with the assignments in
+ * front of a command left out.
+ */
+static void shapeOf(char * cmdline, char * key)
+{
+   char word[PATH_MAX], shape[PATH_MAX];
+   char * p = cmdline, * base;
+   int n, len = 0, first = 1;
+
+   key[0] = '\0';
+   while (*(p += strspn(p, BLANKS)) != '\0')
+   {
+      if (*p == '|')
+      {
+         strcpy(shape, "|");
+         first = 1;
+         p++;
+      } else
+      {
+         n = strcspn(p, BLANKS "|");
+         snprintf(word, sizeof(word), "%.*s", n, p);
+         p += n;
+         if (first && isAssignment(word)) continue;
+         if (first)
+         {
+            //the same command by any path
+            base = strrchr(word, '/');
+            strcpy(shape, base != NULL && base[1] != '\0' ? base + 1 : word);
+            first = 0;
+         } else shapeWord(word, shape, sizeof(shape));
+      }
+      if (len + strlen(shape) + 2 > RUNTIMEKEYLEN) break;
+      len += sprintf(key + len, "%s%s", len > 0 ? " " : "", shape);
+   }
+}
+
+/* shapeWord
+ * Puts the shape of an argument word in shape: the word itself
+ * for options, numbers and redirections, D for a directory, F and
+ * the power of 2 of its size for a file, and _ for anything else.
+ */
+static void shapeWord(char * word, char * shape, int size)
+{
+   struct stat st;
+
+   if (word[0] == '-' || word[0] == '<' || word[0] == '>' ||
+       word[strspn(word, "0123456789.")] == '\0')
+      snprintf(shape, size, "%s", word);
+   else if (stat(word, &st) < 0) snprintf(shape, size, "_");
+   else if (S_ISDIR(st.st_mode)) snprintf(shape, size, "D");
+   else if (st.st_size > 0) snprintf(shape, size, "F%d", ilogb(st.st_size));
+   else snprintf(shape, size, "F");
+}
+
+/* findRuntime
+ * Returns the average of key, or NULL if there is none.  If add
+ * is 1 a new one is made instead; when they are full the least
+ * recently run shape gives up its slot.
+ */
+static runtimeT * findRuntime(char * key, int add)
+{
+   runtimeT * r, * slot = NULL;
+
+   for (r = runtimes; r < runtimes + RUNTIMEMAX; r++)
+   {
+      if (r->key != NULL && strcmp(r->key, key) == 0) return r;
+      if (slot == NULL || (slot->key != NULL && (r->key == NULL || r->last < slot->last)))
+         slot = r;
+   }
+   if (!add) return NULL;
+   free(slot->key);
+   memset(slot, 0, sizeof(runtimeT));
+   slot->key = strdup(key);
+   return slot;
+}
+
+/* loadRuntimes
+ * Reads the run times saved by saveRuntimes, if there are any.
+ */
+static void loadRuntimes()
+{
+   char * path = cachePath(getVar("USH_RUNTIMES"), getVar("HOME"), "ush-runtimes");
+   char * line = NULL;
+   FILE * fp = path != NULL ? fopen(path, "r") : NULL;
+   size_t cap = 0;
+   int len, n, i = 0;
+   long last;
+   runtimeT * r;
+
+   free(path);
+   if (fp == NULL) return;
+   while (i < RUNTIMEMAX && (len = getline(&line, &cap, fp)) > 0)
+   {
+      if (line[len - 1] == '\n') line[len - 1] = '\0';
+      r = &runtimes[i];
+      if (line[0] == '#' ||
+          sscanf(line, "%lf %ld %ld %n", &r->avg, &r->runs, &last, &n) < 3 ||
+          line[n] == '\0' || strlen(line + n) >= RUNTIMEKEYLEN)
+         continue;
+      r->last = last;
+      r->key = strdup(line + n);
+      i++;
+   }
+   free(line);
+   fclose(fp);
+}
+
+/* saveRuntimes
+ * Writes the run times (see saveAtomic) if they changed.
+ */
+static void saveRuntimes()
+{
+   char * path;
+
+   if (!dirty || getpid() != owner) return;
+   path = cachePath(getVar("USH_RUNTIMES"), getVar("HOME"), "ush-runtimes");
+   if (path != NULL && saveAtomic(path, writeRuntimes)) dirty = 0;
+   saved = time(NULL);
+   free(path);
+}
+
+/* writeRuntimes
+ * Writes the run times to fp, for saveRuntimes.
+ */
+static void writeRuntimes(FILE * fp)
+{
+   runtimeT * r;
+
+   fprintf(fp, "# ush runtimes: avg_s runs last shape\n");
+   for (r = runtimes; r < runtimes + RUNTIMEMAX; r++)
+      if (r->key != NULL)
+         fprintf(fp, "%.3f %ld %ld %s\n", r->avg, r->runs, (long) r->last, r->key);
+}
@@ -0,0 +1,25 @@
+/*
+ *  Learned run times of jobs, for ordering the job queue.
+ *  When a job ends normally, its wall time is folded into an
+ *  exponentially weighted average (weight RUNTIMEWEIGHT for the
+ *  new run) kept for the shape of its command line: each command's
+ *  name, its options and numbers as typed, and for its other words
+ *  whether they name a directory, a file of a given size (to a power
+ *  of 2) or neither.  So sort -n big.log and sort -n other.log of the
+ *  same size share an average, while a much smaller log has its own.
+ *  The averages are kept in $USH_RUNTIMES or ~/.cache/ush-runtimes;
+ *  when RUNTIMEMAX shapes are kept the least recently run is dropped.
+ *  The queue (see jobs.c) starts the job expected to be shortest,
+ *  less RUNTIMEAGING seconds per second it has waited, so a long
+ *  job is overtaken only by jobs queued soon after it.
+ */
+
+#define RUNTIMEMAX 256         /* command shapes kept */
+#define RUNTIMEKEYLEN 256      /* longest shape kept */
+#define RUNTIMEWEIGHT 0.3      /* of a new run in the average */
+#define RUNTIMEAGING 1.0       /* expected s forgiven per s queued */
+#define RUNTIMESAVE 60         /* s between saves while ush runs */
+
+void initRuntimes();
+double predictRuntime(char * cmdline);
+void recordRuntime(char * cmdline, double secs);
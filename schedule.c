@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include <sys/timerfd.h>
+#include <time.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "events.h"
+#include "schedule.h"
+
+#define WHEELMASK (WHEELSIZE - 1)
+
+typedef struct sched       /* A schedule */
+{
+   int id;                 /* 0 once cancelled */
+   unsigned long long expires;   /* tick it fires at */
+   unsigned long long interval;  /* ticks between firings; 0 for once */
+   char * spec;            /* when, as typed: every 5s, at +10m */
+   char * cmdline;         /* the job to run */
+   int jid;                /* job of the last firing; 0 if none */
+   int runs;               /* firings that started a job */
+   int skips;              /* firings skipped, the last job still running */
+   struct sched * next;    /* in its wheel slot */
+   struct sched ** pprev;  /* the pointer to it in the slot; NULL if none */
+   struct sched * allNext; /* in the list of all schedules, by id */
+   struct sched * allPrev;
+} schedT;
+
+static schedT * wheel[WHEELLEVELS][WHEELSIZE];
+static schedT * allHead = NULL, * allTail = NULL;
+static unsigned long long now = 0;   /* the next tick to run */
+static struct timespec base;         /* the time of tick 0 */
+static int timerFd = -1;
+static int schedCnt = 0;
+static int nextId = 1;
+static schedT * firing = NULL;       /* the schedule whose job is starting */
+static jobT * jobList = NULL;
+static schedRunFn runFn = NULL;
+
+//not needed outside of this file
+static unsigned long long clockTick();
+static void armTimer(int on);
+static void readTimer(int fd, short revents, void * arg);
+static void runTick();
+static void fire(schedT * s);
+static void insertSched(schedT * s);
+static void unlinkSched(schedT * s);
+static void removeSched(schedT * s);
+static long parseDuration(char * s);
+static long parseAt(char * s);
+static char * durationStr(long ms, char * buf, int size);
+static void listSchedules();
+
+/* initSchedule
+ * Sets the jobs array firings are checked against and the function
+ * that starts their jobs.
+ */
+void initSchedule(jobT jobs[MAXJOBS], schedRunFn run)
+{
+   jobList = jobs;
+   runFn = run;
+   clock_gettime(CLOCK_MONOTONIC, &base);
+}
+
+/* isScheduleCmd
+ * Returns 1 if name is every or at, which take the rest of the job
+ * as typed (see scheduleJob).
+ */
+int isScheduleCmd(char * name)
+{
+   return strcmp(name, "every") == 0 || strcmp(name, "at") == 0;
+}
+
+/* scheduleJob
+ * Handles every DURATION cmdline and at +DURATION|HH:MM[:SS]
+ * cmdline.  job is the job as typed, so the variables and wildcards
+ * of cmdline are expanded each time it runs.  A duration is a
+ * number with an ms, s, m, h or d suffix; seconds if there is none.
+ */
+void scheduleJob(char * job)
+{
+   char * p = job, * cmd, * when, buf[32];
+   long ms;
+   schedT * s;
+
+   cmd = nextWord(&p);
+   when = nextWord(&p);
+   p += strspn(p, BLANKS);
+   if (when == NULL || *p == '\0')
+   {
+      printf("usage: every DURATION cmdline\n");
+      printf("       at +DURATION|HH:MM[:SS] cmdline\n");
+      free(cmd);
+      free(when);
+      return;
+   }
+   ms = (cmd[0] == 'e') ? parseDuration(when) : parseAt(when);
+   if (ms <= 0)
+   {
+      printf("%s: %s: invalid time\n", cmd, when);
+      free(cmd);
+      free(when);
+      return;
+   }
+   s = Malloc(sizeof(schedT));
+   s->id = nextId++;
+   s->spec = Malloc(strlen(cmd) + strlen(when) + 2);
+   sprintf(s->spec, "%s %s", cmd, when);
+   s->cmdline = strdup(p);
+   s->jid = s->runs = s->skips = 0;
+   s->pprev = NULL;
+   //an idle wheel is empty, so it can jump to the current time
+   if (schedCnt == 0) now = clockTick();
+   s->interval = (cmd[0] == 'e') ? (ms + SCHEDTICK - 1) / SCHEDTICK : 0;
+   s->expires = now + (ms + SCHEDTICK - 1) / SCHEDTICK;
+   s->allNext = NULL;
+   s->allPrev = allTail;
+   if (allTail != NULL) allTail->allNext = s;
+   else allHead = s;
+   allTail = s;
+   insertSched(s);
+   if (schedCnt++ == 0) armTimer(1);
+   printf("schedule %d: next in %s\n", s->id, durationStr(ms, buf, sizeof(buf)));
+   free(cmd);
+   free(when);
+}
+
+/* scheduleCmd
+ * The schedule builtin: schedule [list] lists the schedules and
+ * schedule cancel ID...|all cancels them.
+ */
+void scheduleCmd(char ** args)
+{
+   schedT * s, * next;
+   int i, id, found;
+
+   if (args[1] == NULL || strcmp(args[1], "list") == 0)
+   {
+      listSchedules();
+      return;
+   }
+   if (strcmp(args[1], "cancel") != 0 || args[2] == NULL)
+   {
+      printf("usage: schedule [list]\n");
+      printf("       schedule cancel ID...|all\n");
+      return;
+   }
+   for (i = 2; args[i] != NULL; i++)
+   {
+      id = (strcmp(args[i], "all") == 0) ? 0 : atoi(args[i]);
+      found = 0;
+      for (s = allHead; s != NULL; s = next)
+      {
+         next = s->allNext;
+         if (id != 0 && s->id != id) continue;
+         removeSched(s);
+         found = 1;
+      }
+      if (!found && id != 0) printf("schedule: %s: no such schedule\n", args[i]);
+   }
+}
+
+/* clockTick
+ * Returns the tick the clock is in.
+ */
+static unsigned long long clockTick()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ((ts.tv_sec - base.tv_sec) * 1000LL +
+           (ts.tv_nsec - base.tv_nsec) / 1000000) / SCHEDTICK;
+}
+
+/* armTimer
+ * Starts the timerfd ticking every SCHEDTICK ms, or stops it
+ * if on is 0, so an idle shell is not woken up.
+ */
+static void armTimer(int on)
+{
+   struct itimerspec its;
+
+   if (timerFd < 0)
+   {
+      timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (timerFd < 0) unixError("timerfd_create error");
+      addEvent(timerFd, POLLIN, readTimer, NULL);
+   }
+   memset(&its, 0, sizeof(its));
+   if (on)
+   {
+      its.it_interval.tv_nsec = SCHEDTICK * 1000000L;
+      its.it_value = its.it_interval;
+   }
+   timerfd_settime(timerFd, 0, &its, NULL);
+}
+
+/* readTimer
+ * Event handler for the timerfd.  Runs the ticks up to the
+ * current time, which catches up on ticks missed while ush was
+ * busy.  A job that is started may run the event loop (like a
+ * builtin waiting on a job), so the handler can be called again
+ * while it runs; the inner call leaves the ticks to the outer one.
+ */
+static void readTimer(int fd, short revents, void * arg)
+{
+   static int ticking = 0;
+   unsigned long long expirations, target;
+
+   if (read(fd, &expirations, sizeof(expirations)) < 0 || ticking) return;
+   ticking = 1;
+   target = clockTick();
+   while (schedCnt > 0 && now <= target) runTick();
+   ticking = 0;
+   if (schedCnt == 0) armTimer(0);
+}
+
+/* runTick
+ * Runs tick now: when the lower wheels come around, the slot of
+ * the wheel above is cascaded into them, then the schedules in the
+ * slot of the lowest wheel fire.
+ */
+static void runTick()
+{
+   int level, idx;
+   schedT * s, * next;
+
+   for (level = 1; level < WHEELLEVELS &&
+        ((now >> (WHEELBITS * (level - 1))) & WHEELMASK) == 0; level++)
+   {
+      idx = (now >> (WHEELBITS * level)) & WHEELMASK;
+      s = wheel[level][idx];
+      wheel[level][idx] = NULL;
+      for (; s != NULL; s = next)
+      {
+         next = s->next;
+         s->pprev = NULL;
+         insertSched(s);
+      }
+   }
+   //a firing can cancel other schedules, so take one at a time
+   while ((s = wheel[0][now & WHEELMASK]) != NULL)
+   {
+      unlinkSched(s);
+      fire(s);
+   }
+   now++;
+}
+
+/* fire
+ * Starts the job of s unless the job of its last firing is still
+ * running or queued, then puts it back in the wheel for its next
+ * firing or drops it.
+ */
+static void fire(schedT * s)
+{
+   jobT * job = s->jid ? getJobJid(s->jid, jobList) : NULL;
+
+   if ((job != NULL && strcmp(job->cmdline, s->cmdline) == 0) ||
+       (s->jid != 0 && isQueued(s->jid)))
+      s->skips++;
+   else
+   {
+      s->runs++;
+      firing = s;
+      s->jid = runFn(s->cmdline);
+      firing = NULL;
+   }
+   //a once schedule is done; a cancelled one was left for here
+   if (s->interval == 0 || s->id == 0)
+   {
+      removeSched(s);
+      return;
+   }
+   //firings missed while ush was busy are not made up
+   while (s->expires <= now) s->expires += s->interval;
+   insertSched(s);
+}
+
+/* insertSched
+ * Puts s in the slot for its expiry: the lowest wheel that turns
+ * at most once before then.  An overdue s goes in the current slot.
+ */
+static void insertSched(schedT * s)
+{
+   unsigned long long when = s->expires < now ? now : s->expires;
+   unsigned long long delta = when - now;
+   int level = 0;
+   schedT ** slot;
+
+   if (delta >= 1ULL << (WHEELBITS * WHEELLEVELS))
+      when = now + (1ULL << (WHEELBITS * WHEELLEVELS)) - 1;
+   while (level < WHEELLEVELS - 1 && delta >= 1ULL << (WHEELBITS * (level + 1)))
+      level++;
+   slot = &wheel[level][(when >> (WHEELBITS * level)) & WHEELMASK];
+   s->next = *slot;
+   if (*slot != NULL) (*slot)->pprev = &s->next;
+   s->pprev = slot;
+   *slot = s;
+}
+
+/* unlinkSched
+ * Takes s out of its wheel slot.
+ */
+static void unlinkSched(schedT * s)
+{
+   if (s->pprev == NULL) return;
+   *s->pprev = s->next;
+   if (s->next != NULL) s->next->pprev = s->pprev;
+   s->pprev = NULL;
+}
+
+/* removeSched
+ * Drops s.  The schedule whose job is being started is only marked
+ * cancelled; fire drops it once the job started.
+ */
+static void removeSched(schedT * s)
+{
+   if (s == firing)
+   {
+      s->id = 0;
+      return;
+   }
+   unlinkSched(s);
+   if (s->allPrev != NULL) s->allPrev->allNext = s->allNext;
+   else allHead = s->allNext;
+   if (s->allNext != NULL) s->allNext->allPrev = s->allPrev;
+   else allTail = s->allPrev;
+   free(s->spec);
+   free(s->cmdline);
+   free(s);
+   schedCnt--;
+}
+
+/* parseDuration
+ * Returns the milliseconds in a duration like 500ms, 1.5s, 10m,
+ * 2h, 1d or 30 (seconds), or -1 if it is not one.
+ */
+static long parseDuration(char * s)
+{
+   char * end;
+   double n = strtod(s, &end);
+
+   if (end == s || n < 0) return -1;
+   if (strcmp(end, "ms") == 0) return n;
+   if (*end == '\0' || strcmp(end, "s") == 0) return n * 1000;
+   if (strcmp(end, "m") == 0) return n * 60000;
+   if (strcmp(end, "h") == 0) return n * 3600000;
+   if (strcmp(end, "d") == 0) return n * 86400000;
+   return -1;
+}
+
+/* parseAt
+ * Returns the milliseconds until the time of at: +DURATION, or
+ * HH:MM[:SS] today, or tomorrow if that has passed.  Returns -1
+ * if it is not a time.
+ */
+static long parseAt(char * s)
+{
+   int h, m, sec = 0, n;
+   time_t t = time(NULL), then;
+   struct tm tm;
+
+   if (s[0] == '+') return parseDuration(s + 1);
+   n = sscanf(s, "%d:%d:%d", &h, &m, &sec);
+   if (n < 2 || h < 0 || h > 23 || m < 0 || m > 59 || sec < 0 || sec > 59)
+      return -1;
+   localtime_r(&t, &tm);
+   tm.tm_hour = h;
+   tm.tm_min = m;
+   tm.tm_sec = sec;
+   tm.tm_isdst = -1;
+   if ((then = mktime(&tm)) <= t)
+   {
+      tm.tm_mday++;
+      tm.tm_hour = h;
+      tm.tm_isdst = -1;
+      then = mktime(&tm);
+   }
+   return (then - t) * 1000L;
+}
+
+/* durationStr
+ * Formats ms into buf like 250ms, 4.9s, 12m05s or 3h20m.
+ */
+static char * durationStr(long ms, char * buf, int size)
+{
+   long secs = ms / 1000;
+
+   if (ms < 1000) snprintf(buf, size, "%ldms", ms);
+   else if (secs < 60) snprintf(buf, size, "%.1fs", ms / 1000.0);
+   else if (secs < 3600) snprintf(buf, size, "%ldm%02lds", secs / 60, secs % 60);
+   else snprintf(buf, size, "%ldh%02ldm", secs / 3600, secs / 60 % 60);
+   return buf;
+}
+
+
+/* listSchedules
+ * Prints the schedules: when each fires next, how often it ran
+ * and was skipped, and the job of its last firing.
+ */
+static void listSchedules()
+{
+   char next[32], jid[16];
+   long long ms;
+   schedT * s;
+
+   if (allHead == NULL) return;
+   printf("%-4s %-10s %-16s %5s %5s %-5s %s\n", "ID", "NEXT", "WHEN", "RUNS",
+          "SKIPS", "JOB", "COMMAND");
+   for (s = allHead; s != NULL; s = s->allNext)
+   {
+      ms = ((long long) s->expires - (long long) clockTick()) * SCHEDTICK;
+      durationStr(ms > 0 ? ms : 0, next, sizeof(next));
+      if (s->jid != 0) snprintf(jid, sizeof(jid), "%%%d", s->jid);
+      else snprintf(jid, sizeof(jid), "-");
+      printf("%-4d %-10s %-16s %5d %5d %-5s %s\n", s->id, next, s->spec,
+             s->runs, s->skips, jid, s->cmdline);
+   }
+}
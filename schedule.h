@@ -0,0 +1,29 @@
+/*
+ *  Recurring and delayed jobs run by ush itself.
+ *  every 5s cmdline runs cmdline as a background job every 5
+ *  seconds and at +10m cmdline (or at 14:30 cmdline) runs it once.
+ *  A firing is skipped while the job of the previous one is still
+ *  running or queued.  schedule lists the schedules and schedule
+ *  cancel ID|all drops them.
+ *
+ *  The schedules live in a hierarchical timer wheel: WHEELLEVELS
+ *  wheels of WHEELSIZE slots, each slot of a wheel spanning a whole
+ *  turn of the wheel below.  A schedule goes in the slot of the
+ *  lowest wheel that reaches its time and cascades down a wheel as
+ *  that slot comes up, so adding, cancelling and firing are O(1) no
+ *  matter how many schedules there are.  A timerfd in the event loop
+ *  drives the wheel every SCHEDTICK ms while there are schedules.
+ */
+
+#define SCHEDTICK 100      /* ms per tick of the lowest wheel */
+#define WHEELBITS 8
+#define WHEELSIZE (1 << WHEELBITS)
+#define WHEELLEVELS 4      /* reaches 2^32 ticks, over a year */
+
+/* runs cmdline as a background job; returns its jid or 0 */
+typedef int (*schedRunFn)(char * cmdline);
+
+void initSchedule(jobT jobs[MAXJOBS], schedRunFn run);
+int isScheduleCmd(char * name);
+void scheduleJob(char * job);
+void scheduleCmd(char ** args);
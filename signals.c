@@ -0,0 +1,321 @@
+#include <ctype.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "events.h"
+#include "state.h"
+#include "signals.h"
+
+typedef struct             /* A signal name without SIG */
+{
+   const char * name;
+   int sig;
+} sigNameT;
+
+static const sigNameT sigNames[] = {
+   {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ILL", SIGILL},
+   {"TRAP", SIGTRAP}, {"ABRT", SIGABRT}, {"BUS", SIGBUS}, {"FPE", SIGFPE},
+   {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"SEGV", SIGSEGV},
+   {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},
+   {"TERM", SIGTERM},
+#ifdef SIGSTKFLT
+   {"STKFLT", SIGSTKFLT},
+#endif
+   {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+   {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU},
+   {"URG", SIGURG}, {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ},
+   {"VTALRM", SIGVTALRM}, {"PROF", SIGPROF}, {"WINCH", SIGWINCH},
+   {"IO", SIGIO},
+#ifdef SIGPWR
+   {"PWR", SIGPWR},
+#endif
+   {"SYS", SIGSYS},
+   //other spellings, only looked up by name
+   {"IOT", SIGABRT}, {"CLD", SIGCHLD}, {"POLL", SIGIO},
+   {NULL, 0}
+};
+
+//not needed outside of this file
+static int signalProc(jobT * job, int j, int sig);
+static int killJid(int jid, int sig, int quiet, jobT jobs[MAXJOBS]);
+static void killTarget(char * target, int sig, jobT jobs[MAXJOBS]);
+static void listSignals(char * arg);
+static int endsJob(int sig);
+
+/* signalNumber
+ * Returns the number of the signal named name: a number, a
+ * name with or without SIG in any case, or RTMIN+n and RTMAX-n.
+ * Returns -1 if there is no such signal.
+ */
+int signalNumber(char * name)
+{
+   char upper[32], * end;
+   int i, n;
+
+   if (isdigit((unsigned char) name[0]))
+   {
+      n = strtol(name, &end, 10);
+      return (*end == '\0' && n >= 0 && n <= SIGRTMAX) ? n : -1;
+   }
+   for (i = 0; name[i] != '\0' && i < (int) sizeof(upper) - 1; i++)
+      upper[i] = toupper((unsigned char) name[i]);
+   upper[i] = '\0';
+   name = upper;
+   if (strncmp(name, "SIG", 3) == 0) name += 3;
+   for (i = 0; sigNames[i].name != NULL; i++)
+      if (strcmp(name, sigNames[i].name) == 0) return sigNames[i].sig;
+   if (strncmp(name, "RTMIN", 5) == 0 || strncmp(name, "RTMAX", 5) == 0)
+   {
+      n = (name[5] == '\0') ? 0 : strtol(name + 5, &end, 10);
+      if (name[5] != '\0' && *end != '\0') return -1;
+      n = (name[4] == 'N') ? SIGRTMIN + n : SIGRTMAX + n;
+      return (n >= SIGRTMIN && n <= SIGRTMAX) ? n : -1;
+   }
+   return -1;
+}
+
+/* signalName
+ * Returns the name of signal sig without SIG, like TERM or
+ * RTMIN+3.  The name of a real-time signal is overwritten by
+ * the next call.
+ */
+const char * signalName(int sig)
+{
+   static char rt[16];
+   int i;
+
+   for (i = 0; sigNames[i].name != NULL; i++)
+      if (sigNames[i].sig == sig) return sigNames[i].name;
+   if (sig >= SIGRTMIN && sig <= SIGRTMAX)
+   {
+      if (sig == SIGRTMIN) return "RTMIN";
+      if (sig == SIGRTMAX) return "RTMAX";
+      if (sig - SIGRTMIN <= SIGRTMAX - sig)
+         snprintf(rt, sizeof(rt), "RTMIN+%d", sig - SIGRTMIN);
+      else snprintf(rt, sizeof(rt), "RTMAX-%d", SIGRTMAX - sig);
+      return rt;
+   }
+   return "?";
+}
+
+/* signalJob
+ * Sends sig to job, with killpg if the group leader is an
+ * unreaped child of ush and otherwise to each process through its
+ * pidfd.  Like other shells, a stopped job that gets SIGTERM or
+ * SIGHUP is continued so it can act on it.  Returns the number
+ * of processes (or groups) the signal was sent to.
+ */
+int signalJob(jobT * job, int sig)
+{
+   int j, sent = 0;
+
+   if (!job->adopted && job->pidCnt > 0 && job->pid[0] != 0 &&
+       job->pid[0] == job->pgrp)
+      sent = (killpg(job->pgrp, sig) == 0);
+   else
+      for (j = 0; j < job->pidCnt; j++) sent += signalProc(job, j, sig);
+   if (sent > 0 && job->state == ST && (sig == SIGTERM || sig == SIGHUP))
+   {
+      job->state = BG;
+      signalJob(job, SIGCONT);
+   }
+   return sent;
+}
+
+/* killCmd
+ * The kill builtin: kill [-SIG | -s SIG] target ... sends SIGTERM
+ * or SIG to each target; kill -l [SIG] lists the signals or
+ * names one.
+ */
+void killCmd(char ** args, jobT jobs[MAXJOBS])
+{
+   int i = 1, sig = SIGTERM;
+
+   if (args[1] != NULL && strcmp(args[1], "-l") == 0)
+   {
+      listSignals(args[2]);
+      return;
+   }
+   if (args[1] != NULL && strcmp(args[1], "-s") == 0)
+   {
+      sig = args[2] != NULL ? signalNumber(args[2]) : -1;
+      i = 3;
+   }
+   else if (args[1] != NULL && args[1][0] == '-')
+   {
+      sig = signalNumber(&args[1][1]);
+      i = 2;
+   }
+   if (sig < 0)
+   {
+      printf("kill: %s: invalid signal\n", args[i - 1] ? args[i - 1] : "");
+      return;
+   }
+   if (args[i] == NULL)
+   {
+      printf("usage: kill [-SIG | -s SIG] %%jid|%%jid-jid|%%all|%%bg|"
+             "%%stopped|-pgid|pid ...\n");
+      printf("       kill -l [SIG]\n");
+      return;
+   }
+   for (; args[i] != NULL; i++) killTarget(args[i], sig, jobs);
+}
+
+/* signalProc
+ * Sends sig to process j of job through its pidfd.  A child of
+ * ush without a pidfd (there were no fds left) is sent it by pid,
+ * which is safe as long as it is not reaped.  Returns 1 if the
+ * signal was sent.
+ */
+static int signalProc(jobT * job, int j, int sig)
+{
+   if (job->pid[j] == 0) return 0;
+#ifdef SYS_pidfd_send_signal
+   if (job->pidfd[j] >= 0)
+      return syscall(SYS_pidfd_send_signal, job->pidfd[j], sig, NULL, 0) == 0;
+#endif
+   //the pid of an adopted process could have been reused by now
+   if (job->adopted) return 0;
+   return kill(job->pid[j], sig) == 0;
+}
+
+/* killJid
+ * Sends sig to the job with jid.  A queued job is removed from
+ * the queue by a signal that would end it and left alone by any
+ * other (so kill -0 just finds it).  Unless quiet is 1 a missing
+ * job is reported.  Returns 1 if there was such a job.
+ */
+static int killJid(int jid, int sig, int quiet, jobT jobs[MAXJOBS])
+{
+   jobT * job;
+
+   if (isQueued(jid))
+   {
+      if (endsJob(sig) && removeQueued(jid))
+         printf("[%d] removed from queue\n", jid);
+      return 1;
+   }
+   if ((job = getJobJid(jid, jobs)) == NULL)
+   {
+      if (!quiet) printf("kill: %%%d: no such job\n", jid);
+      return 0;
+   }
+   if (signalJob(job, sig) == 0 && !quiet)
+      printf("kill: %%%d: %s\n", jid, strerror(errno));
+   saveJob(job, job - jobs);
+   return 1;
+}
+
+/* killTarget
+ * Sends sig to one target of the kill builtin.
+ */
+static void killTarget(char * target, int sig, jobT jobs[MAXJOBS])
+{
+   int i, first, last, jid, want;
+   char * cmdline, * end;
+   jobT * job;
+   pid_t pid;
+
+   if (target[0] == '%' && (strcmp(target, "%all") == 0 ||
+       strcmp(target, "%bg") == 0 || strcmp(target, "%stopped") == 0))
+   {
+      want = target[1] == 'a' ? UNDEF : target[1] == 'b' ? BG : ST;
+      for (i = 0; i < MAXJOBS; i++)
+      {
+         if (jobs[i].state == UNDEF || (want != UNDEF && jobs[i].state != want))
+            continue;
+         signalJob(&jobs[i], sig);
+         saveJob(&jobs[i], i);
+      }
+      //%all also empties the queue, if the signal ends jobs
+      while (want == UNDEF && endsJob(sig) && (cmdline = dequeueJob(&jid)) != NULL)
+      {
+         printf("[%d] removed from queue\n", jid);
+         free(cmdline);
+      }
+      return;
+   }
+   if (target[0] == '%')
+   {
+      first = strtol(target + 1, &end, 10);
+      last = first;
+      if (*end == '-') last = strtol(end + 1, &end, 10);
+      if (end == target + 1 || *end != '\0' || first < 1 || last < first)
+      {
+         printf("kill: %s: no such job\n", target);
+         return;
+      }
+      //a range only reports what it found
+      for (jid = first; jid <= last; jid++) killJid(jid, sig, first != last, jobs);
+      return;
+   }
+   pid = strtol(target[0] == '-' ? target + 1 : target, &end, 10);
+   if (*end != '\0' || pid < 1)
+   {
+      printf("kill: %s: arguments must be process or job IDs\n", target);
+      return;
+   }
+   if (target[0] == '-')
+   {
+      //a group of a job is signaled the safe way
+      for (i = 0; i < MAXJOBS; i++)
+      {
+         if (jobs[i].state != UNDEF && jobs[i].pgrp == pid)
+         {
+            signalJob(&jobs[i], sig);
+            saveJob(&jobs[i], i);
+            return;
+         }
+      }
+      if (killpg(pid, sig) < 0) printf("kill: %s: %s\n", target, strerror(errno));
+      return;
+   }
+   if ((job = getJobPid(pid, jobs)) != NULL)
+   {
+      for (i = 0; i < job->pidCnt; i++)
+         if (job->pid[i] == pid) signalProc(job, i, sig);
+      return;
+   }
+   if (kill(pid, sig) < 0) printf("kill: %s: %s\n", target, strerror(errno));
+}
+
+/* listSignals
+ * Prints the signals as number) NAME, or with an arg the name
+ * of a signal number or the number of a signal name.
+ */
+static void listSignals(char * arg)
+{
+   int sig, cnt = 0, width = 0;
+
+   if (arg != NULL)
+   {
+      if ((sig = signalNumber(arg)) < 0) printf("kill: %s: invalid signal\n", arg);
+      else if (isdigit((unsigned char) arg[0])) printf("%s\n", signalName(sig));
+      else printf("%d\n", sig);
+      return;
+   }
+   for (sig = 1; sig <= SIGRTMAX; sig++)
+   {
+      if (sig < SIGRTMIN && strcmp(signalName(sig), "?") == 0) continue;
+      if (cnt % 5) printf("%*s", 13 - width, "");
+      width = printf("%2d) SIG%s", sig, signalName(sig));
+      if (++cnt % 5 == 0) printf("\n");
+   }
+   if (cnt % 5) printf("\n");
+}
+
+/* endsJob
+ * Returns 1 if the default action of sig ends a process.
+ */
+static int endsJob(int sig)
+{
+   switch (sig)
+   {
+      case 0: case SIGCONT: case SIGSTOP: case SIGTSTP: case SIGTTIN:
+      case SIGTTOU: case SIGCHLD: case SIGURG: case SIGWINCH:
+         return 0;
+      default:
+         return 1;
+   }
+}
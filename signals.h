@@ -0,0 +1,22 @@
+/*
+ *  The kill builtin and the signal names.
+ *  Signals go to the processes of a job through the pidfds the job
+ *  holds, so a signal can never reach an unrelated process that
+ *  reused the pid of a job process that was reaped.  A job whose
+ *  group leader is a child of ush that is not reaped yet gets the
+ *  signal with one killpg: the group id cannot be reused while the
+ *  leader's pid is held, and the signal also reaches processes the
+ *  stages started themselves.
+ *
+ *  kill [-SIG | -s SIG] target ...
+ *  kill -l [SIG]
+ *  A target is %N, a range of jids %N-M, %all, %bg, %stopped,
+ *  -pgid or pid.  Queued jobs that are targeted by a signal that
+ *  would end them are removed from the queue; other signals, like
+ *  0 and CONT, leave them queued.
+ */
+
+int signalNumber(char * name);
+const char * signalName(int sig);
+int signalJob(jobT * job, int sig);
+void killCmd(char ** args, jobT jobs[MAXJOBS]);
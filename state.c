@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "wrappers.h"
+#include "jobs.h"
+#include "events.h"
+#include "env.h"
+#include "state.h"
+
+static stateFileT * stateFile = NULL;   /* the mapped file; NULL if none */
+
+//not needed outside of this file
+static unsigned long long startTime(pid_t pid);
+
+/* initState
+ * Opens and maps the state file, $USH_STATE, else ush.state in
+ * $XDG_RUNTIME_DIR or else in ~/.cache, and locks it.  Only a
+ * regular file (not a symlink) of the user with mode 0600 is
+ * used, since ush adopts the jobs in it.  Returns 0 if there is
+ * no state file because another ush holds the lock or the file
+ * cannot be used.
+ */
+int initState()
+{
+   char * path, * var = getVar("USH_STATE"), * run = getVar("XDG_RUNTIME_DIR");
+   int fd;
+   void * map;
+   struct stat st;
+
+   if ((var == NULL || var[0] == '\0') && run != NULL && run[0] != '\0')
+   {
+      path = Malloc(strlen(run) + 16);
+      sprintf(path, "%s/ush.state", run);
+   }
+   else if ((path = cachePath(var, getVar("HOME"), "ush.state")) == NULL)
+      return 0;
+   //a new file gets its mode even under a umask
+   fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+   if (fd >= 0) fchmod(fd, 0600);
+   else if (errno == EEXIST)
+      fd = open(path, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+   free(path);
+   if (fd < 0) return 0;
+   //the lock goes away with ush, so a restarted ush gets it back
+   if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid() ||
+       (st.st_mode & 07777) != 0600 ||
+       flock(fd, LOCK_EX | LOCK_NB) < 0 ||
+       ftruncate(fd, sizeof(stateFileT)) < 0)
+   {
+      close(fd);
+      return 0;
+   }
+   map = mmap(NULL, sizeof(stateFileT), PROT_READ | PROT_WRITE, MAP_SHARED,
+              fd, 0);
+   if (map == MAP_FAILED)
+   {
+      close(fd);
+      return 0;
+   }
+   //fd stays open to hold the lock
+   stateFile = map;
+   if (stateFile->magic != STATEMAGIC || stateFile->slots != MAXJOBS)
+   {
+      memset(stateFile, 0, sizeof(stateFileT));
+      stateFile->magic = STATEMAGIC;
+      stateFile->slots = MAXJOBS;
+   }
+   return 1;
+}
+
+/* adoptJobs
+ * Adds the jobs in the state file that still have live processes
+ * to the jobs array.  A process counts as live if a process with
+ * its pid exists and started at the time in the file (so the pid
+ * was not reused).  The pidfd the job holds for each live process
+ * is added to the event loop with handler, which gets the pid as
+ * arg; deletePid removes and closes it.  A job that was in the
+ * foreground is adopted as a background job.
+ * Returns the number of adopted jobs.
+ */
+int adoptJobs(jobT jobs[MAXJOBS], eventHandler handler)
+{
+   stateSlotT * old;
+   stateSlotT * s;
+   pid_t live[STATEPIDS];
+   int fds[STATEPIDS];
+   int i, j, n, cnt = 0;
+   jobT * job;
+
+   if (stateFile == NULL) return 0;
+   //the jobs get new slots, so work from a copy
+   old = Malloc(sizeof(stateFile->slot));
+   memcpy(old, stateFile->slot, sizeof(stateFile->slot));
+   memset(stateFile->slot, 0, sizeof(stateFile->slot));
+   for (i = 0; i < MAXJOBS; i++)
+   {
+      s = &old[i];
+      if (s->jid == 0) continue;
+      n = 0;
+      for (j = 0; j < s->pidCnt && j < STATEPIDS; j++)
+      {
+         if (s->pid[j] == 0 || s->start[j] == 0) continue;
+         //checked after the open, the pidfd is known to hold this process
+         if ((fds[n] = pidfdOpen(s->pid[j])) < 0) continue;
+         if (startTime(s->pid[j]) != s->start[j])
+         {
+            close(fds[n]);
+            continue;
+         }
+         live[n++] = s->pid[j];
+      }
+      if (n == 0) continue;
+      s->cmdline[STATECMDLEN - 1] = '\0';
+      addJob(live, n, s->pgrp, s->state == FG ? BG : s->state, s->jid,
+             s->cmdline, jobs);
+      if ((job = getJobJid(s->jid, jobs)) == NULL)
+      {
+         for (j = 0; j < n; j++) close(fds[j]);
+         continue;
+      }
+      job->adopted = 1;
+      //the job keeps the checked pidfds instead of the ones addJob opened
+      for (j = 0; j < n; j++)
+      {
+         if (job->pidfd[j] >= 0) close(job->pidfd[j]);
+         job->pidfd[j] = fds[j];
+         addEvent(fds[j], POLLIN, handler, (void *) (long) live[j]);
+      }
+      cnt++;
+   }
+   free(old);
+   return cnt;
+}
+
+/* saveJob
+ * Copies the job in jobs[slot] to slot of the state file.  An
+ * UNDEF job clears the slot.  The jid is written last, so a
+ * slot with a jid is complete.
+ */
+void saveJob(jobT * job, int slot)
+{
+   stateSlotT * s;
+   int j;
+
+   if (stateFile == NULL || slot < 0 || slot >= MAXJOBS) return;
+   s = &stateFile->slot[slot];
+   if (job->state == UNDEF)
+   {
+      s->jid = 0;
+      return;
+   }
+   s->jid = 0;
+   s->state = job->state;
+   s->pgrp = job->pgrp;
+   s->pidCnt = job->pidCnt < STATEPIDS ? job->pidCnt : STATEPIDS;
+   for (j = 0; j < s->pidCnt; j++)
+   {
+      //only look up the start time of a pid that is new to the slot
+      if (job->pid[j] != s->pid[j])
+         s->start[j] = job->pid[j] ? startTime(job->pid[j]) : 0;
+      s->pid[j] = job->pid[j];
+   }
+   snprintf(s->cmdline, STATECMDLEN, "%s", job->cmdline);
+   __atomic_store_n(&s->jid, job->jid, __ATOMIC_RELEASE);
+}
+
+/* startTime
+ * Returns the start time of process pid (field 22 of
+ * /proc/pid/stat) or 0 if there is no such process.
+ */
+static unsigned long long startTime(pid_t pid)
+{
+   char path[64], buf[1024], * p;
+   unsigned long long start = 0;
+   int fd, n, field;
+
+   snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) return 0;
+   n = read(fd, buf, sizeof(buf) - 1);
+   close(fd);
+   if (n <= 0) return 0;
+   buf[n] = '\0';
+   //the command name can hold spaces, so count fields from its end
+   if ((p = strrchr(buf, ')')) == NULL) return 0;
+   for (field = 2; field < 22 && p != NULL; field++) p = strchr(p + 1, ' ');
+   if (p != NULL) start = strtoull(p + 1, NULL, 10);
+   return start;
+}
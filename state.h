@@ -0,0 +1,37 @@
+/*
+ *  The job state file.
+ *  The jobs array is mirrored in a small file that is mapped into
+ *  memory: slot i of the file holds jobs[i].  The file is updated as
+ *  jobs are added, change state and lose processes, so it is up to
+ *  date when ush dies.  A restarted ush takes over (adopts) the jobs
+ *  whose processes are still alive; it watches them with pidfds
+ *  since they are no longer its children.
+ *  Only one ush at a time owns the file (it holds a lock on it);
+ *  others run without one.
+ */
+
+#define STATEMAGIC 0x31687375  /* "ush1" */
+#define STATEPIDS 16           /* pids of a job kept in the file */
+#define STATECMDLEN 256        /* bytes of a cmdline kept in the file */
+
+typedef struct             /* A job in the state file */
+{
+   int jid;                /* 0 if the slot is unused */
+   int state;              /* FG, BG or ST */
+   pid_t pgrp;             /* process group id */
+   int pidCnt;             /* number of entries in pid */
+   pid_t pid[STATEPIDS];   /* the first STATEPIDS pids of the job */
+   unsigned long long start[STATEPIDS];  /* start times of the pids */
+   char cmdline[STATECMDLEN];
+} stateSlotT;
+
+typedef struct             /* The layout of the state file */
+{
+   int magic;              /* STATEMAGIC */
+   int slots;              /* MAXJOBS */
+   stateSlotT slot[MAXJOBS];
+} stateFileT;
+
+int initState();
+int adoptJobs(jobT jobs[MAXJOBS], eventHandler handler);
+void saveJob(jobT * job, int slot);
@@ -0,0 +1,447 @@
+/*
+ *  tokcheck [-c scalar|sse2|avx2] [-n LINES] [-s SEED]
+ *  The differential test of tokenize.  Random command lines are
+ *  split by the strtok parser ush used before tokenize (kept below
+ *  as it was, but for old in front of its names) and by the tokens
+ *  of each classifier (all the CPU supports, or the one given with
+ *  -c or $USH_TOKENIZE) into jobs, commands and arguments; the two
+ *  must agree, and the tokens of every classifier must match those
+ *  of the scalar one.  The old parser split arguments only at
+ *  spaces and kept commands and jobs without words, so it is given
+ *  the line with its blanks turned into spaces and its empty
+ *  commands and jobs are skipped.  Exits 1 if any line differs.
+ */
+#include <ctype.h>
+#include "wrappers.h"
+#include "tokenize.h"
+
+#define LINEMAX 400     /* longest random line, below the old MAXLINE */
+#define SHOWN 10        /* differing lines printed per classifier */
+
+static char * names[] = {"scalar", "sse2", "avx2"};
+//word bytes, with the ones next to the blanks and above 127
+static char wordBytes[] = "abcdefgh-_./{}!\x08\x0e\x1f\x7f\x80\x89\xa0\xe9\xff";
+
+/* The parser before tokenize */
+//it copies lines with strncpy bounded by the size of the copy
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstringop-truncation"
+#define MAXLINE                500  /* max line size */
+#define MAXARGS                10   /* max number of command line args */
+#define MAXJOBSPERCMDLN        10   /* max number of jobs in a command line */
+#define MAXCMDSPERJOB          10   /* max number of commands in a job */
+
+typedef struct
+{
+   char * job;      /* the commands that make up a job: cmd1 23 | cmd2 */
+   int filled;      /* 1 ifthis job entry is filled */
+   int bg;          /* 1 if the job runs in the background */
+} oldJobList;
+
+typedef struct
+{
+   char * cmd;            /* a single command and its arguments */
+   char * args[MAXARGS];  /* the parsed command and its args */
+   int filled;            /* 1 if this cmdlist entry is filled */
+   int pipe;              /* 1 if the output of this command is piped */
+} oldCmdList;
+
+//not needed outside of this file
+static void oldClearJobList(oldJobList joblist[MAXJOBSPERCMDLN]);
+static void oldClearCmdList(oldCmdList cmdlist[MAXCMDSPERJOB]);
+static char * oldTrimWhiteSpace(char * str);
+
+
+/* oldParseIntoCmds
+ * Takes as input a job and parses the job into commands.
+ */
+static void oldParseIntoCmds(char * job, oldCmdList cmdlist[MAXCMDSPERJOB])
+{
+   int i, j, pipe = 0;
+   char input[MAXLINE];
+   char * token;
+
+   //look for pipe at very end
+   if (job[strlen(job) - 1] == '|') pipe = 1;
+
+   oldClearCmdList(cmdlist);
+
+   memset(input, '\0', MAXLINE);
+   strncpy(input, job, MAXLINE);
+   token = strtok(input, "|");
+   i = 0;
+   //commands are separated by | characters
+   while (token != NULL)
+   {
+      token = oldTrimWhiteSpace(token);
+      if (i == MAXCMDSPERJOB) unixError("number of commands exceeded");
+      cmdlist[i].cmd = strdup(token);
+      cmdlist[i].filled = 1;
+      cmdlist[i].pipe = 1;
+      token = strtok(NULL, "|");
+      i++;
+   }
+   if (i >= 1) cmdlist[i-1].pipe = pipe;
+
+   //command arguments are separate by whitespace
+   for (i = 0; cmdlist[i].filled == 1; i++)
+   {
+      memset(input, '\0', MAXLINE);
+      strncpy(input, cmdlist[i].cmd, MAXLINE);
+      token = strtok(input, " ");
+      j = 0;
+      while (token != NULL)
+      {
+         token = oldTrimWhiteSpace(token);
+         if (j == MAXARGS) unixError("number of arguments exceeded");
+         cmdlist[i].args[j] = strdup(token);
+         token = strtok(NULL, " ");
+         j++;
+      }
+   }
+}
+
+/* oldInitCmdList
+ * Initializes the cmdlist array to NULLs and 0s
+ */
+static void oldInitCmdList(oldCmdList cmdlist[MAXJOBSPERCMDLN])
+{
+   int i, j;
+   for (i = 0; i < MAXCMDSPERJOB; i++)
+   {
+      cmdlist[i].cmd = NULL;
+      for (j = 0; j < MAXARGS; j++)
+         cmdlist[i].args[j] = NULL;
+      cmdlist[i].filled = 0;
+      cmdlist[i].pipe = 0;
+   }
+}
+
+/* oldClearCmdList
+ * Clears a cmdList array, freeing the space allocated for
+ * strings.
+ */
+static void oldClearCmdList(oldCmdList cmdlist[MAXJOBSPERCMDLN])
+{
+   int i, j;
+   for (i = 0; i < MAXCMDSPERJOB; i++)
+   {
+      if (cmdlist[i].filled)
+      {
+         free(cmdlist[i].cmd);
+         cmdlist[i].cmd = NULL;
+         for (j = 0; j < MAXARGS; j++)
+            if (cmdlist[i].args[j] != NULL)
+            {
+               free(cmdlist[i].args[j]);
+               cmdlist[i].args[j] = NULL;
+            }
+         cmdlist[i].filled = 0;
+         cmdlist[i].pipe = 0;
+      }
+   }
+}
+
+/* oldTrimWhiteSpace
+ * Removes the white space from the beginning and the
+ * end of a string.
+ */
+static char * oldTrimWhiteSpace(char * str)
+{
+   char * end;
+   char * begin = str;
+   while (*begin == ' ') begin++;
+   end = begin;
+   while (*end != '\0') end++;
+   end--;
+   while (end > begin && isspace(*end))
+   {
+      *end = '\0';
+      end--;
+   }
+   return begin;
+}
+
+/* oldParseIntoJobs
+ * Parses a command line into jobs. Jobs are separated
+ * by &.
+ */
+static void oldParseIntoJobs(char * cmdline, oldJobList joblist[MAXJOBSPERCMDLN])
+{
+   int i = 0, bg = 0;
+   oldClearJobList(joblist);
+   cmdline = oldTrimWhiteSpace(cmdline);
+   if (cmdline[strlen(cmdline) - 1] == '&') bg = 1;
+   char input[MAXLINE];
+   strncpy(input, cmdline, MAXLINE);
+   char * token = strtok(input, "&");
+   while (token != NULL)
+   {
+      token = oldTrimWhiteSpace(token);
+      if (i == MAXJOBSPERCMDLN) unixError("too many jobs in commandline");
+      joblist[i].job = strdup(token);
+      joblist[i].filled = 1;
+      joblist[i].bg = 1;
+      token = strtok(NULL, "&");
+      i++;
+   }
+   if (i > 0) joblist[i-1].bg = bg;
+}
+
+/* oldInitJobList
+ * Initialize a job list to NULLs and 0s
+ */
+static void oldInitJobList(oldJobList joblist[MAXJOBSPERCMDLN])
+{
+   int i;
+   for (i = 0; i < MAXJOBSPERCMDLN; i++)
+   {
+      joblist[i].filled = 0;
+      joblist[i].bg = 0;
+      joblist[i].job = NULL;
+   }
+}
+
+/* oldClearJobList
+ * Clears the job list, freeing the space allocated
+ * for strings.
+ */
+static void oldClearJobList(oldJobList joblist[MAXJOBSPERCMDLN])
+{
+   int i;
+   for (i = 0; i < MAXJOBSPERCMDLN; i++)
+   {
+      if (joblist[i].filled == 1)
+      {
+         free(joblist[i].job);
+         joblist[i].job = NULL;
+      }
+      joblist[i].filled = 0;
+      joblist[i].bg = 0;
+   }
+}
+#pragma GCC diagnostic pop
+/* End of the parser before tokenize */
+
+
+/* append
+ * Appends sep and the len bytes at word to out.
+ */
+static void append(char * out, char * sep, char * word, int len)
+{
+   int n = strlen(out);
+
+   strcpy(out + n, sep);
+   n += strlen(sep);
+   memcpy(out + n, word, len);
+   out[n + len] = '\0';
+}
+
+/* randomLine
+ * Puts a random line of words, blanks, | and & in line.  It is
+ * shorter than LINEMAX and within the old limits on jobs, commands
+ * and arguments.
+ */
+static void randomLine(char * line)
+{
+   int len = 0, words = 0, cmds = 1, jobs = 1, r, n;
+
+   while (len < LINEMAX - 10)
+   {
+      r = rand() % 16;
+      if (r < 9 && words == MAXARGS - 2) r = 12;
+      if (r >= 12 && r < 14 && cmds == MAXCMDSPERJOB - 2) r = 14;
+      if (r == 14 && jobs == MAXJOBSPERCMDLN - 2) r = 15;
+      if (r < 9)
+      {
+         for (n = 1 + rand() % 8; n > 0; n--)
+            line[len++] = wordBytes[rand() % (sizeof(wordBytes) - 1)];
+         words++;
+      }
+      else if (r < 12)
+         for (n = 1 + rand() % 3; n > 0; n--)
+            line[len++] = BLANKS[rand() % (sizeof(BLANKS) - 1)];
+      else if (r < 14)
+      {
+         line[len++] = '|';
+         cmds++;
+         words = 0;
+      }
+      else if (r == 14)
+      {
+         line[len++] = '&';
+         jobs++;
+         cmds = 1;
+         words = 0;
+      }
+      else break;
+   }
+   line[len] = '\0';
+}
+
+/* describeOld
+ * Puts the jobs of line, as the old parser split them, in out:
+ * the words of a command separated by blanks, the commands of a
+ * job by " | ", then " |" if the job ends with a pipe and " &" if
+ * it runs in the background, and the jobs separated by "; ".
+ */
+static void describeOld(char * line, char * out)
+{
+   oldJobList joblist[MAXJOBSPERCMDLN];
+   oldCmdList cmdlist[MAXCMDSPERJOB];
+   char copy[LINEMAX + 1], * p;
+   int i, j, k, cmds, last;
+
+   strcpy(copy, line);
+   for (p = copy; *p != '\0'; p++)
+      if (strchr(BLANKS, *p) != NULL) *p = ' ';
+   out[0] = '\0';
+   if (copy[strspn(copy, " ")] == '\0') return;
+   oldInitJobList(joblist);
+   oldInitCmdList(cmdlist);
+   oldParseIntoJobs(copy, joblist);
+   for (i = 0; i < MAXJOBSPERCMDLN && joblist[i].filled; i++)
+   {
+      //the old parseIntoCmds cannot take an empty job
+      if (joblist[i].job[0] == '\0') continue;
+      oldParseIntoCmds(joblist[i].job, cmdlist);
+      cmds = 0;
+      last = 0;
+      for (j = 0; j < MAXCMDSPERJOB && cmdlist[j].filled; j++)
+      {
+         last = j;
+         for (k = 0; k < MAXARGS && cmdlist[j].args[k] != NULL; k++)
+            append(out, k > 0 ? " " : cmds > 0 ? " | " : out[0] != '\0' ? "; " : "",
+                   cmdlist[j].args[k], strlen(cmdlist[j].args[k]));
+         if (k > 0) cmds++;
+      }
+      if (cmds == 0) continue;
+      if (cmdlist[last].pipe) strcat(out, " |");
+      if (joblist[i].bg) strcat(out, " &");
+   }
+   oldClearCmdList(cmdlist);
+   oldClearJobList(joblist);
+}
+
+/* describeNew
+ * Puts the jobs of line, as its tokens split them, in out the way
+ * describeOld does.
+ */
+static void describeNew(char * line, tokenList * tokens, char * out)
+{
+   int t, cmds = 0, words = 0, last = TOK_WORD;
+   tokenT * tok = tokens->tok;
+
+   out[0] = '\0';
+   for (t = 0; t <= tokens->cnt; t++)
+   {
+      if (t < tokens->cnt && tok[t].type == TOK_WORD)
+      {
+         append(out, words > 0 ? " " : cmds > 0 ? " | " : out[0] != '\0' ? "; " : "",
+                line + tok[t].start, tok[t].len);
+         if (words++ == 0) cmds++;
+      }
+      else if (t < tokens->cnt && tok[t].type == TOK_PIPE) words = 0;
+      else
+      {
+         //the end of a job
+         if (cmds > 0 && last == TOK_PIPE) strcat(out, " |");
+         if (cmds > 0 && t < tokens->cnt) strcat(out, " &");
+         cmds = words = 0;
+      }
+      if (t < tokens->cnt) last = tok[t].type;
+   }
+}
+
+/* show
+ * Prints s in quotes, with the bytes that are not printable
+ * ASCII as \xHH.
+ */
+static void show(char * s)
+{
+   putchar('"');
+   for (; *s != '\0'; s++)
+      if (*s >= ' ' && *s <= '~') putchar(*s);
+      else printf("\\x%02x", (unsigned char) *s);
+   putchar('"');
+}
+
+/* sameTokens
+ * Returns 1 if a and b hold the same tokens.
+ */
+static int sameTokens(tokenList * a, tokenList * b)
+{
+   return a->cnt == b->cnt && memcmp(a->tok, b->tok, a->cnt * sizeof(tokenT)) == 0;
+}
+
+/* check
+ * Runs lines random lines from seed through the old parser and
+ * the classifier name.  Returns the number of lines that differ.
+ */
+static long check(char * name, long lines, unsigned seed)
+{
+   char line[LINEMAX + 1], want[2 * LINEMAX], got[2 * LINEMAX];
+   long i, bad = 0;
+   tokenList tokens, scalar;
+
+   initTokens(&tokens);
+   initTokens(&scalar);
+   srand(seed);
+   for (i = 0; i < lines; i++)
+   {
+      randomLine(line);
+      describeOld(line, want);
+      useClassifier("scalar");
+      tokenize(line, strlen(line), &scalar);
+      useClassifier(name);
+      tokenize(line, strlen(line), &tokens);
+      describeNew(line, &tokens, got);
+      if (strcmp(want, got) == 0 && sameTokens(&tokens, &scalar)) continue;
+      if (bad++ >= SHOWN) continue;
+      printf("%s: line %ld: ", name, i);
+      show(line);
+      printf("\n   strtok   ");
+      show(want);
+      printf("\n   tokenize ");
+      show(got);
+      printf("%s\n", sameTokens(&tokens, &scalar) ? "" : ", tokens differ from scalar");
+   }
+   freeTokens(&tokens);
+   freeTokens(&scalar);
+   printf("%-6s %ld lines, %ld differ\n", name, lines, bad);
+   return bad;
+}
+
+int main(int argc, char ** argv)
+{
+   char * only = getenv("USH_TOKENIZE");
+   long lines = 100000, bad = 0;
+   unsigned seed = 1;
+   int i, opt, ran = 0;
+
+   while ((opt = getopt(argc, argv, "c:n:s:")) != -1)
+   {
+      if (opt == 'c') only = optarg;
+      else if (opt == 'n') lines = atol(optarg);
+      else if (opt == 's') seed = strtoul(optarg, NULL, 0);
+      else
+      {
+         fprintf(stderr, "usage: tokcheck [-c scalar|sse2|avx2] [-n LINES] [-s SEED]\n");
+         return 2;
+      }
+   }
+   if (only != NULL && only[0] == '\0') only = NULL;
+   for (i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++)
+   {
+      if (only != NULL && strcmp(only, names[i]) != 0) continue;
+      ran = 1;
+      if (!useClassifier(names[i])) printf("%-6s not supported by this CPU\n", names[i]);
+      else bad += check(names[i], lines, seed);
+   }
+   if (!ran)
+   {
+      fprintf(stderr, "tokcheck: %s: no such classifier\n", only);
+      return 2;
+   }
+   return bad > 0;
+}
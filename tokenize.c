@@ -0,0 +1,242 @@
+#include <stdint.h>
+#include "wrappers.h"
+#include "tokenize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#define BLOCK 32     /* bytes classified at a time */
+
+/* Byte classes */
+#define CL_WORD  0
+#define CL_BLANK 1
+#define CL_OP    2
+
+/* A classifier sets bit i of special if byte i of the block is
+ * a blank or an operator and bit i of ops if it is an operator.
+ */
+typedef void (*classifier)(const unsigned char * p, uint32_t * special,
+                           uint32_t * ops);
+
+static classifier classify = NULL;
+static unsigned char byteClass[256];
+
+//not needed outside of this file
+static void chooseClassifier();
+static void classifyScalar(const unsigned char * p, uint32_t * special,
+                           uint32_t * ops);
+static void addToken(tokenList * list, int type, int start, int len);
+
+/* initTokens
+ * Initializes an empty token list.
+ */
+void initTokens(tokenList * list)
+{
+   list->tok = list->inlineTok;
+   list->cnt = 0;
+   list->cap = INLINETOKENS;
+}
+
+/* tokenize
+ * Breaks the first len bytes of line into tokens, which are
+ * stored in list (the old contents of list are dropped).
+ * list must have been initialized by initTokens.
+ * Words are separated by blanks (space, \t, \n, \v, \f, \r)
+ * and by the operators | and &.  For example,
+ *
+ * "cmd1 ab|cmd2 &"
+ *
+ * gives WORD(0,4) WORD(5,2) PIPE(7,1) WORD(8,4) AMP(13,1)
+ *
+ * Each block of bytes is classified with a single pass of
+ * vector compares. Word starts, word ends and operators are
+ * then found with a few bit operations on the masks, so the
+ * work per block does not depend on the bytes in it.
+ */
+void tokenize(const char * line, int len, tokenList * list)
+{
+   unsigned char tail[BLOCK];
+   const unsigned char * p;
+   uint32_t special, ops, shifted, starts, ends, bits, bit;
+   uint32_t prev = 1;     //the byte before the line counts as a blank
+   int base, pos, wordStart = 0;
+
+   if (classify == NULL) chooseClassifier();
+   list->cnt = 0;
+   for (base = 0; base < len; base += BLOCK)
+   {
+      p = (const unsigned char *) line + base;
+      if (len - base < BLOCK)
+      {
+         //pad the last block with blanks so no word runs past len
+         memset(tail, ' ', BLOCK);
+         memcpy(tail, p, len - base);
+         p = tail;
+      }
+      classify(p, &special, &ops);
+      shifted = (special << 1) | prev;
+      starts = ~special & shifted;    //word byte after a special byte
+      ends = special & ~shifted;      //special byte after a word byte
+      prev = special >> (BLOCK - 1);
+      bits = starts | ends | ops;
+      while (bits != 0)
+      {
+         pos = __builtin_ctz(bits);
+         bit = 1u << pos;
+         bits &= bits - 1;
+         if (ends & bit)
+            addToken(list, TOK_WORD, wordStart, base + pos - wordStart);
+         if (ops & bit)
+            addToken(list, line[base + pos] == '|' ? TOK_PIPE : TOK_AMP,
+                     base + pos, 1);
+         if (starts & bit) wordStart = base + pos;
+      }
+   }
+   //a word that ends exactly at the end of a full block
+   if (prev == 0) addToken(list, TOK_WORD, wordStart, len - wordStart);
+}
+
+/* freeTokens
+ * Frees the space allocated for the tokens in list and
+ * leaves it empty.
+ */
+void freeTokens(tokenList * list)
+{
+   if (list->tok != list->inlineTok) free(list->tok);
+   initTokens(list);
+}
+
+/* addToken
+ * Appends a token to list.  The list moves from its inline
+ * storage to the heap when it is full and doubles from then on.
+ */
+static void addToken(tokenList * list, int type, int start, int len)
+{
+   tokenT * tok;
+
+   if (list->cnt == list->cap)
+   {
+      list->cap *= 2;
+      if (list->tok == list->inlineTok)
+      {
+         tok = Malloc(list->cap * sizeof(tokenT));
+         memcpy(tok, list->inlineTok, sizeof(list->inlineTok));
+      }
+      else tok = realloc(list->tok, list->cap * sizeof(tokenT));
+      if (tok == NULL) unixError("realloc error");
+      list->tok = tok;
+   }
+   list->tok[list->cnt].type = type;
+   list->tok[list->cnt].start = start;
+   list->tok[list->cnt].len = len;
+   list->cnt++;
+}
+
+/* classifyScalar
+ * Classifies a block one byte at a time with a lookup table.
+ * Used when the CPU has no usable vector instructions.
+ */
+static void classifyScalar(const unsigned char * p, uint32_t * special,
+                           uint32_t * ops)
+{
+   int i;
+   uint32_t s = 0, o = 0;
+
+   for (i = 0; i < BLOCK; i++)
+   {
+      s |= (uint32_t) (byteClass[p[i]] != CL_WORD) << i;
+      o |= (uint32_t) (byteClass[p[i]] == CL_OP) << i;
+   }
+   *special = s;
+   *ops = o;
+}
+
+#ifdef HAVE_X86
+/* classifySse2
+ * Classifies a block 16 bytes at a time.  The blanks \t - \r are
+ * found with one unsigned range compare: x - 9 <= 4.
+ */
+__attribute__((target("sse2")))
+static void classifySse2(const unsigned char * p, uint32_t * special,
+                         uint32_t * ops)
+{
+   int h;
+   uint32_t s = 0, o = 0;
+   __m128i x, blank, op;
+
+   for (h = 0; h < BLOCK; h += 16)
+   {
+      x = _mm_loadu_si128((const __m128i *) (p + h));
+      blank = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+      blank = _mm_cmpeq_epi8(_mm_min_epu8(blank, _mm_set1_epi8(4)), blank);
+      blank = _mm_or_si128(blank, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+      op = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('|')),
+                        _mm_cmpeq_epi8(x, _mm_set1_epi8('&')));
+      s |= (uint32_t) _mm_movemask_epi8(_mm_or_si128(blank, op)) << h;
+      o |= (uint32_t) _mm_movemask_epi8(op) << h;
+   }
+   *special = s;
+   *ops = o;
+}
+
+/* classifyAvx2
+ * Classifies a whole block at once.
+ */
+__attribute__((target("avx2")))
+static void classifyAvx2(const unsigned char * p, uint32_t * special,
+                         uint32_t * ops)
+{
+   __m256i x, blank, op;
+
+   x = _mm256_loadu_si256((const __m256i *) p);
+   blank = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+   blank = _mm256_cmpeq_epi8(_mm256_min_epu8(blank, _mm256_set1_epi8(4)),
+                             blank);
+   blank = _mm256_or_si256(blank, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+   op = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('|')),
+                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('&')));
+   *special = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(blank, op));
+   *ops = (uint32_t) _mm256_movemask_epi8(op);
+}
+#endif
+
+/* chooseClassifier
+ * Picks the fastest classifier the CPU supports, or the one named
+ * by $USH_TOKENIZE (see useClassifier) if the CPU supports it.
+ */
+static void chooseClassifier()
+{
+   const char * blanks = " \t\n\v\f\r", * name = getenv("USH_TOKENIZE");
+
+   while (*blanks != '\0') byteClass[(unsigned char) *blanks++] = CL_BLANK;
+   byteClass['|'] = CL_OP;
+   byteClass['&'] = CL_OP;
+   classify = classifyScalar;
+#ifdef HAVE_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("sse2")) classify = classifySse2;
+   if (__builtin_cpu_supports("avx2")) classify = classifyAvx2;
+#endif
+   if (name != NULL && name[0] != '\0') useClassifier(name);
+}
+
+/* useClassifier
+ * Makes tokenize classify bytes with name: scalar, sse2 or avx2.
+ * Returns 0, leaving the classifier as it was, if there is no
+ * such classifier or the CPU does not support it.
+ */
+int useClassifier(const char * name)
+{
+   if (classify == NULL) chooseClassifier();
+   if (strcmp(name, "scalar") == 0) classify = classifyScalar;
+#ifdef HAVE_X86
+   else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+      classify = classifySse2;
+   else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+      classify = classifyAvx2;
+#endif
+   else return 0;
+   return 1;
+}
@@ -0,0 +1,34 @@
+/*
+ *  The command line tokenizer.  A command line is broken into
+ *  words and the operators | and & in a single pass.  Bytes are
+ *  classified 32 at a time, with AVX2 or SSE2 when the CPU has
+ *  them and with a lookup table otherwise; $USH_TOKENIZE (scalar,
+ *  sse2 or avx2) or useClassifier picks one instead.  tokcheck
+ *  compares each of them with the strtok parser ush used before.
+ */
+
+/* Token types */
+#define TOK_WORD 0   /* a run of non-blank, non-operator bytes */
+#define TOK_PIPE 1   /* | */
+#define TOK_AMP  2   /* & */
+#define INLINETOKENS 64  /* tokens stored in the tokenList itself */
+
+typedef struct             /* A token of the command line */
+{
+   int type;               /* TOK_WORD, TOK_PIPE or TOK_AMP */
+   int start;              /* offset of the first byte */
+   int len;                /* number of bytes */
+} tokenT;
+
+typedef struct             /* The tokens of a command line */
+{
+   tokenT * tok;           /* inlineTok or the heap */
+   int cnt;                /* number of tokens */
+   int cap;                /* number of tokens tok can hold */
+   tokenT inlineTok[INLINETOKENS];
+} tokenList;
+
+void initTokens(tokenList * list);
+void tokenize(const char * line, int len, tokenList * list);
+void freeTokens(tokenList * list);
+int useClassifier(const char * name);
@@ -1,54 +1,254 @@
 
+#include <fcntl.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
 #include "wrappers.h"
 #include "parser.h"
 #include "jobs.h"
+#include "policy.h"
+#include "events.h"
+#include "env.h"
+#include "state.h"
+#include "output.h"
+#include "pstat.h"
+#include "memo.h"
+#include "signals.h"
+#include "schedule.h"
+#include "dag.h"
+#include "record.h"
+#include "pipepart.h"
+#include "prefetch.h"
+#include "inproc.h"
+#include "coproc.h"
+#include "runtime.h"
+#include "pressure.h"
+
+#define INPUTCHUNK 65536      /* least free space for a read of stdin */
+#define MAXARGSTRLEN 131072   /* longest exec string (MAX_ARG_STRLEN) */
 
 jobT jobs[MAXJOBS];     /* The job list */ 
+int sigPipe[2];         /* written to by the signal handlers */
+char * input = NULL;    /* characters read from stdin */
+int inputStart = 0;     /* offset of the first unused character */
+int inputLen = 0;       /* offset just past the last character */
+int inputCap = 0;       /* size of input */
+int inputScanned = 0;   /* input[inputStart..inputScanned) has no newline */
+int inputEOF = 0;       /* 1 once stdin is closed */
+int fgStatus = 0;       /* wait status of the last foreground job */
+int fgPolicy = 0;       /* 1 while runJob starts a BG job with the FG policy */
 
 void waitfg();
 void sigchildHandler(int sig);
 void sigintHandler(int sig);
+void sigpipeHandler(int sig);
 void evalCmdLine(char *cmdline);
-void evalJob(char * job, int bg);
+int evalJob(char * job, int bg);
+int runJob(char * job, int bg, int jid, int inFd, int outFd, int * status);
+int runPart(char * cmdline, int inFd, int outFd);
+int runCoproc(char * cmdline, int inFd, int outFd);
+int runScheduled(char * cmdline);
+int runTask(char * cmdline, int * status);
+int evalStatus(char * cmdline);
+int runCaptured(char * job, int outFd);
 int builtin(char * job); 
+int runBuiltin(char ** args);
+void continueJob(char * arg, int state);
+void jobsCmd(char ** args);
+void reapChildren();
+void startQueuedJobs();
 
 /**HELPER METHODS**/
-void closeAllOthers(int i, int cmdCnt, int fds[cmdCnt - 1][2]);
+void readInput(int fd, short revents, void * arg);
+void readSignals(int fd, short revents, void * arg);
+void reapAdopted(int fd, short revents, void * arg);
+char * nextLine();
+int watchWait(int ms, int watch);
+int argsTooLong(cmdArray * cmdlist);
+void execCommand(char ** args, char ** envp);
+int isBuiltinName(char * name);
+
+/* commands handled by runBuiltin */
+const char * builtinNames[] = {"quit", "jobs", "fg", "bg", "joblimit",
+                               "policy", "kill", "export", "unset",
+                               "output", "pstat", "schedule", "dag",
+                               "prefetch", "throttle", NULL};
 
 /* The main drives the shell process.  Basically a shell reads
  * input, handles the input by executing a command in the foreground
- * or background, and repeats. 
+ * or background, and repeats.  Input and terminated children
+ * are handled by the event loop (see events.c).
+ * With --record file the session is logged to file; with --replay
+ * file [--speed X|--max] a logged session is run instead of reading
+ * input (see record.c).
  */
-int main()
+int main(int argc, char ** argv)
 {
-    char commandline[MAXLINE];
-    int bytes;
+    char * commandline;
+    char * record = NULL, * replay = NULL;
+    double speed = 1;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) record = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) replay = argv[++i];
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) speed = atof(argv[++i]);
+        else if (strcmp(argv[i], "--max") == 0) speed = 0;
+        else break;
+    }
+    if (i < argc || (record != NULL && replay != NULL) || speed < 0) {
+        fprintf(stderr, "usage: ush [--record file | --replay file [--speed X | --max]]\n");
+        exit(1);
+    }
 
-    /* initialize the job list */
+    /* initialize the job list and the variables */
     initJobs(jobs);
+    initEnv();
+    initPolicies();
+    initSchedule(jobs, runScheduled);
+    initPrefetch();
+    initRuntimes();
+    initPressure(jobs);
+
+    /* The signal handlers only wake up the event loop through
+     * sigPipe; children are reaped by readSignals.
+     */
+    Pipe(sigPipe);
+    fcntl(sigPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(sigPipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(sigPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sigPipe[1], F_SETFD, FD_CLOEXEC);
+    addEvent(sigPipe[0], POLLIN, readSignals, NULL);
+    addEvent(0, POLLIN, readInput, NULL);
+
+    /* Orphaned processes of our jobs (like the children of a
+     * pipeline stage that exited) are reparented to ush and reaped
+     * by reapChildren.  Jobs of an earlier ush that died are taken
+     * over from the state file (see state.c).
+     */
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+    if (replay == NULL && initState() && adoptJobs(jobs, reapAdopted) > 0)
+        listJobs(jobs);
 
     /* These are the ones you will need to implement */
     Signal(SIGINT,  sigintHandler);    /* ctrl-c entered at ush prompt*/
     Signal(SIGCHLD, sigchildHandler);  /* Terminated child */
+    Signal(SIGPIPE, sigpipeHandler);   /* Write to a closed pipe */
+
+    //a replay takes the place of the input
+    if (replay != NULL) {
+        removeEvent(0);
+        exit(replaySession(replay, speed, evalStatus, watchWait, jobs));
+    }
+    if (record != NULL && !recordOpen(record)) exit(1);
 
     printf("ush> ");
     fflush(NULL);  //flush prompt
+    prefetchIdle(1);
 
-    bytes = read(0, commandline, MAXLINE - 1);
-    if (bytes > 0) commandline[bytes - 1] = '\0'; 
     while (1) //quit in builtin
     {
-        //if the number of bytes is 1 then the
-        //user simply entered a newline
-        if (bytes > 1) evalCmdLine(commandline);
-        printf("ush> ");
-        fflush(NULL);
-        bytes = read(0, commandline, MAXLINE - 1);
-        if (bytes > 0) commandline[bytes - 1] = '\0'; 
+        if ((commandline = nextLine()) != NULL)
+        {
+            prefetchIdle(0);
+            //an empty line means the user simply entered a newline
+            if (commandline[0] != '\0') {
+                if (record != NULL) recordLine(commandline, evalStatus);
+                else evalCmdLine(commandline);
+            }
+            free(commandline);
+            printf("ush> ");
+            fflush(NULL);
+            prefetchIdle(1);
+        } 
+        else if (inputEOF) exit(0);
+        else runEvents(-1);
     }
     return 0;
 }      
 
+/* readInput
+ * Event handler for stdin. Appends what can be read to the
+ * input buffer, which grows as needed; nextLine takes complete
+ * lines out of it. Input typed while a foreground job runs is 
+ * kept until the job is done.
+ */
+void readInput(int fd, short revents, void * arg)
+{
+    int bytes;
+
+    //move the unused input to the front before growing the buffer
+    if (inputStart > 0 && inputCap - inputLen < INPUTCHUNK) {
+        memmove(input, &input[inputStart], inputLen - inputStart);
+        inputLen -= inputStart;
+        inputScanned -= inputStart;
+        inputStart = 0;
+    }
+    if (inputCap - inputLen < INPUTCHUNK) {
+        inputCap = inputCap ? inputCap * 2 : INPUTCHUNK;
+        input = realloc(input, inputCap);
+        if (input == NULL) unixError("realloc error");
+    }
+    bytes = read(fd, &input[inputLen], inputCap - inputLen);
+    if (bytes > 0) inputLen += bytes;
+    else if (bytes == 0 || errno != EINTR) {
+        inputEOF = 1;
+        removeEvent(fd);
+    }
+}
+
+/* nextLine
+ * Returns the next complete line of input, without the newline,
+ * or NULL if there is none yet.  A last line without a newline
+ * is returned once stdin is closed.  The caller frees the line.
+ * Only the bytes that arrived since the last call are searched
+ * for a newline, so a long line costs time linear in its length.
+ */
+char * nextLine()
+{
+    char * nl, * line;
+    int len;
+
+    nl = memchr(&input[inputScanned], '\n', inputLen - inputScanned);
+    if (nl != NULL) len = nl - &input[inputStart];
+    else if (inputEOF && inputLen > inputStart) len = inputLen - inputStart;
+    else {
+        inputScanned = inputLen;
+        return NULL;
+    }
+    line = Malloc(len + 1);
+    memcpy(line, &input[inputStart], len);
+    line[len] = '\0';
+    inputStart += len;
+    if (inputStart < inputLen) inputStart++;     //skip the newline
+    inputScanned = inputStart;
+    return line;
+}
+
+/* watchWait
+ * Runs the event loop for ms milliseconds, for builtins that
+ * sample or watch something.  If watch is 1, returns 0 as soon
+ * as a line of input is waiting (or stdin is closed), which
+ * ends the watch.  Returns 1 otherwise.
+ */
+int watchWait(int ms, int watch)
+{
+    struct timespec start, now;
+    int left = ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        if (watch && (inputEOF || memchr(&input[inputStart], '\n', 
+                                         inputLen - inputStart) != NULL))
+            return 0;
+        if (left > 0) runEvents(left);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = ms - (now.tv_sec - start.tv_sec) * 1000 
+                  - (now.tv_nsec - start.tv_nsec) / 1000000;
+    } while (left > 0);
+    return 1;
+}
+
 /* evalCmdLine
  * Takes as input a command line. Calls the parseIntoJobs
  * function to break the command line into jobs.
@@ -59,46 +259,114 @@ int main()
 void evalCmdLine(char * cmdline)
 {
     int i;
-    jobList joblist[MAXJOBSPERCMDLN];
+    jobArray joblist;
 
     //Parse the command line into jobs
-    initJobList(joblist);
-    parseIntoJobs(cmdline, joblist);
+    initJobList(&joblist);
+    parseIntoJobs(cmdline, &joblist);
 
-    i = 0;
-    while (joblist[i].filled == 1)
+    for (i = 0; i < joblist.cnt; i++)
     {
         //if the job starts with a built-in command like quit then
         //don't evaluate it (builtin will evaluate it)
-        if (!builtin(joblist[i].job))
+        if (!builtin(joblist.job[i].job))
         {
-            evalJob(joblist[i].job, joblist[i].bg);
+            evalJob(joblist.job[i].job, joblist.job[i].bg);
         }
-        i++;
     }
+    clearJobList(&joblist);
     return;
 }
 
+/* evalStatus
+ * Evaluates cmdline (for record.c).  Returns the wait status of
+ * its last foreground job, or -1 if it ran none.
+ */
+int evalStatus(char * cmdline)
+{
+    fgStatus = -1;
+    evalCmdLine(cmdline);
+    return fgStatus;
+}
+
 /******* You need to write these functions *********/
 /* evalJob
+ * This function takes a job and decides whether it can run
+ * now.  Foreground jobs always run.  A background job runs
+ * if fewer than getJobLimit() background jobs are running;
+ * otherwise it is queued and started by startQueuedJobs
+ * once enough running jobs have been reaped.
+ * One entry of the jobs array is always kept free for a 
+ * foreground job.  Returns the jid of the job, or 0 if it
+ * did not start.
+ */
+int evalJob(char * job, int bg)
+{
+    int jid;
+    if (!bg && freeJobs(jobs) == 0) {
+        printf("Tried to create too many jobs\n");
+        return 0;
+    }
+    if (bg && (queueLength() > 0 || bgJobCount(jobs) >= getJobLimit() 
+               || freeJobs(jobs) <= 1)) {
+        jid = queueJob(job, jobs);
+        printf("[%d] queued\n", jid);
+        return jid;
+    }
+    return runJob(job, bg, 0, -1, -1, NULL);
+}
+
+/* runJob
  * This function takes a job, which may consist of a set of
  * commands separated by pipes. Each command is executed
  * by a new process.  A single job is created and added
  * to the joblist. The set of pids associated with the job
- * are stored in the job entry.
+ * are stored in the job entry.  The job gets the given jid,
+ * or a new one if jid is 0.  If outFd is not -1 the output of
+ * the last command goes to it.  If inFd is not -1 the first
+ * command reads it, and a foreground job is not waited for:
+ * the caller feeds it and runs the event loop (see pipepart.c).
+ * Assignments in front of a command (VAR=value cmd) only go
+ * into the environment of that command: it is given an overlay
+ * of the shell's envp block (see envOverlay in env.c), made
+ * before the fork.
+ * Trivial commands like echo are not forked (see inproc.c): the
+ * last command runs in ush once the others have started, and the
+ * others in threads.  The job is made of the forked processes
+ * only (its stage map has their places in the pipeline); if the
+ * last command ran in ush the job has its status.  The last
+ * command is forked after all if ush itself drains its output
+ * (a muxed job, or a pipe as outFd), since writing that from
+ * the main thread would fill the pipe with nobody reading it.
+ * A job of trivial commands alone is over by the time runJob
+ * returns: there is no job, and its wait status goes in status
+ * (if status is not NULL; it is -1 otherwise) and, for a
+ * foreground job, in fgStatus.  Returns the jid, or 0 if there
+ * is no job.
  */
-
-void evalJob(char * job, int bg)
+int runJob(char * job, int bg, int jid, int inFd, int outFd, int * status)
 {
-    int pids[MAXPIDS] = {0};
+    pid_t * pids;
     int cmdCnt;
     //parse the job into commands
     //see parseIntoCmds documentation in parser.c
-    cmdList cmdlist[MAXCMDSPERJOB];
-    initCmdList(cmdlist);
-    parseIntoCmds(job, cmdlist);
+    cmdArray cmdlist;
+    initCmdList(&cmdlist);
+    parseIntoCmds(job, &cmdlist);
+    if (status != NULL) *status = -1;
     //get the number of commands
-    cmdCnt = getCmdCount(cmdlist);
+    cmdCnt = getCmdCount(&cmdlist);
+    expandCmdList(&cmdlist);
+    if (cmdCnt == 0 || argsTooLong(&cmdlist)) {
+        clearCmdList(&cmdlist);
+        return 0;
+    }
+    pids = Malloc(cmdCnt * sizeof(pid_t));
+    int * stages = Malloc(cmdCnt * sizeof(int));
+    int procCnt = 0;                 /* commands forked so far */
+    int inproc = 0;                  /* commands run in ush */
+    char ** last = NULL;             /* args of a last command run in ush */
+    int lastStatus = 0;
     /* You'll need to execute a Fork and an Execvp for
      * each command.  Before creating any children, block the 
      * SIGINT and SIGCHLD signals.  This will allow you to 
@@ -109,85 +377,168 @@ void evalJob(char * job, int bg)
       Sigemptyset(&mask);
       Sigaddset(&mask, SIGINT);
       Sigprocmask(SIG_BLOCK, &mask, &prev_mask); **/
-    int i,j;
-    int fd[cmdCnt - 1][2];
-    if(cmdCnt > 1){
-        for(j = 0; j < cmdCnt ; j ++){
-            pipe(fd[j]); 
-        }
+    int i,assigns;
+    char ** envp;
+    int out[2];
+    /* The pipes are made one stage at a time, so ush holds at most
+     * the read end of the last pipe and the next pipe, and are
+     * close on exec, so a stage only dup2s its own two ends and
+     * every other pipe fd is gone once it execs.  That keeps the
+     * setup of an N stage pipeline O(N).
+     */
+    int in = -1, fd[2];
+    for (i = 0; i < cmdCnt; i++) {
+        char ** args = cmdlist.cmd[i].args;
+        for (assigns = 0; args[assigns] != NULL && isAssignment(args[assigns]);
+             assigns++);
+        if (args[assigns] != NULL && isInprocName(args[assigns])) inproc++;
     }
+    //a background job may get its own output pipe (see output.c)
+    int muxed = bg && inproc < cmdCnt && openOutput(out);
+    int errFd = muxed ? out[1] : 2;
+    struct stat st;
+    int drained = muxed ||
+        (outFd >= 0 && fstat(outFd, &st) == 0 && S_ISFIFO(st.st_mode));
+    fflush(NULL); //don't let the children inherit buffered output
     for (i = 0; i <  cmdCnt; i ++) {
+        char ** args = cmdlist.cmd[i].args;
+        for (assigns = 0; args[assigns] != NULL && isAssignment(args[assigns]);
+             assigns++);
+        args += assigns;
+        if (i < cmdCnt - 1) Pipe2(fd, O_CLOEXEC);
+        if (args[0] != NULL && isInprocName(args[0]) &&
+            (i < cmdCnt - 1 || !drained)) {
+            //none of them reads its input, so in is just closed
+            if (i < cmdCnt - 1) startInproc(args, fd[1], errFd);
+            else last = args;
+            if (in >= 0) close(in);
+            if (i < cmdCnt - 1) {
+                close(fd[1]);
+                in = fd[0];
+            }
+            continue;
+        }
+        envp = assigns > 0 ? envOverlay(args - assigns, assigns) : envBlock();
+        //see whether the command starts cold before it execs
+        int probe = args[0] != NULL && isInprocName(args[0]) ?
+                    -1 : probeExec(args[0]);
         int pid = Fork();
         if (pid == 0) {
-            if(i == 0) setpgid(0,0);
+            if(procCnt == 0) setpgid(0,0);
             else setpgid(0,pids[0]);
-            char buffer[50];
-            if(!cmdlist[i].args[0][0] == '.' 
-                    && !cmdlist[i].args[0][1] == '/'){ 
-                strcpy(buffer, "/bin/");}
-            strcat(buffer,cmdlist[i].args[0]);
-            if(cmdCnt > 1){     
-                if(i == 0){
-                    closeAllOthers(i,cmdCnt,fd);
-                    close(fd[i][0]); //close read end
-                    dup2(fd[i][1],1); //fd 1 now points to file of fd[i][1], ie, fd 3
-                    close(fd[i][1]); //close fd 3 since 1 points to the same location anyway
-                    Execvp(buffer, cmdlist[i].args);
-                    exit(0);
-                }
-                else if (i == cmdCnt - 1){
-                    closeAllOthers(i - 1, cmdCnt, fd); 
-                    dup2(fd[i-1][0],0);
-                    close(fd[i-1][1]);
-                    close(fd[i-1][0]); 
-                    Execvp(buffer, cmdlist[i].args);
-                    exit(0);
-                }
-                else 
-                {
-                    int j;
-
-                    for(j = 0; j < cmdCnt; j ++){
-                        if(j != i && j != i - 1){
-                            close(fd[j][0]);
-                            close(fd[j][1]);
-                        }
-                    }
-                    dup2(fd[i-1][0],0);
-                    dup2(fd[i][1],1);
-                    close(fd[i-1][0]);
-                    close(fd[i-1][1]);
-                    close(fd[i][1]);
-                    close(fd[i][0]);
-                    Execvp(buffer, cmdlist[i].args);
-                    exit(0);
-                }
-
+            applyPolicy(0, bg == 0 || fgPolicy ? FG : BG);
+            if (muxed) {
+                dup2(out[1], 2);
+                if (i == cmdCnt - 1) dup2(out[1], 1);
             }
-
-            Execvp(buffer, cmdlist[i].args); 
-            exit(0);
+            if (outFd >= 0 && i == cmdCnt - 1) dup2(outFd, 1);
+            if (inFd >= 0 && i == 0) dup2(inFd, 0);
+            //dup2 clears close on exec on 0 and 1 only
+            if (in >= 0) dup2(in, 0);
+            if (i < cmdCnt - 1) dup2(fd[1], 1);
+            execCommand(args, envp);
         }
 
-        pids[i] = pid;
+        if (assigns > 0) free(envp);
+        stages[procCnt] = i;
+        pids[procCnt++] = pid;
+        probeStarted(probe, pid);
+        if (in >= 0) close(in);
+        if (i < cmdCnt - 1) {
+            close(fd[1]);
+            in = fd[0];
+        }
     }
 
     //Sigprocmask(SIG_SETMASK, &prev_mask, NULL);
-    if(cmdCnt > 1){
-        for(j = 0; j < cmdCnt ; j ++){
-            close(fd[j][0]); 
-            close(fd[j][1]);
-        }
+    if (last != NULL) {
+        //cd by itself in the foreground is the only one that changes ush
+        int out1 = outFd >= 0 ? outFd : muxed ? out[1] : 1;
+        lastStatus = runInproc(last, out1, errFd, bg || cmdCnt > 1);
+    }
+    if (procCnt == 0) {
+        if (status != NULL) *status = lastStatus;
+        if (!bg) fgStatus = lastStatus;
+        free(pids);
+        free(stages);
+        clearCmdList(&cmdlist);
+        return 0;
     }
     int state;
     state = bg == 0 ? FG : BG;
-    int  lastProcess  =  pids[cmdCnt - 1];
-    addJob(pids, pids[0], state, job, jobs);
-    int jid = pid2jid(pids[0],jobs);
+    int  lastProcess  =  pids[procCnt - 1];
+    addJob(pids, procCnt, pids[0], state, jid, job, jobs);
+    jid = pid2jid(pids[0],jobs);
+    if (last != NULL) getJobJid(jid, jobs)->status = lastStatus;
+    if (procCnt < cmdCnt) getJobJid(jid, jobs)->stage = stages;
+    else free(stages);
+    if (muxed) {
+        close(out[1]);
+        addOutput(out[0], jid);
+    }
+    free(pids);
+    clearCmdList(&cmdlist);
     if(bg == 1){
         printf("[%d] %d\n", jid, lastProcess);
-        return;    
-    } waitfg();
+        return jid;    
+    }
+    if (inFd < 0) waitfg();
+    return jid;
+}
+
+/* argsTooLong
+ * Returns 1 (after printing a message) if the args of a command
+ * in cmdlist do not fit in what the kernel accepts for an exec:
+ * ARG_MAX bytes for all args and environment strings and their
+ * pointers, and MAX_ARG_STRLEN bytes for a single string.
+ */
+int argsTooLong(cmdArray * cmdlist)
+{
+    long argMax = sysconf(_SC_ARG_MAX);
+    long envSize = envBytes(), size, len;
+    int i, j;
+
+    for (i = 0; i < cmdlist->cnt; i++) {
+        size = envSize;
+        for (j = 0; j < cmdlist->cmd[i].argc; j++) {
+            len = strlen(cmdlist->cmd[i].args[j]) + 1;
+            if (len > MAXARGSTRLEN) break;
+            size += len + sizeof(char *);
+        }
+        if (j < cmdlist->cmd[i].argc || (argMax > 0 && size > argMax)) {
+            printf("%s: argument list too long\n", cmdlist->cmd[i].args[0]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* execCommand
+ * Executes the command in args in the calling (child) process
+ * with the environment envp.  The command is looked up in PATH.
+ * If the exec fails, prints why and exits with status 127.
+ * A command made up of assignments only has nothing to run, and
+ * one run in ush (see runJob) is run by runInproc instead, with
+ * the signals of ush back at their defaults so it ends like a
+ * command that exec'd.
+ */
+void execCommand(char ** args, char ** envp)
+{
+    extern char ** environ;
+
+    if (args[0] == NULL) _exit(0);
+    if (isInprocName(args[0])) {
+        Signal(SIGINT, SIG_DFL);
+        Signal(SIGCHLD, SIG_DFL);
+        Signal(SIGPIPE, SIG_DFL);
+        int status = runInproc(args, 1, 2, 1);
+        if (WIFSIGNALED(status)) raise(WTERMSIG(status));
+        _exit(WEXITSTATUS(status));
+    }
+    environ = envp;
+    Execvp(args[0], args);
+    fprintf(stderr, "%s: %s\n", args[0], strerror(errno));
+    _exit(127);
 }
 
 
@@ -198,63 +549,334 @@ void evalJob(char * job, int bg)
  * and 0 otherwise. Should handle:
  * quit - exits shell
  * jobs - lists the jobs (calls listJobs)
- * kill - handles SIGKILL (-9) and SIGINT (-2) only
- *      - can provide a job number preceded by a %,
- *        a group pid preceded by a - or a pid
+ *      - jobs -l [-s cpu|mem] [--watch] lists their processes
+ * kill - sends a signal (SIGTERM by default) by number or name
+ *      - can provide a job number preceded by a %, a range of
+ *        them, %all, %bg, %stopped, a group pid preceded by a -
+ *        or a pid (see signals.c); kill -l lists the signals
  *        kill -9 12345
- *        kill -2 %1
- *        kill -2 -12345
+ *        kill -INT %1
+ *        kill -s TERM %2-5 -12345
+ * fg - continues a job in the foreground: fg %1
+ * bg - continues a job in the background: bg %1
+ * policy - shows or sets the FG and BG scheduling policies
+ * joblimit - shows or sets the number of background jobs 
+ *        that may run at once: joblimit 4
+ * export - exports variables: export NAME=value NAME
+ *        with no args lists the environment
+ * unset - removes variables: unset NAME
+ * output - shows or sets how background jobs output: output mux
+ * pstat - shows the throughput of the stages of a job: pstat %1
+ * NAME=value ... - sets shell variables
+ * memo - runs a job or replays its output: memo sort file
+ *        (see memo.c)
+ * every, at - run a job later: every 5s date, at +10m make
+ * schedule - lists or cancels them: schedule cancel 2
+ *        (see schedule.c)
+ * dag - runs the tasks of a spec in dependency order: dag -j 4 build.dag
+ *        (see dag.c)
+ * pipepart - runs copies of a filter over the parts of a file:
+ *        pipepart --merge sort < words sort (see pipepart.c)
+ * prefetch - shows the cold and warm run times of commands or
+ *        reads them ahead: prefetch now (see prefetch.c)
+ * throttle - stops background jobs while the system is under
+ *        pressure: throttle memory 20 (see pressure.c)
+ * coproc - starts a command that answers queries: coproc py python3 -u
+ *        NAME <<< query - writes a query to one: py <<< 6*7
+ *        (see coproc.c)
+ * echo, true, false, pwd, cd, test, [ and printf are not forked
+ *        either, but they are run by runJob (see inproc.c)
+ * The args are only expanded (see expandCmdList) for builtin
+ * commands and assignments; other jobs are expanded by runJob.
  */
 int builtin(char * job) 
 {
     //Parse the job into commands
-    cmdList cmdlist[MAXCMDSPERJOB];
-    initCmdList(cmdlist);
-    parseIntoCmds(job, cmdlist);
-    int i;
-    for(i = 0; i < MAXCMDSPERJOB; i ++) {
-        if (strcmp(cmdlist[i].args[0],"quit") == 0 ) {
-            exit(0);
-            return 1;
+    cmdArray cmdlist;
+    int found = 1;
+    char ** args;
+    initCmdList(&cmdlist);
+    parseIntoCmds(job, &cmdlist);
+    //a job without commands, like "|", has nothing to run
+    if (getCmdCount(&cmdlist) > 0) {
+        args = cmdlist.cmd[0].args;
+        if (strstr(job, "<<<") != NULL && isCoprocQuery(job, jobs)) {
+            //the query goes to the coprocess as typed
+            fgStatus = coprocQuery(job, jobs);
         }
-        if (strcmp(cmdlist[i].args[0],"jobs") == 0) {
-            listJobs(jobs);
-            return 1;
+        else if (strcmp(args[0], "memo") == 0) {
+            //memo needs the job as typed, not expanded
+            int status = memoJob(job, runCaptured);
+            if (status >= 0) fgStatus = status;
+        }
+        else if (strcmp(args[0], "pipepart") == 0) {
+            //and so is the cmdline pipepart runs copies of
+            pipepartCmd(job, runPart, jobs);
         }
-        if (strcmp(cmdlist[i].args[0], "kill") == 0) { 
-                int signal,pid;
-                if(strcmp(cmdlist[i].args[0], "-9") == 0){
-                    signal = SIGKILL;
-                }
-                else signal = SIGINT;
-
-                if(cmdlist[i].args[2][0] == '%'){
-                    int j;
-                    int jid = atoi(&cmdlist[i].args[2][1]);
-                    jobT* job = getJobJid(jid, jobs); 
-                    for(j = 0; j < MAXPIDS; j ++){
-                        if(job->pid[j] != 0) kill(job->pid[j],signal);
-                    }
-                    return 1;
-                }
-                if(cmdlist[i].args[2][0] == '-') pid = atoi(&cmdlist[i].args[2][1]);
-                else pid = atoi(&cmdlist[i].args[2][0]);
-                kill(pid,signal);
-                return 1;
+        else if (strcmp(args[0], "coproc") == 0) {
+            //and so is the cmdline of a coprocess
+            coprocCmd(job, runCoproc, jobs);
         }
+        else if (isScheduleCmd(args[0])) {
+            //so is the job every and at run later
+            scheduleJob(job);
+        }
+        else if (isBuiltinName(args[0]) || isAssignment(args[0])) {
+            expandCmdList(&cmdlist);
+            found = runBuiltin(cmdlist.cmd[0].args);
+        }
+        else found = 0;
+    }
+    clearCmdList(&cmdlist);
+    return found;
+}
+
+/* runCaptured
+ * Runs job in the foreground with the output of its last command
+ * going to outFd (for memoJob).  Returns the wait status of that
+ * command, or -1 if the job did not terminate.
+ */
+int runCaptured(char * job, int outFd)
+{
+    if (freeJobs(jobs) == 0) {
+        printf("Tried to create too many jobs\n");
+        return -1;
+    }
+    fgStatus = -1;
+    runJob(job, 0, 0, -1, outFd, NULL);
+    return fgStatus;
+}
+
+/* runPart
+ * Starts cmdline in the foreground reading inFd and writing
+ * outFd, without waiting for it (for pipepartCmd), so all the
+ * copies pipepart starts run at once and Ctrl-C stops them all.
+ * Returns its jid, or 0 if it did not start.
+ */
+int runPart(char * cmdline, int inFd, int outFd)
+{
+    return runJob(cmdline, 0, 0, inFd, outFd, NULL);
+}
+
+/* runCoproc
+ * Starts the cmdline of a coprocess (see coproc.c) as a
+ * background job reading inFd and writing outFd.  Since queries
+ * wait on it, its processes get the FG scheduling policy and it
+ * is never throttled (see pressure.c).  Returns its jid, 0 if it
+ * did not start or -1 if it ran in ush (see inproc.c) and is
+ * over already.
+ */
+int runCoproc(char * cmdline, int inFd, int outFd)
+{
+    int jid, status;
+    if (freeJobs(jobs) == 0) {
+        printf("Tried to create too many jobs\n");
         return 0;
     }
+    fgPolicy = 1;
+    jid = runJob(cmdline, 1, 0, inFd, outFd, &status);
+    fgPolicy = 0;
+    if (jid == 0) return status >= 0 ? -1 : 0;
+    getJobJid(jid, jobs)->interactive = 1;
+    return jid;
+}
+
+/* runScheduled
+ * Runs the cmdline of a schedule (see schedule.c) as a
+ * background job.  Returns its jid, or 0 for a builtin.
+ */
+int runScheduled(char * cmdline)
+{
+    if (builtin(cmdline)) return 0;
+    return evalJob(cmdline, 1);
+}
+
+/* runTask
+ * Runs the cmdline of a task of a dag (see dag.c) as a
+ * background job, bypassing the job queue since the dag limits
+ * its own jobs.  Returns its jid, 0 for a builtin or a job that
+ * ran in ush, with its wait status in status, or -1 if it could
+ * not start.
+ */
+int runTask(char * cmdline, int * status)
+{
+    int jid;
+    *status = 0;
+    if (builtin(cmdline)) return 0;
+    jid = runJob(cmdline, 1, 0, -1, -1, status);
+    if (jid > 0) return jid;
+    return *status >= 0 ? 0 : -1;
+}
+
+/* isBuiltinName
+ * Returns 1 if name is one of builtinNames.
+ */
+int isBuiltinName(char * name)
+{
+    int i;
+    for (i = 0; builtinNames[i] != NULL; i++)
+        if (strcmp(name, builtinNames[i]) == 0) return 1;
+    return 0;
+}
+
+/* runBuiltin
+ * Runs the builtin command in args. Returns 0 if args is
+ * not a builtin command.
+ */
+int runBuiltin(char ** args)
+{
+    int i;
+
+    if (args[0] == NULL) return 1;   //expanded to nothing
+    if (isAssignment(args[0])) {
+        //VAR=value cmd is run by runJob
+        for (i = 1; args[i] != NULL && isAssignment(args[i]); i++);
+        if (args[i] != NULL) return 0;
+        for (i = 0; args[i] != NULL; i++) assignVar(args[i], 0);
+        return 1;
+    }
+    if (strcmp(args[0],"quit") == 0 ) {
+        exit(0);
+        return 1;
+    }
+    if (strcmp(args[0],"jobs") == 0) {
+        jobsCmd(args);
+        return 1;
+    }
+    if (strcmp(args[0], "fg") == 0) {
+        continueJob(args[1], FG);
+        return 1;
+    }
+    if (strcmp(args[0], "bg") == 0) {
+        continueJob(args[1], BG);
+        return 1;
+    }
+    if (strcmp(args[0], "joblimit") == 0) {
+        if (args[1] == NULL) printf("%d\n", getJobLimit());
+        else setJobLimit(atoi(args[1]));
+        startQueuedJobs();
+        return 1;
+    }
+    if (strcmp(args[0], "policy") == 0) {
+        policyCmd(args);
+        return 1;
+    }
+    if (strcmp(args[0], "output") == 0) {
+        outputCmd(args);
+        return 1;
+    }
+    if (strcmp(args[0], "pstat") == 0) {
+        pstatCmd(args, jobs, watchWait);
+        return 1;
+    }
+    if (strcmp(args[0], "schedule") == 0) {
+        scheduleCmd(args);
+        return 1;
+    }
+    if (strcmp(args[0], "dag") == 0) {
+        dagCmd(args, jobs, runTask, watchWait);
+        return 1;
+    }
+    if (strcmp(args[0], "prefetch") == 0) {
+        prefetchCmd(args);
+        return 1;
+    }
+    if (strcmp(args[0], "throttle") == 0) {
+        throttleCmd(args);
+        return 1;
+    }
+    if (strcmp(args[0], "export") == 0) {
+        if (args[1] == NULL) printExported();
+        for (i = 1; args[i] != NULL; i++) {
+            if (isAssignment(args[i])) assignVar(args[i], 1);
+            else if (!exportVar(args[i]))
+                printf("export: %s: not set\n", args[i]);
+        }
+        return 1;
+    }
+    if (strcmp(args[0], "unset") == 0) {
+        for (i = 1; args[i] != NULL; i++) unsetVar(args[i]);
+        return 1;
+    }
+    if (strcmp(args[0], "kill") == 0) {
+        killCmd(args, jobs);
+        return 1;
+    }
+    return 0;
+}
+
+/* continueJob
+ * Handles the fg and bg builtins. arg is a job number
+ * preceded by a %.  The job is moved to the given state,
+ * the scheduling policy of that state is applied to each
+ * of its processes and the job is sent SIGCONT.  If the
+ * new state is FG the shell waits for the job.
+ */
+void continueJob(char * arg, int state)
+{
+    int j;
+    jobT * job = NULL;
+
+    if (arg != NULL && arg[0] == '%') job = getJobJid(atoi(&arg[1]), jobs);
+    if (job == NULL) {
+        printf("%s: no such job\n", state == FG ? "fg" : "bg");
+        return;
+    }
+    job->state = state;
+    saveJob(job, job - jobs);
+    for (j = 0; j < job->pidCnt; j ++) {
+        if (job->pid[j] != 0) applyPolicy(job->pid[j], state);
+    }
+    signalJob(job, SIGCONT);
+    if (state == FG) waitfg();
+}
+
+/* jobsCmd
+ * Handles the jobs builtin: jobs [-l] [-s cpu|mem] [--watch]
+ * -l lists the processes of each job with their resource use
+ * (see listJobsLong), -s orders the jobs by %CPU or memory and
+ * --watch refreshes the listing until a line is typed.  -s and
+ * --watch imply -l.
+ */
+void jobsCmd(char ** args)
+{
+    int i, longList = 0, watch = 0, sort = SORTJID;
+
+    for (i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "-l") == 0) longList = 1;
+        else if (strcmp(args[i], "--watch") == 0) watch = longList = 1;
+        else if (strcmp(args[i], "-s") == 0 && args[i + 1] != NULL) {
+            i++;
+            longList = 1;
+            if (strcmp(args[i], "cpu") == 0) sort = SORTCPU;
+            else if (strcmp(args[i], "mem") == 0) sort = SORTMEM;
+            else sort = SORTJID;
+        }
+        else {
+            printf("usage: jobs [-l] [-s cpu|mem] [--watch]\n");
+            return;
+        }
+    }
+    if (!longList) {
+        listJobs(jobs);
+        return;
+    }
+    do {
+        if (watch && isatty(1)) printf("\033[H\033[J");
+        listJobsLong(jobs, sort);
+        fflush(stdout);
+    } while (watch && watchWait(JOBSINTERVAL, 1));
 }
 
 /* waitfg
- * Calls sleep(1) within a loop, while the fgJobs(jobs) is 
+ * Runs the event loop while the fgJobs(jobs) is 
  * not NULL.  fgJobs(jobs) returns a pointer to the
  * foreground job.
  */
 void waitfg()
 {
     while ( fgJob(jobs) != NULL ){
-        sleep(1);
+        runEvents(-1);
     }
     return;
 }
@@ -262,71 +884,148 @@ void waitfg()
 /*
  * sigchildHandler
  * This is called when the shell receives the SIGCHLD signal (one if
- * its children has terminated).  It should reap all terminated child
- * process. If the process is the foreground process, nothing is
- * printed in response.  However if the process is a background process,
- * it should print either:
+ * its children has terminated). It wakes up the event loop, which
+ * reaps the children (see reapChildren).
+ */
+void sigchildHandler(int sig)
+{
+    int olderrno = errno;
+    char c = sig;
+    write(sigPipe[1], &c, 1);
+    errno = olderrno;
+}
+
+/* readSignals
+ * Event handler for sigPipe.  Empties the pipe and reaps
+ * the children that have terminated.
+ */
+void readSignals(int fd, short revents, void * arg)
+{
+    char buffer[64];
+    while (read(fd, buffer, sizeof(buffer)) > 0);
+    reapChildren();
+}
+
+/*
+ * reapChildren
+ * Reaps all terminated child processes. If the process is the 
+ * foreground process, nothing is printed in response.  However 
+ * if the process is a background process, it prints either:
  * jid killed
  * if the process terminated abnormally (for example, by a CTRL-C).
  * or
  * jid done
  * if the process terminated normally. It will only print if the
  * job is finished.  The job is finished when all processes within the
- * job terminate.
+ * job terminate.  A job with a stopped process is put in the ST
+ * state. Queued jobs are started in the slots that were freed.
+ * The wait status of the last command of the foreground job is
+ * kept in fgStatus; that of a finished job is passed on to the
+ * dag that may be waiting on it (see dagJobDone).
  */
-void sigchildHandler(int sig)
+void reapChildren()
 {
     int status;
-    int pid = 0;
-    while(pid == 0){pid = waitpid(-1, &status, WNOHANG);}
-    if(pid != -1){
-        int jid = pid2jid(pid,jobs);
-        jobT* job = getJobJid(jid, jobs);
+    int pid;
+    while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0){
+        jobT* job = getJobPid(pid, jobs);
+        if(job == NULL) continue;
+        if(WIFSTOPPED(status)){
+            job->state = ST;
+            saveJob(job, job - jobs);
+            continue;
+        }
+        int jid = job->jid;
         int state = job->state;
-        char buffer[MAXLINE];
-        strncpy(buffer,jobs->cmdline,MAXLINE - 1);
+        //unless the last command ran in ush (see runJob)
+        if (pid == job->pid[job->pidCnt - 1] && job->status < 0) job->status = status;
+        if (state == FG && pid == job->pid[job->pidCnt - 1]) fgStatus = job->status;
+        int last = job->status;
+        char * buffer = strdup(job->cmdline);
         int result = deletePid(pid,jobs);
+        if (result == 1) dagJobDone(jid, last);
         if(result == 1 && state == BG){
-            if(!WIFEXITED(status)){
+            if(!WIFEXITED(last)){
                 printf("[%d] killed  \t%s\n", jid, buffer);
             }else
             {
                 printf("[%d] done \t %s\n", jid, buffer);
             }
         }
+        free(buffer);
+    }
+    startQueuedJobs();
+}
+
+/* reapAdopted
+ * Event handler for the pidfd of a process of an adopted job (see
+ * adoptJobs in state.c), which gets the pid as arg.  The pidfd
+ * is readable once the process terminated.  Adopted processes
+ * are not children of ush, so their exit status is not known and
+ * a finished job is reported as done.
+ */
+void reapAdopted(int fd, short revents, void * arg)
+{
+    pid_t pid = (pid_t) (long) arg;
+    jobT * job = getJobPid(pid, jobs);
+
+    //the fd is the job's pidfd; deletePid removes and closes it
+    if (job == NULL) {
+        removeEvent(fd);
+        close(fd);
+        return;
+    }
+    int jid = job->jid;
+    int state = job->state;
+    char * buffer = strdup(job->cmdline);
+    if (deletePid(pid, jobs) == 1 && state != FG)
+        printf("[%d] done \t %s\n", jid, buffer);
+    free(buffer);
+    startQueuedJobs();
+}
+
+/* startQueuedJobs
+ * Starts queued jobs, shortest expected first (see dequeueJob
+ * in jobs.c), while fewer than getJobLimit() background jobs
+ * are running.  Jobs stopped by throttling (see pressure.c)
+ * count as running: starting others would add to the pressure.
+ */
+void startQueuedJobs()
+{
+    char * job;
+    int jid;
+    while (queueLength() > 0 && bgJobCount(jobs) + throttledJobs() < getJobLimit() 
+           && freeJobs(jobs) > 1) {
+        job = dequeueJob(&jid);
+        runJob(job, 1, jid, -1, -1, NULL);
+        free(job);
     }
 }
 
 /*
  * sigintHandler
  * This handler is executed if the shell is sent a SIGINT signal.
- * If there is a foreground process job, the handler should use
- * the kill command to send the signal to the foreground process
- * job using the foreground process group id.
+ * If there is a foreground process job, the signal is sent
+ * to its process group.
  */
 void sigintHandler(int sig)
 {
     int i;
+    //one killpg reaches every process of the job
     for (i = 0; i < MAXJOBS; i ++) {
-        if(jobs[i].state == FG){
-            int j;
-            for (j = 0; j < MAXPIDS; j ++) {
-                kill(jobs[i].pid[j], SIGINT);
-            }
-        }
+        if (jobs[i].state == FG && jobs[i].pgrp > 0) killpg(jobs[i].pgrp, SIGINT);
     }
-    fflush(NULL);
 }
 
-
-void closeAllOthers(int i, int cmdCnt, int fds[cmdCnt - 1][2])
+/*
+ * sigpipeHandler
+ * Catches SIGPIPE, so a write of ush (or of a command it runs in
+ * a thread, see inproc.c, or of pipepart feeding its copies) to a
+ * pipe whose reader is gone fails with EPIPE instead of killing
+ * ush.  The children get SIGPIPE as usual: a caught signal goes
+ * back to its default action on exec, where an ignored one would
+ * stay ignored.
+ */
+void sigpipeHandler(int sig)
 {
-    int j;
-    for(j = 0; j < cmdCnt; j ++){
-        if(i != j){
-            close(fds[j][0]);
-            close(fds[j][1]);
-        }
-    }
 }
-
@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "wrappers.h"
+#include "wildcard.h"
+
+typedef struct dirCache    /* A directory listing */
+{
+   dev_t dev;              /* device and inode of the directory */
+   ino_t ino;
+   struct timespec mtime;  /* mtime of the directory when it was read */
+   time_t loaded;          /* CLOCK_MONOTONIC seconds when it was read */
+   int busy;               /* number of expansions walking the entries */
+   int cnt;                /* number of entries */
+   char ** names;          /* entry names, pointing into buf */
+   unsigned char * types;  /* d_type of each entry */
+   char * buf;
+   struct dirCache * next; /* most recently used first */
+} dirCache;
+
+typedef struct             /* The paths matched by a pattern */
+{
+   char ** path;
+   int cnt;
+   int cap;
+} pathList;
+
+struct dent64              /* A record returned by getdents64 */
+{
+   unsigned long long d_ino;
+   long long d_off;
+   unsigned short d_reclen;
+   unsigned char d_type;
+   char d_name[];
+};
+
+static dirCache * cache = NULL;
+static char * dentBuf = NULL;
+
+//not needed outside of this file
+static void globPath(const char * prefix, char ** comps, int n, int i,
+                     pathList * out);
+static dirCache * lookupDir(const char * path);
+static int readDir(int fd, dirCache * d);
+static void freeDir(dirCache * d);
+static void trimCache();
+static int isDir(const char * prefix, const char * name, int type);
+static char * joinPath(const char * prefix, const char * name);
+static void addPath(pathList * out, char * path);
+static void stringSort(char ** a, int n, int depth);
+
+/* hasWildcard
+ * Returns 1 if word contains *, ? or a [ with a ] after it.
+ */
+int hasWildcard(const char * word)
+{
+   const char * open;
+
+   if (strpbrk(word, "*?") != NULL) return 1;
+   open = strchr(word, '[');
+   return open != NULL && strchr(open + 1, ']') != NULL;
+}
+
+/* expandWildcard
+ * Returns the sorted paths that match pattern, in an array of
+ * strings that is freed with freeExpansion.  The number of paths
+ * is stored in cnt. Returns NULL if nothing matches.
+ * For example, with the files a.c b.c and src/x.c the pattern
+ * "*.c" gives "a.c" "b.c", and a ** component in front of it
+ * gives "a.c" "b.c" "src/x.c".
+ */
+char ** expandWildcard(const char * pattern, int * cnt)
+{
+   char * copy = strdup(pattern);
+   char ** comps = Malloc((strlen(pattern) / 2 + 2) * sizeof(char *));
+   char * comp, * next;
+   int i, j, n = 0;
+   pathList out = { NULL, 0, 0 };
+
+   //split the pattern into path components; a trailing / gives
+   //an empty last component, which only matches directories
+   for (comp = copy; comp != NULL; comp = next)
+   {
+      next = strchr(comp, '/');
+      if (next != NULL) *next++ = '\0';
+      if (comp[0] != '\0' || next == NULL) comps[n++] = comp;
+   }
+   globPath(pattern[0] == '/' ? "/" : "", comps, n, 0, &out);
+   free(comps);
+   free(copy);
+
+   *cnt = 0;
+   if (out.cnt == 0)
+   {
+      free(out.path);
+      return NULL;
+   }
+   sortStrings(out.path, out.cnt);
+   //** can reach a path more than once
+   for (i = 1, j = 1; i < out.cnt; i++)
+   {
+      if (strcmp(out.path[i], out.path[j - 1]) == 0) free(out.path[i]);
+      else out.path[j++] = out.path[i];
+   }
+   *cnt = j;
+   return out.path;
+}
+
+/* freeExpansion
+ * Frees the paths returned by expandWildcard.
+ */
+void freeExpansion(char ** paths, int cnt)
+{
+   int i;
+   for (i = 0; i < cnt; i++) free(paths[i]);
+   free(paths);
+}
+
+/* sortStrings
+ * Sorts strs in byte order with a multikey quicksort, which
+ * looks at each character of a common prefix only once
+ * instead of once per comparison.
+ */
+void sortStrings(char ** strs, int cnt)
+{
+   stringSort(strs, cnt, 0);
+}
+
+/* globPath
+ * Adds to out the paths below prefix that match the components
+ * comps[i..n-1] of a pattern.
+ */
+static void globPath(const char * prefix, char ** comps, int n, int i,
+                     pathList * out)
+{
+   char * comp, * path;
+   dirCache * d;
+   int j, last;
+   struct stat st;
+
+   if (i == n)
+   {
+      addPath(out, strdup(prefix));
+      return;
+   }
+   comp = comps[i];
+   last = (i == n - 1);
+   if (!hasWildcard(comp) && strcmp(comp, "**") != 0)
+   {
+      path = joinPath(prefix, comp);
+      if (!last) globPath(path, comps, n, i + 1, out);
+      else if (lstat(path, &st) == 0)
+      {
+         addPath(out, path);
+         return;
+      }
+      free(path);
+      return;
+   }
+   if ((d = lookupDir(prefix)) == NULL) return;
+   d->busy++;
+   //** matches no directory at all as well
+   if (strcmp(comp, "**") == 0 && !last) globPath(prefix, comps, n, i + 1, out);
+   for (j = 0; j < d->cnt; j++)
+   {
+      if (strcmp(comp, "**") == 0)
+      {
+         //** does not follow symbolic links, so it cannot loop
+         if (d->names[j][0] == '.') continue;
+         path = joinPath(prefix, d->names[j]);
+         if (last) addPath(out, strdup(path));
+         if (d->types[j] == DT_DIR || (d->types[j] == DT_UNKNOWN
+             && lstat(path, &st) == 0 && S_ISDIR(st.st_mode)))
+            globPath(path, comps, n, i, out);
+         free(path);
+      } else if (fnmatch(comp, d->names[j], FNM_PERIOD) == 0)
+      {
+         if (!last && !isDir(prefix, d->names[j], d->types[j])) continue;
+         path = joinPath(prefix, d->names[j]);
+         globPath(path, comps, n, i + 1, out);
+         free(path);
+      }
+   }
+   d->busy--;
+}
+
+/* lookupDir
+ * Returns the listing of the directory path ("" is the current
+ * directory). A cached listing is used if it is younger than
+ * DIRCACHETTL seconds and the directory's mtime is unchanged.
+ * Returns NULL if the directory cannot be read.
+ */
+static dirCache * lookupDir(const char * path)
+{
+   int fd;
+   struct stat st;
+   struct timespec now;
+   dirCache * d, * prev = NULL;
+
+   fd = open(path[0] != '\0' ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd == -1) return NULL;
+   if (fstat(fd, &st) == -1)
+   {
+      close(fd);
+      return NULL;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   for (d = cache; d != NULL; prev = d, d = d->next)
+      if (d->dev == st.st_dev && d->ino == st.st_ino) break;
+   if (d != NULL && d->mtime.tv_sec == st.st_mtim.tv_sec
+       && d->mtime.tv_nsec == st.st_mtim.tv_nsec
+       && now.tv_sec - d->loaded < DIRCACHETTL)
+   {
+      close(fd);
+      //move the listing to the front
+      if (prev != NULL)
+      {
+         prev->next = d->next;
+         d->next = cache;
+         cache = d;
+      }
+      return d;
+   }
+   //a stale listing that is still being walked is left alone
+   //until the walk is done; it can no longer be found
+   if (d != NULL) d->dev = d->ino = 0;
+   d = calloc(1, sizeof(dirCache));
+   if (d == NULL || readDir(fd, d) == -1)
+   {
+      free(d);
+      close(fd);
+      return NULL;
+   }
+   close(fd);
+   d->dev = st.st_dev;
+   d->ino = st.st_ino;
+   d->mtime = st.st_mtim;
+   d->loaded = now.tv_sec;
+   d->next = cache;
+   cache = d;
+   trimCache();
+   return d;
+}
+
+/* readDir
+ * Reads the entries of the directory fd, except . and ..,
+ * into d with getdents64 calls of DENTBUFSIZE bytes.
+ * Returns -1 on an error.
+ */
+static int readDir(int fd, dirCache * d)
+{
+   long bytes, pos;
+   int len, cap = 0, size = 0, bufCap = 0, i;
+   struct dent64 * ent;
+   int * offsets = NULL;
+   char * p;
+
+   if (dentBuf == NULL) dentBuf = Malloc(DENTBUFSIZE);
+   while ((bytes = syscall(SYS_getdents64, fd, dentBuf, DENTBUFSIZE)) > 0)
+   {
+      for (pos = 0; pos < bytes; pos += ent->d_reclen)
+      {
+         ent = (struct dent64 *) (dentBuf + pos);
+         if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+         len = strlen(ent->d_name) + 1;
+         if (d->cnt == cap)
+         {
+            cap = cap ? cap * 2 : 64;
+            offsets = realloc(offsets, cap * sizeof(int));
+            d->types = realloc(d->types, cap);
+            if (offsets == NULL || d->types == NULL) unixError("realloc error");
+         }
+         if (size + len > bufCap)
+         {
+            bufCap = bufCap ? bufCap * 2 : 4096;
+            if (bufCap < size + len) bufCap = size + len;
+            p = realloc(d->buf, bufCap);
+            if (p == NULL) unixError("realloc error");
+            d->buf = p;
+         }
+         memcpy(d->buf + size, ent->d_name, len);
+         offsets[d->cnt] = size;
+         d->types[d->cnt++] = ent->d_type;
+         size += len;
+      }
+   }
+   d->names = Malloc((d->cnt + 1) * sizeof(char *));
+   for (i = 0; i < d->cnt; i++) d->names[i] = d->buf + offsets[i];
+   free(offsets);
+   if (bytes == -1)
+   {
+      freeDir(d);
+      return -1;
+   }
+   return 0;
+}
+
+/* freeDir
+ * Frees the entries of a listing.
+ */
+static void freeDir(dirCache * d)
+{
+   free(d->names);
+   free(d->types);
+   free(d->buf);
+   d->names = NULL;
+   d->types = NULL;
+   d->buf = NULL;
+   d->cnt = 0;
+}
+
+/* trimCache
+ * Frees the least recently used listings beyond DIRCACHEMAX,
+ * and stale ones, unless an expansion is walking them.
+ */
+static void trimCache()
+{
+   dirCache * d, ** link = &cache;
+   int cnt = 0;
+
+   while ((d = *link) != NULL)
+   {
+      cnt++;
+      if (d->busy == 0 && (cnt > DIRCACHEMAX || d->ino == 0))
+      {
+         *link = d->next;
+         freeDir(d);
+         free(d);
+      } else link = &d->next;
+   }
+}
+
+/* isDir
+ * Returns 1 if the entry name of directory prefix is a
+ * directory or a symbolic link to one.
+ */
+static int isDir(const char * prefix, const char * name, int type)
+{
+   struct stat st;
+   char * path;
+   int dir;
+
+   if (type == DT_DIR) return 1;
+   if (type != DT_LNK && type != DT_UNKNOWN) return 0;
+   path = joinPath(prefix, name);
+   dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+   free(path);
+   return dir;
+}
+
+/* joinPath
+ * Returns prefix/name in new space. An empty prefix is
+ * the current directory.
+ */
+static char * joinPath(const char * prefix, const char * name)
+{
+   int plen = strlen(prefix), nlen = strlen(name);
+   int slash = (plen > 0 && prefix[plen - 1] != '/');
+   char * path = Malloc(plen + slash + nlen + 1);
+
+   memcpy(path, prefix, plen);
+   if (slash) path[plen] = '/';
+   memcpy(path + plen + slash, name, nlen + 1);
+   return path;
+}
+
+/* addPath
+ * Appends path to out.
+ */
+static void addPath(pathList * out, char * path)
+{
+   if (out->cnt == out->cap)
+   {
+      out->cap = out->cap ? out->cap * 2 : 16;
+      out->path = realloc(out->path, out->cap * sizeof(char *));
+      if (out->path == NULL) unixError("realloc error");
+   }
+   out->path[out->cnt++] = path;
+}
+
+#define CH(s, d) ((unsigned char) (s)[d])
+
+/* stringSort
+ * Sorts the n strings of a, which are equal in their first
+ * depth characters.  The strings are split three ways on the
+ * character at depth; only the middle part moves on to the
+ * next character.
+ */
+static void stringSort(char ** a, int n, int depth)
+{
+   int lt, gt, i, j, v, c;
+   char * t;
+
+   while (n > 1)
+   {
+      if (n < 12)
+      {
+         for (i = 1; i < n; i++)
+            for (j = i; j > 0 && strcmp(a[j] + depth, a[j - 1] + depth) < 0; j--)
+            {
+               t = a[j]; a[j] = a[j - 1]; a[j - 1] = t;
+            }
+         return;
+      }
+      t = a[0]; a[0] = a[n / 2]; a[n / 2] = t;
+      v = CH(a[0], depth);
+      lt = 0;
+      gt = n - 1;
+      i = 1;
+      while (i <= gt)
+      {
+         c = CH(a[i], depth);
+         if (c < v)
+         {
+            t = a[lt]; a[lt++] = a[i]; a[i++] = t;
+         } else if (c > v)
+         {
+            t = a[gt]; a[gt--] = a[i]; a[i] = t;
+         } else i++;
+      }
+      stringSort(a, lt, depth);
+      stringSort(a + gt + 1, n - gt - 1, depth);
+      if (v == 0) return;
+      //the middle part continues with the next character
+      a += lt;
+      n = gt - lt + 1;
+      depth++;
+   }
+}
@@ -0,0 +1,21 @@
+/*
+ *  Wildcard (glob) expansion of command arguments.
+ *  *   matches any string, ? any character, [...] a set of
+ *  characters and a ** path component any number of directories.
+ *  Names that start with a . are only matched by a pattern that
+ *  starts with a . too.  The matches of a pattern are sorted in
+ *  byte order; a pattern without matches is left as it is.
+ *
+ *  Directory listings are read with large getdents64 calls and
+ *  kept for a few seconds, keyed by device, inode and mtime, so
+ *  repeated patterns over the same directory do not read it again.
+ */
+
+#define DIRCACHETTL    5           /* seconds a listing is kept */
+#define DIRCACHEMAX    32          /* listings kept at most */
+#define DENTBUFSIZE    (1 << 18)   /* bytes read per getdents64 call */
+
+int hasWildcard(const char * word);
+char ** expandWildcard(const char * pattern, int * cnt);
+void freeExpansion(char ** paths, int cnt);
+void sortStrings(char ** strs, int cnt);
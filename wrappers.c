@@ -1,3 +1,7 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "wrappers.h"
 
@@ -93,6 +97,17 @@ int Pipe(int pipefd[2])
    return 0;
 }
 
+/* Pipe2
+ * Wrapper for pipe2.
+ * Like pipe, but with flags like O_CLOEXEC set on both ends
+ * atomically.
+ */
+int Pipe2(int pipefd[2], int flags)
+{
+   if (pipe2(pipefd, flags) == -1) unixError("pipe2 error");
+   return 0;
+}
+
 
 /* Malloc
  * Wrapper for malloc.
@@ -217,3 +232,76 @@ void *Signal(int signum, void (*handler)(int))
    return (old_action.sa_handler);
 }
 
+/* seconds
+ * Returns the monotonic time in seconds.
+ */
+double seconds()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* nextWord
+ * Returns the next blank separated word at *p in new space and
+ * moves *p past it.  Returns NULL if there is none.
+ */
+char * nextWord(char ** p)
+{
+   char * start = *p + strspn(*p, BLANKS);
+   int len = strcspn(start, BLANKS);
+
+   *p = start + len;
+   return len > 0 ? strndup(start, len) : NULL;
+}
+
+/* cachePath
+ * Returns, in new space, the path of the cache file or directory
+ * name of ush: var (the value of the variable that names it) if
+ * it is set and ~/.cache/name otherwise (~/.cache is made if
+ * needed).  Returns NULL, so there is no cache, if there is no
+ * home directory or ~/.cache is not a directory of the user's;
+ * a shared directory like /tmp would let others plant entries.
+ */
+char * cachePath(char * var, char * home, char * name)
+{
+   char * path;
+   struct stat st;
+
+   if (var != NULL && var[0] != '\0') return strdup(var);
+   if (home == NULL || home[0] == '\0') return NULL;
+   path = Malloc(strlen(home) + strlen(name) + 16);
+   sprintf(path, "%s/.cache", home);
+   mkdir(path, 0700);
+   if (lstat(path, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid())
+   {
+      free(path);
+      return NULL;
+   }
+   strcat(path, "/");
+   strcat(path, name);
+   return path;
+}
+
+/* saveAtomic
+ * Writes the file at path with writeFn, to a temporary file that
+ * is then renamed over the old one, so a reader never sees half
+ * of it.  Returns 1 if the file was written and 0 otherwise.
+ */
+int saveAtomic(char * path, void (*writeFn)(FILE * fp))
+{
+   char * tmp = Malloc(strlen(path) + 16);
+   FILE * fp;
+   int saved = 0;
+
+   sprintf(tmp, "%s.%d", path, (int) getpid());
+   if ((fp = fopen(tmp, "w")) != NULL)
+   {
+      writeFn(fp);
+      if (fclose(fp) == 0 && rename(tmp, path) == 0) saved = 1;
+      else unlink(tmp);
+   }
+   free(tmp);
+   return saved;
+}
@@ -7,6 +7,8 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#define BLANKS " \t\n\v\f\r"   /* separate the words of a job */
+
 void unixError(char * msg);
 int Fork();
 int Execvp(char * path, char * argv[]);
@@ -20,4 +22,9 @@ int Dup2(int oldfd, int newfd);
 int Close(int fildes);
 int Setpgid(pid_t pid, pid_t pgid);
 int Pipe(int pipefd[2]);
+int Pipe2(int pipefd[2], int flags);
 pid_t Waitpid(pid_t pid, int *status, int options); 
+double seconds();
+char * nextWord(char ** p);
+char * cachePath(char * var, char * home, char * name);
+int saveAtomic(char * path, void (*writeFn)(FILE * fp));